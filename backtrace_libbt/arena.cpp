@@ -0,0 +1,58 @@
+
+#include "arena.h"
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+Arena::Arena(std::size_t i_chunkSize)
+ : m_chunkSize(i_chunkSize),
+   m_chunks(nullptr),
+   m_current(nullptr),
+   m_end(nullptr),
+   m_bytesReserved(0) {
+}
+
+Arena::~Arena() {
+    while (m_chunks) {
+        Chunk* next = m_chunks->m_next;
+        std::free(m_chunks);
+        m_chunks = next;
+    }
+}
+
+void* Arena::allocate(std::size_t i_size, std::size_t i_alignment) {
+    std::uintptr_t current = reinterpret_cast<std::uintptr_t>(m_current);
+    std::uintptr_t aligned = (current + i_alignment - 1) & ~(i_alignment - 1);
+    if (! m_current || aligned + i_size > reinterpret_cast<std::uintptr_t>(m_end)) {
+
+        //! an oversized request gets a chunk of its own
+        std::size_t payload = i_size + i_alignment > m_chunkSize ?
+            i_size + i_alignment : m_chunkSize;
+        std::size_t total = sizeof(Chunk) + payload;
+        Chunk* chunk = static_cast<Chunk *>(std::malloc(total));
+        if (! chunk) {
+            throw std::bad_alloc();
+        }
+        chunk->m_next = m_chunks;
+        m_chunks = chunk;
+        m_bytesReserved += total;
+        m_current = reinterpret_cast<char *>(chunk + 1);
+        m_end = reinterpret_cast<char *>(chunk) + total;
+        current = reinterpret_cast<std::uintptr_t>(m_current);
+        aligned = (current + i_alignment - 1) & ~(i_alignment - 1);
+    }
+    m_current = reinterpret_cast<char *>(aligned + i_size);
+    return reinterpret_cast<void *>(aligned);
+}
+
+string_view_t Arena::copy(string_view_t i_str) {
+    char* p = static_cast<char *>(allocate(i_str.size() + 1));
+    std::memcpy(p, i_str.data(), i_str.size());
+    p[i_str.size()] = '\0';
+    return string_view_t(p, i_str.size());
+}
+
+std::size_t Arena::bytesReserved() const {
+    return m_bytesReserved;
+}
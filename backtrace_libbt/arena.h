@@ -0,0 +1,42 @@
+#ifndef _BKTCE_ARENA_H
+#define _BKTCE_ARENA_H
+
+#include "bktce.h"
+
+//! A bump allocator that hands out memory from large chunks and frees
+//! everything at once when it is destroyed;
+//! Used to store the long-lived bits of the symbolizer (interned names,
+//! demangled symbols) without one heap allocation per string;
+//! NOT thread-safe: the owner must serialize the calls
+class Arena {
+public:
+    explicit Arena(std::size_t i_chunkSize = 64 * 1024);
+    ~Arena();
+
+    //! Returns i_size bytes aligned to i_alignment (a power of 2);
+    //! the memory stays valid until the arena is destroyed
+    void* allocate(std::size_t i_size, std::size_t i_alignment = 1);
+
+    //! Copies the string (plus a terminating null) into the arena
+    string_view_t copy(string_view_t i_str);
+
+    //! Number of bytes requested from the system so far
+    std::size_t bytesReserved() const;
+
+private:
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    //! chunks are chained through their first bytes
+    struct Chunk {
+        Chunk* m_next;
+    };
+
+    std::size_t m_chunkSize;
+    Chunk* m_chunks;
+    char* m_current;
+    char* m_end;
+    std::size_t m_bytesReserved;
+};
+
+#endif // _BKTCE_ARENA_H
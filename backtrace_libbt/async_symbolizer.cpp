@@ -0,0 +1,205 @@
+
+#include "async_symbolizer.h"
+
+#include <chrono>
+#include <ostream>
+
+TraceSink::~TraceSink() {
+}
+
+void TraceSink::flush() {
+}
+
+StreamSink::StreamSink(std::ostream& o_stream)
+ : m_stream(o_stream) {
+}
+
+void StreamSink::write(std::uint64_t i_tag, const Stacktrace& i_stack) {
+    m_stream << "trace " << i_tag << ":\n";
+    for (const Frame& frame : i_stack.getFrames()) {
+        m_stream << "    " << frame.toString();
+    }
+    if (i_stack.truncated()) {
+        m_stream << "    ... (truncated)\n";
+    }
+}
+
+void StreamSink::flush() {
+    m_stream.flush();
+}
+
+FileSink::FileSink(const char* i_path)
+ : StreamSink(m_file),
+   m_file(i_path, std::ios::app) {
+}
+
+bool_t FileSink::isOpen() const {
+    return m_file.is_open();
+}
+
+AsyncSymbolizer::AsyncSymbolizer(TraceSink& o_sink,
+                                 std::size_t i_capacity,
+                                 OverflowPolicy i_policy)
+ : m_sink(o_sink),
+   m_policy(i_policy),
+   m_mask(0),
+   m_slots(nullptr),
+   m_enqueuePosition(0),
+   m_dequeuePosition(0),
+   m_dropped(0),
+   m_delivered(0),
+   m_stop(false),
+   m_sleeping(false) {
+    std::size_t capacity = 2;
+    while (capacity < i_capacity) {
+        capacity <<= 1;
+    }
+    m_mask = capacity - 1;
+    m_slots = new Slot[capacity];
+    for (std::size_t i = 0; i < capacity; ++i) {
+        m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+    m_worker = std::thread(&AsyncSymbolizer::run, this);
+}
+
+AsyncSymbolizer::~AsyncSymbolizer() {
+    m_stop.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wakeUp.notify_one();
+    }
+    m_worker.join();
+    delete[] m_slots;
+}
+
+AsyncSymbolizer::Slot* AsyncSymbolizer::acquire(std::size_t& o_position) {
+    std::size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+        Slot* slot = &m_slots[position & m_mask];
+        std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+        if (diff == 0) {
+            if (m_enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                        std::memory_order_relaxed)) {
+                o_position = position;
+                return slot;
+            }
+        } else if (diff < 0) {
+            //! the slot still holds a trace the worker has not taken
+            if (m_policy == OverflowPolicy::DropNewest) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            std::this_thread::yield();
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+        } else {
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void AsyncSymbolizer::publish(Slot* i_slot, std::size_t i_position) {
+    i_slot->m_sequence.store(i_position + 1, std::memory_order_release);
+    //! the producer only takes the mutex when the worker is idle
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wakeUp.notify_one();
+    }
+}
+
+bool_t AsyncSymbolizer::capture(std::uint64_t i_tag, std::size_t i_numSkippedFrames) {
+    std::size_t position = 0;
+    Slot* slot = acquire(position);
+    if (! slot) {
+        return false;
+    }
+    bool_t truncated = false;
+    //! skip capture() itself
+    slot->m_size = static_cast<std::uint32_t>(
+        unwindStack(slot->m_frames, s_maxDepth, i_numSkippedFrames + 1, &truncated));
+    slot->m_truncated = truncated;
+    slot->m_tag = i_tag;
+    publish(slot, position);
+    return true;
+}
+
+bool_t AsyncSymbolizer::push(const native_frame_ptr_t* i_begin,
+                             std::size_t i_size,
+                             bool_t i_truncated,
+                             std::uint64_t i_tag) {
+    std::size_t position = 0;
+    Slot* slot = acquire(position);
+    if (! slot) {
+        return false;
+    }
+    if (i_size > s_maxDepth) {
+        i_size = s_maxDepth;
+        i_truncated = true;
+    }
+    for (std::size_t i = 0; i < i_size; ++i) {
+        slot->m_frames[i] = i_begin[i];
+    }
+    slot->m_size = static_cast<std::uint32_t>(i_size);
+    slot->m_truncated = i_truncated;
+    slot->m_tag = i_tag;
+    publish(slot, position);
+    return true;
+}
+
+void AsyncSymbolizer::run() {
+    while (true) {
+        std::size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+        Slot* slot = &m_slots[position & m_mask];
+        if (slot->m_sequence.load(std::memory_order_acquire) == position + 1) {
+            Stacktrace st(slot->m_frames, slot->m_frames + slot->m_size, slot->m_truncated);
+            std::uint64_t tag = slot->m_tag;
+            //! the slot is free as soon as the PCs are copied out
+            slot->m_sequence.store(position + m_mask + 1, std::memory_order_release);
+            m_dequeuePosition.store(position + 1, std::memory_order_relaxed);
+            st.resolve();
+            m_sink.write(tag, st);
+            m_delivered.fetch_add(1, std::memory_order_release);
+            continue;
+        }
+
+        //! the queue is empty
+        m_sink.flush();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_drained.notify_all();
+        if (m_stop.load()) {
+            //! a producer may still be filling a claimed slot
+            if (m_enqueuePosition.load() == m_dequeuePosition.load(std::memory_order_relaxed)) {
+                return;
+            }
+            lock.unlock();
+            std::this_thread::yield();
+            continue;
+        }
+        m_sleeping.store(true);
+        //! the timeout covers a producer that publishes between the
+        //! check above and the store of m_sleeping
+        m_wakeUp.wait_for(lock, std::chrono::milliseconds(10));
+        m_sleeping.store(false);
+    }
+}
+
+void AsyncSymbolizer::flush() {
+    std::size_t target = m_enqueuePosition.load();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_wakeUp.notify_one();
+    while (m_delivered.load() < target) {
+        m_drained.wait_for(lock, std::chrono::milliseconds(10));
+    }
+}
+
+std::uint64_t AsyncSymbolizer::pushed() const {
+    return m_enqueuePosition.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AsyncSymbolizer::dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AsyncSymbolizer::delivered() const {
+    return m_delivered.load(std::memory_order_relaxed);
+}
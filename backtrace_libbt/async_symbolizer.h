@@ -0,0 +1,143 @@
+#ifndef _BKTCE_ASYNC_SYMBOLIZER_H
+#define _BKTCE_ASYNC_SYMBOLIZER_H
+
+#include "bktce.h"
+#include "raw_stacktrace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+
+//! Receives the symbolized traces of an AsyncSymbolizer; write() and
+//! flush() are only ever called from the worker thread
+class TraceSink {
+public:
+    virtual ~TraceSink();
+
+    //! i_tag is what the producer passed along with the trace
+    virtual void write(std::uint64_t i_tag, const Stacktrace& i_stack) = 0;
+
+    virtual void flush();
+};
+
+//! Writes traces to a stream in the format of simple_backtrace()
+class StreamSink : public TraceSink {
+public:
+    explicit StreamSink(std::ostream& o_stream);
+
+    void write(std::uint64_t i_tag, const Stacktrace& i_stack) override;
+
+    void flush() override;
+
+private:
+    std::ostream& m_stream;
+};
+
+//! Appends traces to a file
+class FileSink : public StreamSink {
+public:
+    explicit FileSink(const char* i_path);
+
+    bool_t isOpen() const;
+
+private:
+    std::ofstream m_file;
+};
+
+//! What a producer does when the queue is full
+enum class OverflowPolicy {
+    //! wait for the worker to free a slot
+    Block,
+    //! discard the new trace and count it
+    DropNewest
+};
+
+//! Moves symbolization off the threads that capture traces;
+//! Producers unwind straight into a slot of a bounded lock-free
+//! multi-producer queue (Dmitry Vyukov's array queue) and return;
+//! a worker thread turns each slot into a Stacktrace, symbolizes it
+//! and hands it to the sink; so the latency a producer sees is the
+//! unwinding alone, never the DWARF parsing;
+//! The destructor delivers what is still queued, then stops the worker
+class AsyncSymbolizer {
+public:
+    static const std::size_t s_maxDepth = 64;
+
+    //! i_capacity is rounded up to a power of 2
+    explicit AsyncSymbolizer(TraceSink& o_sink,
+                             std::size_t i_capacity = 1024,
+                             OverflowPolicy i_policy = OverflowPolicy::DropNewest);
+    ~AsyncSymbolizer();
+
+    //! Captures the calling thread's stack (frame 0 is the caller of
+    //! capture(), unless i_numSkippedFrames says otherwise) and queues
+    //! it; returns false if the trace was dropped
+    __attribute__((noinline))
+    bool_t capture(std::uint64_t i_tag = 0, std::size_t i_numSkippedFrames = 0);
+
+    //! Queues an already captured trace; returns false if it was dropped
+    bool_t push(const native_frame_ptr_t* i_begin,
+                std::size_t i_size,
+                bool_t i_truncated,
+                std::uint64_t i_tag = 0);
+
+    template<std::size_t N>
+    bool_t push(const RawStacktrace<N>& i_stack, std::uint64_t i_tag = 0) {
+        return push(i_stack.begin(), i_stack.size(), i_stack.truncated(), i_tag);
+    }
+
+    //! Waits until everything queued so far has reached the sink
+    void flush();
+
+    //! Number of traces queued
+    std::uint64_t pushed() const;
+
+    //! Number of traces dropped because the queue was full
+    std::uint64_t dropped() const;
+
+    //! Number of traces written to the sink
+    std::uint64_t delivered() const;
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> m_sequence;
+        std::uint64_t m_tag;
+        std::uint32_t m_size;
+        std::uint32_t m_truncated;
+        native_frame_ptr_t m_frames[s_maxDepth];
+    };
+
+    AsyncSymbolizer(const AsyncSymbolizer&) = delete;
+    AsyncSymbolizer& operator=(const AsyncSymbolizer&) = delete;
+
+    //! Claims the next free slot; nullptr if the queue is full and the
+    //! policy is DropNewest
+    Slot* acquire(std::size_t& o_position);
+
+    //! Hands a filled slot over to the worker
+    void publish(Slot* i_slot, std::size_t i_position);
+
+    void run();
+
+    TraceSink& m_sink;
+    OverflowPolicy m_policy;
+    std::size_t m_mask;
+    Slot* m_slots;
+
+    alignas(64) std::atomic<std::size_t> m_enqueuePosition;
+    alignas(64) std::atomic<std::size_t> m_dequeuePosition;
+    alignas(64) std::atomic<std::uint64_t> m_dropped;
+    std::atomic<std::uint64_t> m_delivered;
+
+    std::atomic<bool_t> m_stop;
+    std::atomic<bool_t> m_sleeping;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    std::condition_variable m_drained;
+    std::thread m_worker;
+};
+
+#endif // _BKTCE_ASYNC_SYMBOLIZER_H
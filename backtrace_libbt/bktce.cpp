@@ -1,56 +1,38 @@
 
 #include "bktce.h"
+#include "demangle.h"
+#include "format.h"
+#include "frame_cache.h"
+#include "intern.h"
+#include "raw_stacktrace.h"
+#include "symbolizer.h"
 
 #include <iostream>
-#include <iomanip>
-#include <sstream>
 
 #include <unwind.h>
 #include <backtrace.h>
 #include <dlfcn.h>
-#include <cxxabi.h>
+#include <unistd.h>
 
 namespace {
 
-//! A helper function to encapsulate symbol-demangling
-string_t demangle(const char* i_symbol) {
-    int status = 0;
-    std::size_t size = 0;
-    char* p = abi::__cxa_demangle(i_symbol, nullptr, &size, &status);
-    
-    //! if demangling has no effect or it fails for some reason, 
-    //! return the original symbol back;
-    if (p == nullptr || status != 0) {
-        return i_symbol;
-    }
-    
-    string_t tmp(p);
-    std::free(p);
-    return tmp;    
-}
-
 //! Get the binary target's filename from a frame pointer via the gnu 
 //! linker;
 //! This function is called if the translator fails to translate the 
 //! frame pointer to a source code location;
-string_t getBinaryFilenameLD(native_frame_ptr_t i_address) {
+string_id_t getBinaryFilenameLD(native_frame_ptr_t i_address) {
     Dl_info dli;
-    if (! dladdr(const_cast<void*>(i_address), &dli)) {
-        return "";
+    if (! dladdr(const_cast<void*>(i_address), &dli) || ! dli.dli_fname) {
+        return StringTable::s_emptyId;
     }
-    return dli.dli_fname;
+    return StringTable::instance().intern(dli.dli_fname);
 }
 
-//! Must be called before any call to backtrace_pcinfo()
-//! Must be called only once!
-//! DO NOT free/delete (its storage is managed by libbacktrace)
-backtrace_state* backtraceState = nullptr;
-
 //! libbacktrace callback argument
 //! See gcc/libbacktrace/backtrace.h
 struct PCData {
-    string_t* function;
-    string_t* filename;
+    string_id_t function;
+    string_id_t filename;
     std::size_t lineNumber;
 };
 
@@ -62,16 +44,41 @@ int libbacktrace_full_callback(void* o_data,
                                int i_lineno, 
                                const char* i_function) {
     PCData& data = *static_cast<PCData *>(o_data);
-    if (data.filename && i_filename) {
-        *data.filename = i_filename;
+    if (i_filename) {
+        data.filename = StringTable::instance().intern(i_filename);
     }
-    if (data.function && i_function) {
-        *data.function = demangle(i_function);
+    if (i_function) {
+        data.function = Demangler::instance().demangle(i_function);
     }
     data.lineNumber = static_cast<std::size_t>(i_lineno);
     return 0;
 }
 
+//! libbacktrace callback function for backtrace_pcinfo_batch();
+//! o_data is an array of PCData, one per PC of the batch
+int libbacktrace_batch_callback(void* o_data,
+                                std::size_t i_index,
+                                uintptr_t i_pc,
+                                const char* i_filename,
+                                int i_lineno,
+                                const char* i_function) {
+    PCData* data = static_cast<PCData *>(o_data);
+    return libbacktrace_full_callback(&data[i_index], i_pc, i_filename, i_lineno, i_function);
+}
+
+//! Turns what libbacktrace reported for a PC into a ResolvedFrame;
+//! falls back to the gnu linker for the binary filename
+ResolvedFrame toResolvedFrame(native_frame_ptr_t i_address, const PCData& i_data) {
+    ResolvedFrame resolved;
+    resolved.m_function = i_data.function;
+    resolved.m_sourceFilename = i_data.filename;
+    resolved.m_sourceLineNumber = static_cast<std::uint32_t>(i_data.lineNumber);
+    if (resolved.m_sourceFilename == StringTable::s_emptyId || resolved.m_sourceLineNumber == 0) {
+        resolved.m_binaryFilename = getBinaryFilenameLD(i_address);
+    }
+    return resolved;
+}
+
 //! libbacktrace callback function;
 //! We don't have a use case where we would need to handle failed
 //! backtrace operation hence the empty function body;
@@ -87,6 +94,7 @@ struct UnwindState {
     std::size_t m_numSkippedFrames;
     native_frame_ptr_t* m_current;
     native_frame_ptr_t* m_end;
+    bool_t m_truncated;
 };
 
 //! this is the callback function passed to _Unwind_Backtrace;
@@ -107,49 +115,93 @@ _Unwind_Reason_Code unwindCallback(_Unwind_Context* i_context, void* i_state) {
     }
     state = static_cast<UnwindState *>(i_state);
 
+    native_frame_ptr_t ip = reinterpret_cast<native_frame_ptr_t>(_Unwind_GetIP(i_context));
+
+    //! identify the end of stack condition
+    if (! ip) {
+        return _URC_END_OF_STACK;
+    }
+
     //! to skip the first N frames
     //! note that while skipping, it can already reach the end of the stack
     if (state->m_numSkippedFrames) {
         state->m_numSkippedFrames -= 1;
-        if (_Unwind_GetIP(i_context)) {
-            return _URC_NO_REASON;
-        } else {
-            return _URC_END_OF_STACK;
-        }
+        return _URC_NO_REASON;
+    }
+
+    //! the buffer is full but the stack goes on: record the loss
+    //! instead of dropping the remaining frames silently
+    if (state->m_current == state->m_end) {
+        state->m_truncated = true;
+        return _URC_END_OF_STACK;
     }
 
     //! during iteration;
     //! populate the state structure fields
-    *state->m_current =  reinterpret_cast<native_frame_ptr_t>(_Unwind_GetIP(i_context));
+    *state->m_current = ip;
     state->m_current += 1;
 
-    //! identify the end of stack condition
-    if (!*(state->m_current - 1) || state->m_current == state->m_end) {
-        return _URC_END_OF_STACK;
-    }
-
     //! continue iteration
     return _URC_NO_REASON;
 }
 
 }
 
+//! thousands of traces may be kept in memory for aggregation
+static_assert(sizeof(Frame) <= 24, "Frame is meant to be a compact record");
+
 Frame::Frame(native_frame_ptr_t i_address)
- : m_native(i_address) {
-    PCData data = {&m_function, &m_sourceFilename, 0};
-    if (backtraceState) {
-        backtrace_pcinfo(
-            backtraceState,
-            reinterpret_cast<uintptr_t>(i_address),
-            &libbacktrace_full_callback,
-            &libbacktrace_error_callback,
-            &data
-        );
-        m_sourceLineNumber = data.lineNumber;
+ : m_native(i_address),
+   m_function(StringTable::s_emptyId),
+   m_sourceFilename(StringTable::s_emptyId),
+   m_binaryFilename(StringTable::s_emptyId),
+   m_sourceLineNumber(0),
+   m_resolved(0) {
+}
+
+void Frame::resolve() const {
+    if (m_resolved) {
+        return;
     }
-    if (! hasSourceInfo()) {
-        m_binaryFilename = getBinaryFilenameLD(m_native);
+
+    //! repeated call sites are served by the process-wide cache
+    ResolvedFrame resolved;
+    FrameCache& cache = FrameCache::instance();
+    Symbolizer& symbolizer = Symbolizer::instance();
+    unsigned long long generation = symbolizer.generation();
+    if (! cache.lookup(m_native, generation, resolved)) {
+        //! the PC may be in a library loaded since; the loader is only
+        //! asked on a miss
+        if (symbolizer.refreshModules()) {
+            generation = symbolizer.generation();
+        }
+        PCData data = {StringTable::s_emptyId, StringTable::s_emptyId, 0};
+        backtrace_state* backtraceState = symbolizer.state();
+        if (backtraceState) {
+            backtrace_pcinfo(
+                backtraceState,
+                reinterpret_cast<uintptr_t>(m_native),
+                &libbacktrace_full_callback,
+                &libbacktrace_error_callback,
+                &data
+            );
+        }
+        resolved = toResolvedFrame(m_native, data);
+        cache.insert(m_native, generation, resolved);
     }
+    assign(resolved);
+}
+
+void Frame::assign(const ResolvedFrame& i_resolved) const {
+    m_function = i_resolved.m_function;
+    m_sourceFilename = i_resolved.m_sourceFilename;
+    m_binaryFilename = i_resolved.m_binaryFilename;
+    m_sourceLineNumber = i_resolved.m_sourceLineNumber;
+    m_resolved = 1;
+}
+
+bool_t Frame::isResolved() const {
+    return m_resolved;
 }
 
 native_frame_ptr_t Frame::get() const {
@@ -157,89 +209,193 @@ native_frame_ptr_t Frame::get() const {
 }
 
 bool_t Frame::hasSourceInfo() const {
-    return m_sourceFilename.size() > 0 && m_sourceLineNumber > 0;
+    resolve();
+    return m_sourceFilename != StringTable::s_emptyId && m_sourceLineNumber > 0;
 }
 
-const string_t& Frame::getSourceFilename() const {
-    return m_sourceFilename;
+string_view_t Frame::getFunction() const {
+    resolve();
+    return StringTable::instance().get(m_function);
+}
+
+string_view_t Frame::getSourceFilename() const {
+    resolve();
+    return StringTable::instance().get(m_sourceFilename);
 }
     
-const string_t& Frame::getBinaryFilename() const {
-    return m_binaryFilename;
+string_view_t Frame::getBinaryFilename() const {
+    resolve();
+    return StringTable::instance().get(m_binaryFilename);
 }
     
 std::size_t Frame::getSourceLineNumber() const {
+    resolve();
     return m_sourceLineNumber;
 }
 
 string_t Frame::toString() const {
-    std::stringstream ss;
-    ss << std::hex << m_native << std::dec << " ";
-    if (hasSourceInfo()) {
-        ss << m_function << " at " << m_sourceFilename << ":" << m_sourceLineNumber;
-    } else {
-        ss << " in " << m_binaryFilename;
+    char buffer[1024];
+    std::size_t length = formatFrame(*this, FrameFormat::Full, buffer, sizeof(buffer));
+    if (length < sizeof(buffer)) {
+        return string_t(buffer, length);
     }
-    ss << std::endl;    
-    return ss.str();
+    //! a long template name
+    string_t s(length, '\0');
+    formatFrame(*this, FrameFormat::Full, &s[0], length + 1);
+    return s;
 }
 
 const std::vector<Frame>& Stacktrace::getFrames() const {
     return m_frames;
 }
 
+void Stacktrace::resolve() const {
+
+    //! the frames missing from the cache are symbolized together: the
+    //! batch lookup sorts their PCs and walks each compilation unit
+    //! once instead of searching for every PC independently
+    std::vector<std::size_t> pending;
+    std::vector<uintptr_t> pcs;
+    FrameCache& cache = FrameCache::instance();
+    Symbolizer& symbolizer = Symbolizer::instance();
+    unsigned long long generation = symbolizer.generation();
+    for (std::size_t i = 0; i < m_frames.size(); ++i) {
+        const Frame& fr = m_frames[i];
+        if (fr.isResolved()) {
+            continue;
+        }
+        ResolvedFrame resolved;
+        if (cache.lookup(fr.get(), generation, resolved)) {
+            fr.assign(resolved);
+            continue;
+        }
+        pending.push_back(i);
+        pcs.push_back(reinterpret_cast<uintptr_t>(fr.get()));
+    }
+    if (pending.empty()) {
+        return;
+    }
+
+    //! once per trace, and only for the misses (see Frame::resolve())
+    if (symbolizer.refreshModules()) {
+        generation = symbolizer.generation();
+    }
+    PCData empty = {StringTable::s_emptyId, StringTable::s_emptyId, 0};
+    std::vector<PCData> results(pending.size(), empty);
+    backtrace_state* backtraceState = symbolizer.state();
+    if (backtraceState) {
+        backtrace_pcinfo_batch(
+            backtraceState,
+            pcs.data(),
+            pcs.size(),
+            &libbacktrace_batch_callback,
+            &libbacktrace_error_callback,
+            results.data()
+        );
+    }
+    for (std::size_t k = 0; k < pending.size(); ++k) {
+        const Frame& fr = m_frames[pending[k]];
+        ResolvedFrame resolved = toResolvedFrame(fr.get(), results[k]);
+        cache.insert(fr.get(), generation, resolved);
+        fr.assign(resolved);
+    }
+}
+
+std::size_t Stacktrace::hash() const {
+    //! FNV-1a over the frame pointers; the symbolized information does
+    //! not take part in the hash, so hashing never resolves a frame
+    std::size_t h = 14695981039346656037ULL;
+    for (const Frame& fr : m_frames) {
+        h ^= reinterpret_cast<std::size_t>(fr.get());
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool_t Stacktrace::operator==(const Stacktrace& i_other) const {
+    if (m_frames.size() != i_other.m_frames.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < m_frames.size(); ++i) {
+        if (m_frames[i].get() != i_other.m_frames[i].get()) {
+            return false;
+        }
+    }
+    return true;
+}
+
 std::size_t Stacktrace::size() const {
     return m_frames.size();
 }
 
-Stacktrace::Stacktrace(std::size_t i_numSkippedFrames) {
+Stacktrace::Stacktrace(std::size_t i_numSkippedFrames)
+ : m_truncated(false) {
     
     //! about the hardcoded max stack size:
     //! 128 is seen in boost's implementation (1.68.0);
     //! however in a deep recursion (such as the linear optimization
     //! algorithm) the number of frames could go beyond 128 even 256,
-    //! hence the choice of 512 here
-    static const int s_maxStackSize = 512;
-    std::vector<native_frame_ptr_t> buf(s_maxStackSize, nullptr);
-    std::size_t numFramesCollected = 0;
+    //! hence the choice of 512 here;
+    //! the buffer lives on the stack (4KB) so that the only heap
+    //! allocation is the exact-sized vector of frames
+    static const std::size_t s_maxStackSize = 512;
+    native_frame_ptr_t buf[s_maxStackSize];
 
-    UnwindState state = {
-        i_numSkippedFrames,
-        buf.data(),
-        buf.data() + s_maxStackSize,
-    };
-    _Unwind_Backtrace(&unwindCallback, &state);
+    std::size_t numFramesCollected = unwindStack(
+        buf, s_maxStackSize, i_numSkippedFrames, &m_truncated);
 
-    //! calculate the number of collected frame pointers
-    for (std::size_t i = 0; i < s_maxStackSize; ++i) {
-        if (buf[i] == nullptr) {
-            break;
-        }
-        numFramesCollected++;
-    }
-    
     //! can not see any frame 
     if (! numFramesCollected) {
         return;
     }
 
-    //! SetUp() global state
-    backtraceState = backtrace_create_state(
-        nullptr,
-        0,
-        &libbacktrace_error_callback,
-        nullptr);
-    m_frames.reserve(numFramesCollected);
-    for (std::size_t i = 0; i < numFramesCollected; ++i) {
+    assign(buf, buf + numFramesCollected);
+}
+
+Stacktrace::Stacktrace(const native_frame_ptr_t* i_begin,
+                       const native_frame_ptr_t* i_end,
+                       bool_t i_truncated)
+ : m_truncated(i_truncated) {
+    assign(i_begin, i_end);
+}
+
+void Stacktrace::assign(const native_frame_ptr_t* i_begin,
+                        const native_frame_ptr_t* i_end) {
+    m_frames.reserve(i_end - i_begin);
+    for (const native_frame_ptr_t* it = i_begin; it != i_end; ++it) {
 
         //! if the frame pointer is null, it is the end of the stack
-        if (! buf[i]) {
+        if (! *it) {
             return;
         }
 
-        //! create the Frame object
-        m_frames.emplace_back(buf[i]);
+        //! create the Frame object; it is not symbolized until one
+        //! of its accessors is called
+        m_frames.emplace_back(*it);
+    }
+}
+
+bool_t Stacktrace::truncated() const {
+    return m_truncated;
+}
+
+__attribute__((noinline))
+std::size_t unwindStackCfi(native_frame_ptr_t* o_buffer,
+                           std::size_t i_capacity,
+                           std::size_t i_numSkippedFrames,
+                           bool_t* o_truncated) {
+    //! the first frame _Unwind_Backtrace reports is this function
+    UnwindState state = {
+        i_numSkippedFrames + 1,
+        o_buffer,
+        o_buffer + i_capacity,
+        false,
+    };
+    _Unwind_Backtrace(&unwindCallback, &state);
+    if (o_truncated) {
+        *o_truncated = state.m_truncated;
     }
+    return static_cast<std::size_t>(state.m_current - o_buffer);
 }
 
 void simple_backtrace() {
@@ -247,13 +403,11 @@ void simple_backtrace() {
     if (st.size() == 0) {
         return;
     }
-    int index = 0;
-    for (const Frame& fr : st.getFrames()) {
-        std::cout << std::right << std::setfill(' ') << std::setw(3) << index;
-        std::cout << "# ";
-        std::cout << fr.toString();
-        index += 1;
-    }
+    st.resolve();
+    //! the trace goes straight to the file descriptor; whatever the
+    //! program wrote to std::cout must come out first
+    std::cout.flush();
+    writeStacktrace(STDOUT_FILENO, st, FrameFormat::Full);
     std::cout << std::endl;
 }
 
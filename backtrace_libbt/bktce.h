@@ -2,24 +2,46 @@
 #define _BACKTRACE_LIB_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include <cstdint>
 #include <cstdlib>
 
 using string_t = std::string;
+using string_view_t = std::string_view;
 using bool_t = bool;
 using native_frame_ptr_t = const void *;
 
+//! id of a string in the process-wide StringTable (see intern.h)
+using string_id_t = std::uint32_t;
+
+struct ResolvedFrame;
+
 //! A textural representation of an x86_64 runtime stack-frame;
 //! Provides accessor methods to retrieve the frame pointer; 
 //! If debug symbols are available in the target binary, source code 
 //! filename and line number are also available  
+//! The frame is symbolized lazily: constructing it only stores the
+//! frame pointer; the first call to an accessor that needs the source
+//! information (or an explicit call to resolve()) symbolizes it;
+//! Note that a const Frame is NOT safe to resolve from multiple threads
+//! at the same time - resolve() it first if it is shared
+//! The names are held as ids into the process-wide StringTable, which
+//! keeps the frame at 24 bytes and makes copying it allocation-free;
+//! the returned views stay valid for the lifetime of the process
 class Frame {
 public:
     explicit Frame(native_frame_ptr_t i_address);
 
-    //! Returns the native frame pointer;
+    //! Returns the native frame pointer; never symbolizes the frame
     native_frame_ptr_t get() const;
+
+    //! Symbolizes the frame; does nothing if it is already resolved
+    void resolve() const;
+
+    //! Has the frame been symbolized
+    bool_t isResolved() const;
     
     //! Returns a print-friendly string;
     string_t toString() const;
@@ -27,21 +49,30 @@ public:
     //! Is source code information accessible
     bool_t hasSourceInfo() const;
 
+    //! Returns the demangled function name;
+    string_view_t getFunction() const;
+
     //! Returns full path to the source code;
-    const string_t& getSourceFilename() const;
+    string_view_t getSourceFilename() const;
     
     //! Returns full path to the binary file;
-    const string_t& getBinaryFilename() const;
+    string_view_t getBinaryFilename() const;
     
     //! Return the source code line number
     std::size_t getSourceLineNumber() const;
 
 private:
+    friend class Stacktrace;
+
+    //! stores the symbolized information and marks the frame resolved
+    void assign(const ResolvedFrame& i_resolved) const;
+
     native_frame_ptr_t m_native;
-    string_t m_function;
-    string_t m_sourceFilename;
-    string_t m_binaryFilename;
-    std::size_t m_sourceLineNumber;
+    mutable string_id_t m_function;
+    mutable string_id_t m_sourceFilename;
+    mutable string_id_t m_binaryFilename;
+    mutable std::uint32_t m_sourceLineNumber : 31;
+    mutable std::uint32_t m_resolved : 1;
 };
 
 //! The textural representation of an x86_64 runtime stack.
@@ -50,18 +81,44 @@ private:
 //! position of the starting frame. 
 //! Note that if the target is built with fomit-frame-pointer (or other
 //! equivalent options) this container may be empty;
+//! Capturing only unwinds the stack; the frames are symbolized on
+//! demand, one by one through the Frame accessors or all together
+//! through resolve(); a trace that is only hashed, compared or dropped
+//! never pays for symbolization
 class Stacktrace {
 public:
     // skip the call to the constructor and the unwinding function
     Stacktrace(std::size_t i_numSkippedFrames = 2);
 
+    //! adopts frame pointers captured elsewhere (e.g. RawStacktrace);
+    //! copying stops at the first null frame pointer
+    Stacktrace(const native_frame_ptr_t* i_begin,
+               const native_frame_ptr_t* i_end,
+               bool_t i_truncated = false);
+
     //! access each frame from the interior to the exterior;
     const std::vector<Frame>& getFrames() const;
+
+    //! symbolizes every frame
+    void resolve() const;
     
     std::size_t size() const;
 
+    //! Returns a hash of the frame pointers (no symbolization)
+    std::size_t hash() const;
+
+    //! Two traces are equal if they hold the same frame pointers
+    bool_t operator==(const Stacktrace& i_other) const;
+
+    //! Is the stack deeper than what was captured
+    bool_t truncated() const;
+
 private:
+    void assign(const native_frame_ptr_t* i_begin,
+                const native_frame_ptr_t* i_end);
+
     std::vector<Frame> m_frames;
+    bool_t m_truncated;
 };
 
 //! unwind the stack then writes out the information collected from 
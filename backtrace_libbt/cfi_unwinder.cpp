@@ -0,0 +1,903 @@
+
+#include "cfi_unwinder.h"
+
+#include "loader.h"
+#include "raw_stacktrace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <ucontext.h>
+
+//! glibc 2.35+: _dl_find_object() finds the .eh_frame_hdr of a PC
+//! without locking, and may be called from a signal handler
+#if defined(DLFO_STRUCT_HAS_EH_DBASE)
+#define BKTCE_HAVE_DL_FIND_OBJECT 1
+#endif
+
+//! a loaded module that has an .eh_frame_hdr search table
+struct CfiUnwinder::Module {
+    std::uintptr_t m_begin;
+    std::uintptr_t m_end;
+    const std::uint8_t* m_header;
+    //! pairs of (initial location, FDE address), both relative to
+    //! m_header, sorted by initial location
+    const std::int32_t* m_table;
+    std::size_t m_count;
+};
+
+//! immutable once published; a replaced table is never freed, readers
+//! may still be walking it (tables are only replaced on dlopen); the
+//! modules are only looked up where _dl_find_object() is missing: a
+//! module unloaded since the table was built is still in it
+struct CfiUnwinder::ModuleTable {
+    std::vector<CfiUnwinder::Module> m_modules;
+    unsigned long long m_loadGeneration;
+};
+
+namespace {
+
+//! DWARF register numbers (x86_64 psABI)
+const unsigned s_regRBP = 6;
+const unsigned s_regRSP = 7;
+const unsigned s_regRA = 16;
+
+//! pointer encodings (DW_EH_PE_*)
+const std::uint8_t s_peOmit = 0xff;
+const std::uint8_t s_peIndirect = 0x80;
+const std::uint8_t s_peTableEncoding = 0x3b;    // datarel | sdata4
+
+std::uint64_t readULEB(const std::uint8_t*& io_p, const std::uint8_t* i_end) {
+    std::uint64_t value = 0;
+    unsigned shift = 0;
+    while (io_p < i_end) {
+        std::uint8_t byte = *io_p++;
+        if (shift < 64) {
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (! (byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+std::int64_t readSLEB(const std::uint8_t*& io_p, const std::uint8_t* i_end) {
+    std::int64_t value = 0;
+    unsigned shift = 0;
+    std::uint8_t byte = 0;
+    while (io_p < i_end) {
+        byte = *io_p++;
+        if (shift < 64) {
+            value |= static_cast<std::int64_t>(byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (! (byte & 0x80)) {
+            break;
+        }
+    }
+    if (shift < 64 && (byte & 0x40)) {
+        value |= -(static_cast<std::int64_t>(1) << shift);
+    }
+    return value;
+}
+
+template<typename T>
+T readRaw(const std::uint8_t*& io_p) {
+    T value;
+    std::memcpy(&value, io_p, sizeof(T));
+    io_p += sizeof(T);
+    return value;
+}
+
+//! reads a pointer encoded as i_encoding; i_dataBase is the base of
+//! DW_EH_PE_datarel (the start of .eh_frame_hdr); returns false for the
+//! encodings that do not occur in .eh_frame
+bool_t readEncoded(const std::uint8_t*& io_p,
+                   const std::uint8_t* i_end,
+                   std::uint8_t i_encoding,
+                   std::uintptr_t i_dataBase,
+                   std::uintptr_t& o_value) {
+    if (i_encoding == s_peOmit) {
+        o_value = 0;
+        return true;
+    }
+    std::uintptr_t base = 0;
+    switch (i_encoding & 0x70) {
+    case 0x00:
+        break;
+    case 0x10:
+        base = reinterpret_cast<std::uintptr_t>(io_p);
+        break;
+    case 0x30:
+        base = i_dataBase;
+        break;
+    default:
+        return false;
+    }
+    std::uintptr_t value = 0;
+    switch (i_encoding & 0x0f) {
+    case 0x00: value = readRaw<std::uint64_t>(io_p); break;
+    case 0x01: value = readULEB(io_p, i_end); break;
+    case 0x02: value = readRaw<std::uint16_t>(io_p); break;
+    case 0x03: value = readRaw<std::uint32_t>(io_p); break;
+    case 0x04: value = readRaw<std::uint64_t>(io_p); break;
+    case 0x09: value = readSLEB(io_p, i_end); break;
+    case 0x0a: value = readRaw<std::int16_t>(io_p); break;
+    case 0x0b: value = readRaw<std::int32_t>(io_p); break;
+    case 0x0c: value = readRaw<std::int64_t>(io_p); break;
+    default:
+        return false;
+    }
+    if (value) {
+        value += base;
+    }
+    if ((i_encoding & s_peIndirect) && value) {
+        value = *reinterpret_cast<const std::uintptr_t *>(value);
+    }
+    o_value = value;
+    return true;
+}
+
+//! the decoded header of a CIE
+struct Cie {
+    std::uint64_t m_codeAlign;
+    std::int64_t m_dataAlign;
+    std::uint64_t m_raRegister;
+    std::uint8_t m_fdeEncoding;
+    bool_t m_hasAugmentationData;
+    const std::uint8_t* m_instructions;
+    const std::uint8_t* m_end;
+};
+
+//! reads the length of a CIE/FDE and returns the end of the record
+const std::uint8_t* readLength(const std::uint8_t*& io_p) {
+    std::uint64_t length = readRaw<std::uint32_t>(io_p);
+    if (length == 0xffffffff) {
+        length = readRaw<std::uint64_t>(io_p);
+    }
+    return io_p + length;
+}
+
+bool_t parseCie(const std::uint8_t* i_cie, Cie& o_cie) {
+    const std::uint8_t* p = i_cie;
+    const std::uint8_t* end = readLength(p);
+    if (readRaw<std::uint32_t>(p) != 0) {
+        return false;
+    }
+    std::uint8_t version = *p++;
+    const char* augmentation = reinterpret_cast<const char *>(p);
+    p += std::strlen(augmentation) + 1;
+    if (augmentation[0] && augmentation[0] != 'z') {
+        //! e.g. the obsolete "eh" augmentation
+        return false;
+    }
+    o_cie.m_codeAlign = readULEB(p, end);
+    o_cie.m_dataAlign = readSLEB(p, end);
+    o_cie.m_raRegister = version == 1 ? *p++ : readULEB(p, end);
+    o_cie.m_fdeEncoding = 0;
+    o_cie.m_hasAugmentationData = augmentation[0] == 'z';
+    if (o_cie.m_hasAugmentationData) {
+        std::uint64_t size = readULEB(p, end);
+        const std::uint8_t* data = p;
+        p += size;
+        for (const char* a = augmentation + 1; *a; ++a) {
+            switch (*a) {
+            case 'R':
+                o_cie.m_fdeEncoding = *data++;
+                break;
+            case 'L':
+                data++;
+                break;
+            case 'P': {
+                std::uint8_t encoding = *data++;
+                std::uintptr_t personality = 0;
+                //! only skipped, never dereferenced
+                if (! readEncoded(data, p, encoding & ~s_peIndirect, 0, personality)) {
+                    return false;
+                }
+                break;
+            }
+            case 'S':
+            case 'B':
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+    o_cie.m_instructions = p;
+    o_cie.m_end = end;
+    return true;
+}
+
+//! how a register of the caller is recovered
+struct RegisterRule {
+    enum Kind : std::uint8_t { Same, Undefined, Offset, Unsupported };
+    Kind m_kind;
+    std::int64_t m_offset;
+};
+
+struct CfaState {
+    unsigned m_cfaRegister;
+    std::int64_t m_cfaOffset;
+    bool_t m_cfaSupported;
+    RegisterRule m_rbp;
+    RegisterRule m_ra;
+};
+
+//! runs a CFA program until the location passes i_pc; returns false on
+//! an instruction this unwinder does not implement
+bool_t execute(const std::uint8_t* i_begin,
+               const std::uint8_t* i_end,
+               const Cie& i_cie,
+               std::uintptr_t i_location,
+               std::uintptr_t i_pc,
+               const CfaState& i_initial,
+               CfaState& io_state) {
+    static const std::size_t s_maxRemembered = 8;
+    CfaState remembered[s_maxRemembered];
+    std::size_t numRemembered = 0;
+    std::uintptr_t location = i_location;
+    const std::uint8_t* p = i_begin;
+
+    auto ruleOf = [&io_state](std::uint64_t i_register) -> RegisterRule* {
+        if (i_register == s_regRBP) {
+            return &io_state.m_rbp;
+        }
+        if (i_register == s_regRA) {
+            return &io_state.m_ra;
+        }
+        return nullptr;
+    };
+    auto initialOf = [&i_initial](std::uint64_t i_register) -> RegisterRule {
+        return i_register == s_regRBP ? i_initial.m_rbp : i_initial.m_ra;
+    };
+    auto setOffset = [&](std::uint64_t i_register, std::int64_t i_offset) {
+        if (RegisterRule* r = ruleOf(i_register)) {
+            r->m_kind = RegisterRule::Offset;
+            r->m_offset = i_offset;
+        }
+    };
+    auto setKind = [&](std::uint64_t i_register, RegisterRule::Kind i_kind) {
+        if (RegisterRule* r = ruleOf(i_register)) {
+            r->m_kind = i_kind;
+        }
+    };
+
+    while (p < i_end) {
+        std::uint8_t op = *p++;
+        std::uint8_t operand = op & 0x3f;
+        switch (op & 0xc0) {
+        case 0x40:    // DW_CFA_advance_loc
+            location += operand * i_cie.m_codeAlign;
+            if (location > i_pc) {
+                return true;
+            }
+            continue;
+        case 0x80:    // DW_CFA_offset
+            setOffset(operand, static_cast<std::int64_t>(readULEB(p, i_end)) * i_cie.m_dataAlign);
+            continue;
+        case 0xc0:    // DW_CFA_restore
+            if (ruleOf(operand)) {
+                *ruleOf(operand) = initialOf(operand);
+            }
+            continue;
+        default:
+            break;
+        }
+
+        std::uint64_t reg = 0;
+        std::uint64_t delta = 0;
+        switch (op) {
+        case 0x00:    // DW_CFA_nop
+            break;
+        case 0x01: {  // DW_CFA_set_loc
+            std::uintptr_t value = 0;
+            if (! readEncoded(p, i_end, i_cie.m_fdeEncoding, 0, value)) {
+                return false;
+            }
+            location = value;
+            if (location > i_pc) {
+                return true;
+            }
+            break;
+        }
+        case 0x02:    // DW_CFA_advance_loc1
+            delta = readRaw<std::uint8_t>(p);
+            break;
+        case 0x03:    // DW_CFA_advance_loc2
+            delta = readRaw<std::uint16_t>(p);
+            break;
+        case 0x04:    // DW_CFA_advance_loc4
+            delta = readRaw<std::uint32_t>(p);
+            break;
+        case 0x05:    // DW_CFA_offset_extended
+            reg = readULEB(p, i_end);
+            setOffset(reg, static_cast<std::int64_t>(readULEB(p, i_end)) * i_cie.m_dataAlign);
+            break;
+        case 0x06:    // DW_CFA_restore_extended
+            reg = readULEB(p, i_end);
+            if (ruleOf(reg)) {
+                *ruleOf(reg) = initialOf(reg);
+            }
+            break;
+        case 0x07:    // DW_CFA_undefined
+            setKind(readULEB(p, i_end), RegisterRule::Undefined);
+            break;
+        case 0x08:    // DW_CFA_same_value
+            setKind(readULEB(p, i_end), RegisterRule::Same);
+            break;
+        case 0x09:    // DW_CFA_register
+            reg = readULEB(p, i_end);
+            readULEB(p, i_end);
+            setKind(reg, RegisterRule::Unsupported);
+            break;
+        case 0x0a:    // DW_CFA_remember_state
+            if (numRemembered == s_maxRemembered) {
+                return false;
+            }
+            remembered[numRemembered++] = io_state;
+            break;
+        case 0x0b:    // DW_CFA_restore_state
+            if (! numRemembered) {
+                return false;
+            }
+            //! the remembered state includes the CFA rule
+            io_state = remembered[--numRemembered];
+            break;
+        case 0x0c:    // DW_CFA_def_cfa
+            io_state.m_cfaRegister = static_cast<unsigned>(readULEB(p, i_end));
+            io_state.m_cfaOffset = static_cast<std::int64_t>(readULEB(p, i_end));
+            io_state.m_cfaSupported = true;
+            break;
+        case 0x0d:    // DW_CFA_def_cfa_register
+            io_state.m_cfaRegister = static_cast<unsigned>(readULEB(p, i_end));
+            break;
+        case 0x0e:    // DW_CFA_def_cfa_offset
+            io_state.m_cfaOffset = static_cast<std::int64_t>(readULEB(p, i_end));
+            break;
+        case 0x0f: {  // DW_CFA_def_cfa_expression
+            std::uint64_t size = readULEB(p, i_end);
+            p += size;
+            io_state.m_cfaSupported = false;
+            break;
+        }
+        case 0x10:    // DW_CFA_expression
+        case 0x16: {  // DW_CFA_val_expression
+            reg = readULEB(p, i_end);
+            std::uint64_t size = readULEB(p, i_end);
+            p += size;
+            setKind(reg, RegisterRule::Unsupported);
+            break;
+        }
+        case 0x11:    // DW_CFA_offset_extended_sf
+            reg = readULEB(p, i_end);
+            setOffset(reg, readSLEB(p, i_end) * i_cie.m_dataAlign);
+            break;
+        case 0x12:    // DW_CFA_def_cfa_sf
+            io_state.m_cfaRegister = static_cast<unsigned>(readULEB(p, i_end));
+            io_state.m_cfaOffset = readSLEB(p, i_end) * i_cie.m_dataAlign;
+            io_state.m_cfaSupported = true;
+            break;
+        case 0x13:    // DW_CFA_def_cfa_offset_sf
+            io_state.m_cfaOffset = readSLEB(p, i_end) * i_cie.m_dataAlign;
+            break;
+        case 0x14:    // DW_CFA_val_offset
+        case 0x15:    // DW_CFA_val_offset_sf
+            reg = readULEB(p, i_end);
+            if (op == 0x14) {
+                readULEB(p, i_end);
+            } else {
+                readSLEB(p, i_end);
+            }
+            setKind(reg, RegisterRule::Unsupported);
+            break;
+        case 0x2e:    // DW_CFA_GNU_args_size
+            readULEB(p, i_end);
+            break;
+        case 0x2f:    // DW_CFA_GNU_negative_offset_extended
+            reg = readULEB(p, i_end);
+            setOffset(reg, -static_cast<std::int64_t>(readULEB(p, i_end)) * i_cie.m_dataAlign);
+            break;
+        default:
+            return false;
+        }
+        if (delta) {
+            location += delta * i_cie.m_codeAlign;
+            if (location > i_pc) {
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+//! A rule packed into one word:
+//!   bits  0..7   CFA register (rsp or rbp); 0 means "no rule"
+//!   bits  8..31  CFA offset (unsigned)
+//!   bits 32..47  offset of the return address from the CFA (signed);
+//!                0 means the return address is undefined (the
+//!                outermost frame)
+//!   bits 48..63  offset of the saved rbp from the CFA (signed); 0
+//!                means rbp is unchanged
+const std::uint64_t s_noRule = 0;
+
+std::uint64_t packRule(const CfaState& i_state) {
+    if (! i_state.m_cfaSupported
+        || (i_state.m_cfaRegister != s_regRSP && i_state.m_cfaRegister != s_regRBP)
+        || i_state.m_cfaOffset < 0
+        || i_state.m_cfaOffset >= (1 << 24)) {
+        return s_noRule;
+    }
+    std::int64_t raOffset = 0;
+    if (i_state.m_ra.m_kind == RegisterRule::Offset) {
+        raOffset = i_state.m_ra.m_offset;
+        if (! raOffset || raOffset < -32768 || raOffset > 32767) {
+            return s_noRule;
+        }
+    } else if (i_state.m_ra.m_kind != RegisterRule::Undefined) {
+        return s_noRule;
+    }
+    std::int64_t rbpOffset = 0;
+    if (i_state.m_rbp.m_kind == RegisterRule::Offset) {
+        rbpOffset = i_state.m_rbp.m_offset;
+        if (! rbpOffset || rbpOffset < -32768 || rbpOffset > 32767) {
+            return s_noRule;
+        }
+    } else if (i_state.m_rbp.m_kind == RegisterRule::Unsupported) {
+        return s_noRule;
+    }
+    return static_cast<std::uint64_t>(i_state.m_cfaRegister)
+        | (static_cast<std::uint64_t>(i_state.m_cfaOffset) << 8)
+        | (static_cast<std::uint64_t>(static_cast<std::uint16_t>(raOffset)) << 32)
+        | (static_cast<std::uint64_t>(static_cast<std::uint16_t>(rbpOffset)) << 48);
+}
+
+//! finds the FDE of i_pc in a module and computes its packed rule
+std::uint64_t computeRule(const std::uint8_t* i_header,
+                          const std::int32_t* i_table,
+                          std::size_t i_count,
+                          std::uintptr_t i_pc) {
+    std::uintptr_t header = reinterpret_cast<std::uintptr_t>(i_header);
+    std::intptr_t target = static_cast<std::intptr_t>(i_pc - header);
+
+    //! the last entry whose initial location is <= i_pc
+    std::size_t lo = 0;
+    std::size_t hi = i_count;
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (i_table[2 * mid] <= target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (! lo) {
+        return s_noRule;
+    }
+    const std::uint8_t* fde = i_header + i_table[2 * (lo - 1) + 1];
+
+    const std::uint8_t* p = fde;
+    const std::uint8_t* end = readLength(p);
+    const std::uint8_t* ciePointerField = p;
+    std::uint32_t ciePointer = readRaw<std::uint32_t>(p);
+    if (! ciePointer) {
+        return s_noRule;
+    }
+    Cie cie;
+    if (! parseCie(ciePointerField - ciePointer, cie)) {
+        return s_noRule;
+    }
+    std::uintptr_t pcBegin = 0;
+    std::uintptr_t pcRange = 0;
+    if (! readEncoded(p, end, cie.m_fdeEncoding, header, pcBegin)
+        || ! readEncoded(p, end, cie.m_fdeEncoding & 0x0f, header, pcRange)) {
+        return s_noRule;
+    }
+    if (i_pc < pcBegin || i_pc >= pcBegin + pcRange) {
+        return s_noRule;
+    }
+    if (cie.m_hasAugmentationData) {
+        std::uint64_t size = readULEB(p, end);
+        p += size;
+    }
+    if (cie.m_raRegister != s_regRA) {
+        return s_noRule;
+    }
+
+    CfaState initial = {};
+    initial.m_cfaSupported = false;
+    initial.m_rbp.m_kind = RegisterRule::Same;
+    initial.m_ra.m_kind = RegisterRule::Undefined;
+    if (! execute(cie.m_instructions, cie.m_end, cie, pcBegin, ~static_cast<std::uintptr_t>(0),
+                  initial, initial)) {
+        return s_noRule;
+    }
+    CfaState state = initial;
+    if (! execute(p, end, cie, pcBegin, i_pc, initial, state)) {
+        return s_noRule;
+    }
+    return packRule(state);
+}
+
+//! finds the binary search table of the .eh_frame_hdr at
+//! io_module.m_header; false if it has none this unwinder can read
+bool_t readSearchTable(CfiUnwinder::Module& io_module) {
+    //! version, eh_frame_ptr_enc, fde_count_enc, table_enc
+    const std::uint8_t* h = io_module.m_header;
+    if (h[0] != 1 || h[3] != s_peTableEncoding) {
+        return false;
+    }
+    const std::uint8_t* p = h + 4;
+    std::uintptr_t ehFrame = 0;
+    std::uintptr_t count = 0;
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(h);
+    if (! readEncoded(p, p + 16, h[1], base, ehFrame)
+        || ! readEncoded(p, p + 16, h[2], base, count)) {
+        return false;
+    }
+    io_module.m_table = reinterpret_cast<const std::int32_t *>(p);
+    io_module.m_count = count;
+    return true;
+}
+
+struct ScanResult {
+    std::vector<CfiUnwinder::Module>* m_modules;
+    unsigned long long m_loadGeneration;
+};
+
+//! A cache entry holds a PC and its rule in one word:
+//!   bits  0..26  the rule, compacted (0: empty entry):
+//!                bit 0       the CFA register is rbp (rather than rsp)
+//!                bits 1..12  CFA offset / 8
+//!                bits 13..19 return address offset / 8 (signed)
+//!                bits 20..26 saved rbp offset / 8 (signed)
+//!   bits 27..28  the epoch of the cache the rule was computed in
+//!   bits 29..63  the tag of the PC
+//! The PC is mixed by an odd multiplier, which is a bijection of the
+//! 47-bit user address space: the top bits of the product pick the
+//! entry and the remaining 35 bits are the tag, so an entry's tag
+//! identifies its PC exactly; the PCs above 2^47 and the rules that do
+//! not fit are not cached;
+//! refresh() moves the epoch before it empties the cache: a rule that
+//! a concurrent miss computed from a module unloaded since, and stored
+//! once the cache was emptied, carries an epoch lookups do not accept
+const unsigned s_pcBits = 47;
+const unsigned s_indexBits = 12;
+const unsigned s_tagBits = s_pcBits - s_indexBits;
+const unsigned s_ruleBits = 29;
+const unsigned s_compactBits = 27;
+const std::uint64_t s_pcMask = (static_cast<std::uint64_t>(1) << s_pcBits) - 1;
+const std::uint64_t s_ruleMask = (static_cast<std::uint64_t>(1) << s_ruleBits) - 1;
+const std::uint64_t s_compactMask = (static_cast<std::uint64_t>(1) << s_compactBits) - 1;
+const std::uint64_t s_epochMask = s_ruleMask & ~s_compactMask;
+
+std::uint64_t mixPC(std::uintptr_t i_pc) {
+    return (static_cast<std::uint64_t>(i_pc) * 0x9E3779B97F4A7C15ULL) & s_pcMask;
+}
+
+//! a signed offset / 8 in 7 bits; false if it does not fit
+bool_t compactOffset(std::int16_t i_offset, std::uint64_t& o_bits) {
+    if (i_offset % 8 || i_offset < -64 * 8 || i_offset > 63 * 8) {
+        return false;
+    }
+    o_bits = static_cast<std::uint64_t>(i_offset / 8) & 0x7f;
+    return true;
+}
+
+std::int16_t expandOffset(std::uint64_t i_bits) {
+    std::int16_t value = static_cast<std::int16_t>(i_bits & 0x7f);
+    return static_cast<std::int16_t>(value >= 64 ? value - 128 : value) * 8;
+}
+
+//! the compacted form of a packed rule; 0 if it does not fit
+std::uint64_t compactRule(std::uint64_t i_packed) {
+    unsigned cfaRegister = i_packed & 0xff;
+    std::uint64_t cfaOffset = (i_packed >> 8) & 0xffffff;
+    std::uint64_t raBits = 0;
+    std::uint64_t rbpBits = 0;
+    if (cfaOffset % 8 || cfaOffset / 8 >= (1 << 12)
+        || ! compactOffset(static_cast<std::int16_t>(i_packed >> 32), raBits)
+        || ! compactOffset(static_cast<std::int16_t>(i_packed >> 48), rbpBits)) {
+        return 0;
+    }
+    return (cfaRegister == s_regRBP ? 1 : 0)
+        | ((cfaOffset / 8) << 1)
+        | (raBits << 13)
+        | (rbpBits << 20);
+}
+
+std::uint64_t expandRule(std::uint64_t i_compact) {
+    std::uint64_t cfaRegister = (i_compact & 1) ? s_regRBP : s_regRSP;
+    std::uint64_t cfaOffset = ((i_compact >> 1) & 0xfff) * 8;
+    std::int16_t raOffset = expandOffset(i_compact >> 13);
+    std::int16_t rbpOffset = expandOffset(i_compact >> 20);
+    return cfaRegister
+        | (cfaOffset << 8)
+        | (static_cast<std::uint64_t>(static_cast<std::uint16_t>(raOffset)) << 32)
+        | (static_cast<std::uint64_t>(static_cast<std::uint16_t>(rbpOffset)) << 48);
+}
+
+}
+
+CfiUnwinder& CfiUnwinder::instance() {
+    static CfiUnwinder* s_instance = new CfiUnwinder;
+    return *s_instance;
+}
+
+CfiUnwinder::CfiUnwinder()
+ : m_modules(nullptr),
+   m_loadGeneration(0),
+   m_epoch(0),
+   m_hits(0),
+   m_misses(0) {
+    for (std::size_t i = 0; i < s_cacheSize; ++i) {
+        m_cache[i].store(0, std::memory_order_relaxed);
+    }
+    refresh();
+}
+
+void CfiUnwinder::refresh() {
+    static std::mutex s_mutex;
+    std::lock_guard<std::mutex> lock(s_mutex);
+
+    ModuleTable* table = new ModuleTable;
+    table->m_loadGeneration = 0;
+    ScanResult result = {&table->m_modules, 0};
+    dl_iterate_phdr([](dl_phdr_info* i_info, size_t, void* io_data) -> int {
+        ScanResult* result = static_cast<ScanResult *>(io_data);
+        result->m_loadGeneration = i_info->dlpi_adds + i_info->dlpi_subs;
+        Module module = {};
+        module.m_begin = ~static_cast<std::uintptr_t>(0);
+        for (ElfW(Half) i = 0; i < i_info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = i_info->dlpi_phdr[i];
+            if (phdr.p_type == PT_LOAD) {
+                std::uintptr_t begin = i_info->dlpi_addr + phdr.p_vaddr;
+                module.m_begin = std::min(module.m_begin, begin);
+                module.m_end = std::max(module.m_end, begin + phdr.p_memsz);
+            } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+                module.m_header = reinterpret_cast<const std::uint8_t *>(
+                    i_info->dlpi_addr + phdr.p_vaddr);
+            }
+        }
+        if (! module.m_header || module.m_begin >= module.m_end || ! readSearchTable(module)) {
+            return 0;
+        }
+        result->m_modules->push_back(module);
+        return 0;
+    }, &result);
+
+    std::sort(table->m_modules.begin(), table->m_modules.end(),
+              [](const Module& lhs, const Module& rhs) {
+                  return lhs.m_begin < rhs.m_begin;
+              });
+    table->m_loadGeneration = result.m_loadGeneration;
+    m_loadGeneration.store(result.m_loadGeneration);
+
+    //! the old table stays alive; readers may still use it
+    m_modules.store(table, std::memory_order_release);
+
+    //! a dlclose() may have put another module at the cached PCs: the
+    //! entries of the previous epochs are not served any more
+    m_epoch.fetch_add(1, std::memory_order_acq_rel);
+    for (std::size_t i = 0; i < s_cacheSize; ++i) {
+        m_cache[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool_t CfiUnwinder::findModule(std::uintptr_t i_pc, Module& o_module) const {
+#if defined(BKTCE_HAVE_DL_FIND_OBJECT)
+    //! the loader's own records: a module unloaded since the last
+    //! refresh() is never read
+    dl_find_object object;
+    if (_dl_find_object(reinterpret_cast<void *>(i_pc), &object) != 0 || ! object.dlfo_eh_frame) {
+        return false;
+    }
+    o_module.m_begin = reinterpret_cast<std::uintptr_t>(object.dlfo_map_start);
+    o_module.m_end = reinterpret_cast<std::uintptr_t>(object.dlfo_map_end);
+    o_module.m_header = static_cast<const std::uint8_t *>(object.dlfo_eh_frame);
+    return readSearchTable(o_module);
+#else
+    const ModuleTable* table = m_modules.load(std::memory_order_acquire);
+    const std::vector<Module>& modules = table->m_modules;
+    auto it = std::upper_bound(modules.begin(), modules.end(), i_pc,
+                               [](std::uintptr_t i_value, const Module& i_module) {
+                                   return i_value < i_module.m_begin;
+                               });
+    if (it == modules.begin()) {
+        return false;
+    }
+    --it;
+    if (i_pc >= it->m_end) {
+        return false;
+    }
+    o_module = *it;
+    return true;
+#endif
+}
+
+std::uint64_t CfiUnwinder::rule(std::uintptr_t i_pc, bool_t& io_mayRefresh, std::size_t& io_numMisses) {
+    static_assert(s_cacheSize == static_cast<std::size_t>(1) << s_indexBits,
+                  "an entry is picked by the top bits of the mixed PC");
+    static_assert(s_tagBits + s_ruleBits == 64, "an entry is one word");
+    std::uint64_t mixed = mixPC(i_pc);
+    bool_t cacheable = (i_pc & ~s_pcMask) == 0;
+    std::atomic<std::uint64_t>& entry = m_cache[mixed >> s_tagBits];
+    std::uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    std::uint64_t stamp = (mixed << s_ruleBits) | ((epoch << s_compactBits) & s_epochMask);
+    std::uint64_t cached = entry.load(std::memory_order_relaxed);
+    std::uint64_t compact = cached & s_compactMask;
+    if (cacheable && compact && (cached & ~s_compactMask) == stamp) {
+        return expandRule(compact);
+    }
+    io_numMisses += 1;
+
+    //! a library unloaded since the last scan may have left its
+    //! addresses to another one; the loader is asked once per walk
+    if (io_mayRefresh) {
+        io_mayRefresh = false;
+        if (loaderGeneration() != m_loadGeneration.load()) {
+            refresh();
+            epoch = m_epoch.load(std::memory_order_acquire);
+            stamp = (mixed << s_ruleBits) | ((epoch << s_compactBits) & s_epochMask);
+        }
+    }
+    Module module;
+    if (! findModule(i_pc, module)) {
+        return s_noRule;
+    }
+    std::uint64_t packed = computeRule(module.m_header, module.m_table, module.m_count, i_pc);
+    compact = packed != s_noRule ? compactRule(packed) : 0;
+    if (cacheable && compact && m_epoch.load(std::memory_order_acquire) == epoch) {
+        entry.store(stamp | compact, std::memory_order_relaxed);
+    }
+    return packed;
+}
+
+bool_t CfiUnwinder::walk(Registers i_registers,
+                         bool_t i_exactPC,
+                         bool_t i_mayRefresh,
+                         std::size_t i_numSkippedFrames,
+                         native_frame_ptr_t* o_buffer,
+                         std::size_t i_capacity,
+                         std::size_t& o_size,
+                         bool_t& o_truncated) {
+    //! the counters are shared by all threads: update them once per walk
+    struct Counters {
+        CfiUnwinder* m_unwinder;
+        std::size_t m_numSteps;
+        std::size_t m_numMisses;
+
+        ~Counters() {
+            m_unwinder->m_hits.fetch_add(m_numSteps - m_numMisses, std::memory_order_relaxed);
+            if (m_numMisses) {
+                m_unwinder->m_misses.fetch_add(m_numMisses, std::memory_order_relaxed);
+            }
+        }
+    } counters = {this, 0, 0};
+
+    Registers regs = i_registers;
+    //! a walk that may not refresh the modules runs in a signal handler
+    std::uintptr_t stackEnd = threadStackEnd(i_mayRefresh);
+    bool_t mayRefresh = i_mayRefresh;
+    std::size_t numSkippedFrames = i_numSkippedFrames;
+    bool_t exact = i_exactPC;
+    o_size = 0;
+    o_truncated = false;
+
+    while (regs.m_pc) {
+        if (numSkippedFrames) {
+            numSkippedFrames -= 1;
+        } else if (o_size == i_capacity) {
+            o_truncated = true;
+            return true;
+        } else {
+            o_buffer[o_size++] = reinterpret_cast<native_frame_ptr_t>(regs.m_pc);
+        }
+
+        //! a return address points after the call, which may be the
+        //! first instruction of the next function
+        counters.m_numSteps += 1;
+        std::uint64_t packed = rule(exact ? regs.m_pc : regs.m_pc - 1, mayRefresh, counters.m_numMisses);
+        exact = false;
+        if (packed == s_noRule) {
+            return false;
+        }
+        unsigned cfaRegister = packed & 0xff;
+        std::uintptr_t cfaOffset = (packed >> 8) & 0xffffff;
+        std::int16_t raOffset = static_cast<std::int16_t>(packed >> 32);
+        std::int16_t rbpOffset = static_cast<std::int16_t>(packed >> 48);
+        if (! raOffset) {
+            //! the outermost frame
+            return true;
+        }
+
+        std::uintptr_t cfa = (cfaRegister == s_regRSP ? regs.m_sp : regs.m_fp) + cfaOffset;
+        //! the caller's frame is further up the same stack
+        if (cfa <= regs.m_sp || cfa % sizeof(std::uintptr_t) || (stackEnd && cfa > stackEnd)) {
+            return false;
+        }
+        std::uintptr_t raAddress = cfa + raOffset;
+        std::uintptr_t rbpAddress = cfa + rbpOffset;
+        if (raAddress < regs.m_sp || (stackEnd && raAddress + sizeof(std::uintptr_t) > stackEnd)) {
+            return false;
+        }
+        regs.m_pc = *reinterpret_cast<const std::uintptr_t *>(raAddress);
+        if (rbpOffset) {
+            if (rbpAddress < regs.m_sp || (stackEnd && rbpAddress + sizeof(std::uintptr_t) > stackEnd)) {
+                return false;
+            }
+            regs.m_fp = *reinterpret_cast<const std::uintptr_t *>(rbpAddress);
+        }
+        regs.m_sp = cfa;
+    }
+    return true;
+}
+
+std::size_t CfiUnwinder::unwind(const void* i_ucontext,
+                                native_frame_ptr_t* o_buffer,
+                                std::size_t i_capacity,
+                                bool_t* o_truncated) {
+    std::size_t size = 0;
+    bool_t truncated = false;
+#if defined(__x86_64__)
+    const ucontext_t* uc = static_cast<const ucontext_t *>(i_ucontext);
+    Registers regs = {
+        static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]),
+        static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]),
+        static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]),
+    };
+    walk(regs, true, false, 0, o_buffer, i_capacity, size, truncated);
+#else
+    (void)i_ucontext;
+    (void)o_buffer;
+    (void)i_capacity;
+#endif
+    if (o_truncated) {
+        *o_truncated = truncated;
+    }
+    return size;
+}
+
+std::uint64_t CfiUnwinder::hits() const {
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+std::uint64_t CfiUnwinder::misses() const {
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+__attribute__((noinline))
+std::size_t unwindStackCachedCfi(native_frame_ptr_t* o_buffer,
+                                 std::size_t i_capacity,
+                                 std::size_t i_numSkippedFrames,
+                                 bool_t* o_truncated) {
+#if defined(__x86_64__)
+    CfiUnwinder::Registers regs;
+    __asm__ __volatile__(
+        "leaq 0(%%rip), %0\n\t"
+        "movq %%rsp, %1\n\t"
+        "movq %%rbp, %2\n\t"
+        : "=r"(regs.m_pc), "=r"(regs.m_sp), "=r"(regs.m_fp));
+    std::size_t size = 0;
+    bool_t truncated = false;
+    //! frame 0 is this function
+    if (CfiUnwinder::instance().walk(regs, true, true, i_numSkippedFrames + 1,
+                                     o_buffer, i_capacity, size, truncated)) {
+        if (o_truncated) {
+            *o_truncated = truncated;
+        }
+        return size;
+    }
+#endif
+    //! a frame this unwinder can not step through
+    std::size_t numFrames = unwindStackCfi(o_buffer, i_capacity, i_numSkippedFrames + 1, o_truncated);
+    __asm__ __volatile__("" ::: "memory");
+    return numFrames;
+}
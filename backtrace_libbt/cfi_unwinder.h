@@ -0,0 +1,111 @@
+#ifndef _BKTCE_CFI_UNWINDER_H
+#define _BKTCE_CFI_UNWINDER_H
+
+#include "bktce.h"
+
+#include <atomic>
+#include <cstdint>
+
+//! bktce's own DWARF CFI unwinder (x86_64);
+//! libgcc's _Unwind_Backtrace finds the FDE of every frame through
+//! dl_iterate_phdr(), which takes the loader lock, and interprets the
+//! CFA program from scratch each time; here:
+//! - the PT_GNU_EH_FRAME (.eh_frame_hdr) binary search tables of the
+//!   loaded modules are collected once into an immutable, sorted
+//!   module table that readers access without locking;
+//! - the CIE/FDE program of a PC is run once; the outcome (where the
+//!   CFA, the return address and the caller's rbp are) is packed,
+//!   together with the PC, into one word of a process-wide
+//!   direct-mapped cache, so that a warm unwind step is a hash probe
+//!   and three loads;
+//! Only the rules compilers emit for ordinary code are supported (CFA =
+//! rsp/rbp + offset, registers saved at CFA + offset); a frame that
+//! needs anything else (DWARF expressions, e.g. PLT stubs and signal
+//! trampolines) or has no FDE stops the walk and the capture is
+//! redone with _Unwind_Backtrace;
+//! Lookups never allocate and never lock; the .eh_frame_hdr of a PC is
+//! found with _dl_find_object() (glibc 2.35+), or else in a module
+//! table that is only rebuilt by refresh(), or when a capture (outside
+//! a signal handler) finds that libraries were loaded or unloaded;
+//! without _dl_find_object(), a walk in a signal handler may read the
+//! tables of a library unloaded since the last refresh()
+class CfiUnwinder {
+public:
+    //! The process-wide unwinder; the module table is built on the
+    //! first call; it is never destroyed
+    static CfiUnwinder& instance();
+
+    //! Rescans the loaded modules (call after dlopen()/dlclose())
+    void refresh();
+
+    //! Unwinds from the registers saved in a ucontext_t (the third
+    //! argument of an SA_SIGINFO signal handler); the first recorded
+    //! frame is the interrupted PC; never allocates or locks; the
+    //! frames are only checked against the end of the stack if the
+    //! thread has looked it up before (see threadStackEnd())
+    std::size_t unwind(const void* i_ucontext,
+                       native_frame_ptr_t* o_buffer,
+                       std::size_t i_capacity,
+                       bool_t* o_truncated);
+
+    //! Number of unwind steps served by the rule cache
+    std::uint64_t hits() const;
+
+    //! Number of unwind steps that ran a CFA program
+    std::uint64_t misses() const;
+
+    //! The registers an unwind step needs
+    struct Registers {
+        std::uintptr_t m_pc;
+        std::uintptr_t m_sp;
+        std::uintptr_t m_fp;
+    };
+
+    //! Walks the stack from i_registers; frame 0 is i_registers.m_pc,
+    //! which is exact (not a return address) iff i_exactPC; returns
+    //! false if the walk stopped at a frame it could not unwind rather
+    //! than at the outermost frame
+    bool_t walk(Registers i_registers,
+                bool_t i_exactPC,
+                bool_t i_mayRefresh,
+                std::size_t i_numSkippedFrames,
+                native_frame_ptr_t* o_buffer,
+                std::size_t i_capacity,
+                std::size_t& o_size,
+                bool_t& o_truncated);
+
+    //! a loaded module and its FDE search table (see the .cpp)
+    struct Module;
+
+private:
+    struct ModuleTable;
+
+    CfiUnwinder();
+    CfiUnwinder(const CfiUnwinder&) = delete;
+    CfiUnwinder& operator=(const CfiUnwinder&) = delete;
+
+    //! Returns the packed rule of i_pc; 0 if it can not be unwound;
+    //! increments io_numMisses unless the rule was cached; a miss
+    //! refreshes the modules if libraries were loaded or unloaded
+    //! since, if io_mayRefresh, which it then clears
+    std::uint64_t rule(std::uintptr_t i_pc, bool_t& io_mayRefresh, std::size_t& io_numMisses);
+
+    //! The module of i_pc and its FDE search table; false if none
+    bool_t findModule(std::uintptr_t i_pc, Module& o_module) const;
+
+    static const std::size_t s_cacheSize = 4096;
+
+    std::atomic<const ModuleTable*> m_modules;
+    std::atomic<unsigned long long> m_loadGeneration;
+    //! moved by every refresh(); an entry is only served in the epoch
+    //! it was computed in (see the .cpp)
+    std::atomic<std::uint64_t> m_epoch;
+    //! one word per entry, the PC's tag and its rule: written and read
+    //! at once, so that concurrent writers can not mix them up (see the
+    //! .cpp)
+    std::atomic<std::uint64_t> m_cache[s_cacheSize];
+    std::atomic<std::uint64_t> m_hits;
+    std::atomic<std::uint64_t> m_misses;
+};
+
+#endif // _BKTCE_CFI_UNWINDER_H
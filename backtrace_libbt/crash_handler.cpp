@@ -0,0 +1,226 @@
+
+#include "crash_handler.h"
+
+#include "cfi_unwinder.h"
+#include "format.h"
+#include "raw_stacktrace.h"
+#include "symbolizer.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <backtrace.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+namespace {
+
+const int s_signals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE};
+const std::size_t s_numSignals = sizeof(s_signals) / sizeof(s_signals[0]);
+const std::size_t s_maxFrames = 128;
+
+std::atomic<int> s_fd(-1);
+std::atomic<bool_t> s_handling(false);
+//! the thread that prints the report, and whether it is done
+std::atomic<long> s_reportingThread(0);
+std::atomic<bool_t> s_reported(false);
+struct sigaction s_previous[s_numSignals];
+
+//! all the memory the handler uses
+native_frame_ptr_t s_frames[s_maxFrames];
+char s_line[4096];
+
+const char* signalName(int i_signal) {
+    switch (i_signal) {
+    case SIGSEGV: return "SIGSEGV (segmentation fault)";
+    case SIGBUS: return "SIGBUS (bus error)";
+    case SIGABRT: return "SIGABRT (abort)";
+    case SIGFPE: return "SIGFPE (arithmetic exception)";
+    default: return "signal";
+    }
+}
+
+void writeLine(const FormatBuffer& i_line) {
+    int fd = s_fd.load(std::memory_order_relaxed);
+    const char* p = i_line.data();
+    std::size_t remaining = i_line.size();
+    while (remaining) {
+        ssize_t written = ::write(fd, p, remaining);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        p += written;
+        remaining -= written;
+    }
+}
+
+//! what the libbacktrace callbacks print into
+struct FrameLine {
+    FormatBuffer* m_line;
+    std::size_t m_index;
+    std::uintptr_t m_pc;
+    bool_t m_found;
+};
+
+void errorCallback(void*, const char*, int) {
+}
+
+int fullCallback(void* io_data, uintptr_t, const char* i_filename, int i_lineNumber, const char* i_function) {
+    FrameLine* frame = static_cast<FrameLine *>(io_data);
+    if (! i_function) {
+        return 0;
+    }
+    //! an inlined call comes before the function it is inlined into
+    if (frame->m_found) {
+        frame->m_line->put(" (inlined)\n");
+        writeLine(*frame->m_line);
+        frame->m_line->clear();
+    }
+    frame->m_found = true;
+    frame->m_line->putDecimal(frame->m_index, 3).put("# ").putHex(frame->m_pc).put(" ").put(i_function);
+    if (i_filename) {
+        frame->m_line->put(" at ").put(i_filename).put(":").putDecimal(i_lineNumber);
+    }
+    return 0;
+}
+
+void syminfoCallback(void* io_data, uintptr_t, const char* i_symbol, uintptr_t, uintptr_t) {
+    FrameLine* frame = static_cast<FrameLine *>(io_data);
+    frame->m_line->putDecimal(frame->m_index, 3).put("# ").putHex(frame->m_pc);
+    if (i_symbol) {
+        frame->m_line->put(" ").put(i_symbol);
+    }
+    frame->m_found = true;
+}
+
+void onSignal(int i_signal, siginfo_t* i_info, void* i_context) {
+    long thread = syscall(SYS_gettid);
+    //! one report per process: a second crashing thread waits for it
+    //! (the previous action of the first one usually ends the process),
+    //! a crash in this handler goes straight to the previous action
+    if (s_handling.exchange(true)) {
+        if (s_reportingThread.load() != thread) {
+            while (! s_reported.load()) {
+                struct timespec pause = {0, 10 * 1000 * 1000};
+                nanosleep(&pause, nullptr);
+            }
+        }
+    } else {
+        s_reportingThread.store(thread);
+        FormatBuffer line(s_line, sizeof(s_line));
+        line.put("*** bktce: caught ").put(signalName(i_signal));
+        if (i_signal != SIGABRT) {
+            line.put(" at address ").putHex(reinterpret_cast<std::uintptr_t>(i_info->si_addr));
+        }
+        line.put(" in thread ").putDecimal(static_cast<std::uint64_t>(thread)).put(" ***\n");
+        writeLine(line);
+
+        bool_t truncated = false;
+        std::size_t size = CfiUnwinder::instance().unwind(i_context, s_frames, s_maxFrames, &truncated);
+        if (size < 2) {
+            //! no CFI for the crashing PC (e.g. generated code, or a
+            //! corrupted stack): its frame records may still lead on
+            size = unwindSignalFramePointer(i_context, s_frames, s_maxFrames, &truncated);
+        }
+
+        //! the process is about to die: no library is unloaded meanwhile
+        backtrace_freeze_modules(1);
+        backtrace_state* state = Symbolizer::instance().state();
+        for (std::size_t i = 0; i < size; ++i) {
+            line.clear();
+            //! look a return address up at the call instruction
+            std::uintptr_t pc = reinterpret_cast<std::uintptr_t>(s_frames[i]);
+            std::uintptr_t lookUp = i ? pc - 1 : pc;
+            FrameLine frame = {&line, i, pc, false};
+            if (state) {
+                backtrace_pcinfo(state, lookUp, &fullCallback, &errorCallback, &frame);
+                if (! frame.m_found) {
+                    backtrace_syminfo(state, lookUp, &syminfoCallback, &errorCallback, &frame);
+                }
+            }
+            if (! frame.m_found) {
+                line.putDecimal(i, 3).put("# ").putHex(pc);
+            }
+            line.put("\n");
+            writeLine(line);
+        }
+        line.clear();
+        if (truncated) {
+            line.put("  ... (truncated)\n");
+        }
+        line.put("\n");
+        writeLine(line);
+        s_reported.store(true);
+    }
+
+    //! hand the signal over to whoever had it before us; it is blocked
+    //! until this handler returns, then it is delivered again (SIGABRT)
+    //! or the faulting instruction is re-executed (SIGSEGV, ...)
+    for (std::size_t i = 0; i < s_numSignals; ++i) {
+        if (s_signals[i] == i_signal) {
+            sigaction(i_signal, &s_previous[i], nullptr);
+        }
+    }
+    if (i_info->si_code <= 0 || i_signal == SIGABRT) {
+        //! sent by kill()/raise()/abort(): it will not happen again
+        raise(i_signal);
+    }
+}
+
+}
+
+bool_t CrashHandler::installAltStack() {
+    stack_t current;
+    if (sigaltstack(nullptr, &current) == 0 && ! (current.ss_flags & SS_DISABLE)) {
+        return true;
+    }
+    //! leaked on purpose: the thread may crash at any time
+    std::size_t size = 64 * 1024;
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    stack_t stack = {};
+    stack.ss_sp = p;
+    stack.ss_size = size;
+    return sigaltstack(&stack, nullptr) == 0;
+}
+
+bool_t CrashHandler::install(int i_fd) {
+    if (! installAltStack()) {
+        return false;
+    }
+
+    //! everything that would otherwise happen during the first crash:
+    //! the module tables, libbacktrace's debug info, libgcc's unwinder
+    //! and the bounds of this thread's stack
+    CfiUnwinder::instance();
+    Symbolizer::instance().warmUp();
+    RawStacktrace<4> warmUp;
+    (void)warmUp;
+    threadStackEnd();
+
+    s_fd.store(i_fd);
+    struct sigaction action = {};
+    action.sa_sigaction = &onSignal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (std::size_t i = 0; i < s_numSignals; ++i) {
+        if (sigaction(s_signals[i], &action, &s_previous[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CrashHandler::uninstall() {
+    for (std::size_t i = 0; i < s_numSignals; ++i) {
+        sigaction(s_signals[i], &s_previous[i], nullptr);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef _BKTCE_CRASH_HANDLER_H
+#define _BKTCE_CRASH_HANDLER_H
+
+#include "bktce.h"
+
+#include <unistd.h>
+
+//! Prints a symbolized stack trace when the process crashes (SIGSEGV,
+//! SIGBUS, SIGABRT, SIGFPE), then lets the signal take its course (core
+//! dump, exit status);
+//! simple_backtrace() can not do that: it allocates and takes locks,
+//! so a crash inside malloc or while a lock is held deadlocks; the
+//! handler instead
+//! - runs on an alternate signal stack, so that it works after a stack
+//!   overflow (the stack is per thread: see installAltStack());
+//! - unwinds from the crash context with CfiUnwinder (no allocation,
+//!   no locks);
+//! - symbolizes with the libbacktrace state of Symbolizer, read in
+//!   advance by install(), and the modules known then
+//!   (backtrace_freeze_modules()): the loader's lock, which the thread
+//!   may hold inside dlopen(), is not taken; libbacktrace allocates
+//!   with mmap(), and waits at most 20 ms for a thread that reads what
+//!   the lookup needs before answering with the symbol alone; a
+//!   library loaded since the last lookup may be printed as an
+//!   address;
+//! - formats into a static buffer and writes to a file descriptor
+//!   opened before the crash;
+//! - reports the first crash only: the other threads that crash
+//!   meanwhile wait until it is printed;
+//! The function names are printed mangled (demangling allocates);
+//! pipe the output through c++filt
+class CrashHandler {
+public:
+    //! Installs the handler (and an alternate signal stack for the
+    //! calling thread) and pre-warms the unwinder and the symbolizer;
+    //! the trace is written to i_fd; returns false on failure
+    static bool_t install(int i_fd = STDERR_FILENO);
+
+    //! Restores the signal actions that were in place before install()
+    static void uninstall();
+
+    //! Gives the calling thread its own alternate signal stack; call it
+    //! on the threads whose stack overflows should be reported
+    static bool_t installAltStack();
+};
+
+#endif // _BKTCE_CRASH_HANDLER_H
@@ -0,0 +1,282 @@
+
+#include "demangle.h"
+#include "intern.h"
+
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <cxxabi.h>
+
+namespace {
+
+//! abi::__cxa_demangle requires a malloc()-ed buffer that it can
+//! realloc(); each thread keeps one and lets it grow to the longest
+//! symbol seen so far; this saves the result's malloc, not those of
+//! the parse itself
+struct ScratchBuffer {
+    char* m_data = nullptr;
+    std::size_t m_size = 0;
+
+    ~ScratchBuffer() {
+        std::free(m_data);
+    }
+};
+
+//! Returns the demangled symbol, or i_mangled itself if it is not a
+//! mangled C++ name; the view is valid until the next call on the same
+//! thread
+string_view_t demangleToScratch(const char* i_mangled) {
+    thread_local ScratchBuffer s_scratch;
+    int status = 0;
+    std::size_t size = s_scratch.m_size;
+    char* p = abi::__cxa_demangle(i_mangled, s_scratch.m_data, &size, &status);
+
+    //! if demangling has no effect or it fails for some reason, 
+    //! return the original symbol back;
+    if (p == nullptr || status != 0) {
+        return i_mangled;
+    }
+
+    //! __cxa_demangle reports the buffer size in "size" only when it
+    //! (re)allocates the buffer; the demangled string is null-terminated
+    if (p != s_scratch.m_data) {
+        s_scratch.m_data = p;
+        s_scratch.m_size = size;
+    }
+    return string_view_t(p);
+}
+
+std::size_t copyTruncated(string_view_t i_str, char* o_buffer, std::size_t i_size) {
+    if (! i_size) {
+        return 0;
+    }
+    std::size_t n = i_str.size() < i_size - 1 ? i_str.size() : i_size - 1;
+    std::memcpy(o_buffer, i_str.data(), n);
+    o_buffer[n] = '\0';
+    return n;
+}
+
+bool_t startsWith(string_view_t i_str, std::size_t i_pos, string_view_t i_prefix) {
+    return i_str.compare(i_pos, i_prefix.size(), i_prefix) == 0;
+}
+
+bool_t isIdentifierChar(char i_c) {
+    return std::isalnum(static_cast<unsigned char>(i_c)) || i_c == '_';
+}
+
+}
+
+Demangler& Demangler::instance() {
+    //! never destroyed, see StringTable::instance()
+    static Demangler* s_instance = new Demangler;
+    return *s_instance;
+}
+
+Demangler::Demangler()
+ : m_hits(0),
+   m_misses(0) {
+}
+
+string_id_t Demangler::demangle(const char* i_mangled, DemangleMode i_mode) {
+    string_view_t mangled(i_mangled);
+    Shard& shard = m_shards[std::hash<string_view_t>()(mangled) % s_numShards];
+    std::lock_guard<std::mutex> lock(shard.m_lock);
+
+    auto it = shard.m_names.find(mangled);
+    if (it == shard.m_names.end()) {
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        Names names = {
+            StringTable::instance().intern(demangleToScratch(i_mangled)),
+            s_notComputed,
+        };
+        it = shard.m_names.emplace(shard.m_arena.copy(mangled), names).first;
+    } else {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (i_mode == DemangleMode::Full) {
+        return it->second.m_full;
+    }
+    if (it->second.m_short == s_notComputed) {
+        string_view_t full = StringTable::instance().get(it->second.m_full);
+        //! only the interned result is kept: the scratch space grows to
+        //! the longest name the thread has shortened and is reused
+        thread_local std::vector<char> s_scratch;
+        if (s_scratch.size() < full.size() + 1) {
+            s_scratch.resize(full.size() + 1);
+        }
+        std::size_t n = shortName(full, s_scratch.data(), full.size() + 1);
+        it->second.m_short = StringTable::instance().intern(string_view_t(s_scratch.data(), n));
+    }
+    return it->second.m_short;
+}
+
+std::size_t Demangler::demangle(const char* i_mangled,
+                                char* o_buffer,
+                                std::size_t i_size,
+                                DemangleMode i_mode) {
+    string_view_t name = StringTable::instance().get(demangle(i_mangled, i_mode));
+    return copyTruncated(name, o_buffer, i_size);
+}
+
+std::size_t Demangler::shortName(string_view_t i_demangled,
+                                 char* o_buffer,
+                                 std::size_t i_size) {
+    if (! i_size) {
+        return 0;
+    }
+    std::size_t n = 0;
+    //! where the name starts in o_buffer, after the return type of a
+    //! function template ("std::basic_ostream& std::operator<<")
+    std::size_t nameStart = 0;
+    int angles = 0;
+    int parens = 0;
+    int braces = 0;
+    //! the parentheses being skipped belong to the return type
+    bool_t decltypeParens = false;
+    std::size_t i = 0;
+    auto put = [&](char c) {
+        if (n + 1 < i_size) {
+            o_buffer[n++] = c;
+        }
+    };
+    while (i < i_demangled.size()) {
+        char c = i_demangled[i];
+        bool_t outside = angles == 0 && parens == 0;
+
+        //! "(anonymous namespace)" is part of the qualified name
+        if (outside && startsWith(i_demangled, i, "(anonymous namespace)")) {
+            for (char k : string_view_t("(anonymous namespace)")) {
+                put(k);
+            }
+            i += std::strlen("(anonymous namespace)");
+            continue;
+        }
+
+        //! operator<, operator(), operator new[], operator bool ... keep
+        //! their symbols, spaces and types
+        if (outside && braces == 0 && startsWith(i_demangled, i, "operator")
+            && (i == 0 || ! isIdentifierChar(i_demangled[i - 1]))
+            && (i + 8 == i_demangled.size() || ! isIdentifierChar(i_demangled[i + 8]))) {
+            i += std::strlen("operator");
+            for (char k : string_view_t("operator")) {
+                put(k);
+            }
+            if (startsWith(i_demangled, i, "()")) {
+                put('(');
+                put(')');
+                i += 2;
+                continue;
+            }
+            if (i < i_demangled.size() && (i_demangled[i] == ' ' || i_demangled[i] == '"')) {
+                //! operator new, operator"" _km, conversions: up to the
+                //! parameter list, without template arguments
+                int typeAngles = 0;
+                while (i < i_demangled.size() && (typeAngles > 0 || i_demangled[i] != '(')) {
+                    if (i_demangled[i] == '<') {
+                        typeAngles += 1;
+                    } else if (i_demangled[i] == '>' && typeAngles > 0) {
+                        typeAngles -= 1;
+                    } else if (typeAngles == 0) {
+                        put(i_demangled[i]);
+                    }
+                    i += 1;
+                }
+                continue;
+            }
+            while (i < i_demangled.size() &&
+                   std::strchr("<>=!+-*/%^&|~[],", i_demangled[i])) {
+                put(i_demangled[i]);
+                i += 1;
+            }
+            //! "operator< <int>": the template arguments follow
+            if (startsWith(i_demangled, i, " <")) {
+                i += 1;
+            }
+            continue;
+        }
+
+        //! lambda and unnamed-type names ({lambda(int&)#1}) are kept
+        //! verbatim
+        if (c == '{') {
+            braces += 1;
+        } else if (c == '}' && braces > 0) {
+            braces -= 1;
+            if (outside) {
+                put(c);
+            }
+            i += 1;
+            continue;
+        }
+        if (braces > 0) {
+            if (outside) {
+                put(c);
+            }
+            i += 1;
+            continue;
+        }
+
+        if (c == '<') {
+            angles += 1;
+        } else if (c == '>' && angles > 0) {
+            angles -= 1;
+        } else if (c == '(' && outside
+                   && i + 1 < i_demangled.size() && std::strchr("*&", i_demangled[i + 1])) {
+            //! "int (*foo())(int)": a function returning a pointer to a
+            //! function; what precedes is the return type
+            nameStart = n;
+            i += 1;
+        } else if (c == '(') {
+            if (outside) {
+                string_view_t before(o_buffer, n);
+                decltypeParens = before.size() >= 8
+                    && before.compare(before.size() - 8, 8, "decltype") == 0;
+                if (! decltypeParens && before.size() >= 9) {
+                    decltypeParens = before.compare(before.size() - 9, 9, "decltype ") == 0;
+                }
+            }
+            parens += 1;
+        } else if (c == ')' && parens > 0) {
+            parens -= 1;
+            //! the first parameter list that is not followed by "::" (as
+            //! in "f(int)::{lambda()#1}") is the function's: the rest is
+            //! qualifiers, clone suffixes or the return type's
+            //! parameters
+            if (parens == 0 && angles == 0) {
+                if (! decltypeParens && ! startsWith(i_demangled, i + 1, "::")) {
+                    break;
+                }
+                decltypeParens = false;
+            }
+        } else if (outside) {
+            put(c);
+            if (c == ' ') {
+                nameStart = n;
+            }
+        }
+        i += 1;
+    }
+
+    while (n > 0 && o_buffer[n - 1] == ' ') {
+        n -= 1;
+    }
+    if (nameStart > n) {
+        nameStart = n;
+    }
+    if (nameStart) {
+        std::memmove(o_buffer, o_buffer + nameStart, n - nameStart);
+        n -= nameStart;
+    }
+    o_buffer[n] = '\0';
+    return n;
+}
+
+std::uint64_t Demangler::hits() const {
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Demangler::misses() const {
+    return m_misses.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+#ifndef _BKTCE_DEMANGLE_H
+#define _BKTCE_DEMANGLE_H
+
+#include "arena.h"
+#include "bktce.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+enum class DemangleMode {
+    //! what abi::__cxa_demangle returns, e.g.
+    //! "generator(int&, std::map<int, ...>&)"
+    Full,
+    //! template arguments and parameter lists removed, e.g.
+    //! "generator" or "generator::{lambda(int&)#2}::operator()"
+    Short,
+};
+
+//! A memoizing C++ demangler;
+//! Each distinct mangled name is demangled once; the results are stored
+//! in the StringTable and every later request for the same symbol is a
+//! hash lookup, so a warm symbolizer does not touch the global
+//! allocator for demangling;
+//! abi::__cxa_demangle still allocates while it parses (and grows its
+//! output buffer with realloc()), so a miss costs a few mallocs: the
+//! memoization is what keeps them off the warm path;
+//! Symbols that are not mangled (C functions) are returned unchanged
+class Demangler {
+public:
+    static Demangler& instance();
+
+    Demangler();
+
+    //! Returns the StringTable id of the demangled i_mangled
+    string_id_t demangle(const char* i_mangled,
+                         DemangleMode i_mode = DemangleMode::Full);
+
+    //! Writes the demangled i_mangled to o_buffer, truncated to fit and
+    //! always null-terminated; returns the number of characters written
+    std::size_t demangle(const char* i_mangled,
+                         char* o_buffer,
+                         std::size_t i_size,
+                         DemangleMode i_mode = DemangleMode::Full);
+
+    //! Writes the short form of an already demangled name to o_buffer
+    //! (see DemangleMode::Short); truncated to fit and null-terminated;
+    //! returns the number of characters written; never allocates
+    static std::size_t shortName(string_view_t i_demangled,
+                                 char* o_buffer,
+                                 std::size_t i_size);
+
+    std::uint64_t hits() const;
+
+    std::uint64_t misses() const;
+
+private:
+    Demangler(const Demangler&) = delete;
+    Demangler& operator=(const Demangler&) = delete;
+
+    static const string_id_t s_notComputed = 0xFFFFFFFF;
+
+    struct Names {
+        string_id_t m_full;
+        string_id_t m_short;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex m_lock;
+        std::unordered_map<string_view_t, Names> m_names;
+        //! holds the mangled keys of m_names
+        Arena m_arena;
+    };
+
+    static const std::size_t s_numShards = 16;
+
+    std::atomic<std::uint64_t> m_hits;
+    std::atomic<std::uint64_t> m_misses;
+    Shard m_shards[s_numShards];
+};
+
+#endif // _BKTCE_DEMANGLE_H
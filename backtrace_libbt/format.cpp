@@ -0,0 +1,312 @@
+
+#include "format.h"
+
+#include "demangle.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+//! longest "0x" + 16 hex digits or 20 decimal digits
+const std::size_t s_maxNumberLength = 24;
+
+std::size_t formatHex(std::uintptr_t i_value, char* o_buffer) {
+    static const char s_digits[] = "0123456789abcdef";
+    char digits[16];
+    std::size_t n = 0;
+    do {
+        digits[n++] = s_digits[i_value & 0xf];
+        i_value >>= 4;
+    } while (i_value);
+    o_buffer[0] = '0';
+    o_buffer[1] = 'x';
+    for (std::size_t i = 0; i < n; ++i) {
+        o_buffer[2 + i] = digits[n - 1 - i];
+    }
+    return n + 2;
+}
+
+//! right-aligned in i_width columns
+std::size_t formatDecimal(std::uint64_t i_value, std::size_t i_width, char* o_buffer) {
+    char digits[20];
+    std::size_t n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + i_value % 10);
+        i_value /= 10;
+    } while (i_value);
+    std::size_t length = 0;
+    for (; length + n < i_width; ++length) {
+        o_buffer[length] = ' ';
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        o_buffer[length++] = digits[n - 1 - i];
+    }
+    return length;
+}
+
+string_view_t baseName(string_view_t i_path) {
+    std::size_t slash = i_path.rfind('/');
+    return slash == string_view_t::npos ? i_path : i_path.substr(slash + 1);
+}
+
+//! Collects the pieces of the output; the sink decides where they go
+class Output {
+public:
+    virtual ~Output() {
+    }
+
+    //! i_text must stay valid until flush() (or, for the buffer, is
+    //! copied right away)
+    virtual void put(string_view_t i_text) = 0;
+
+    //! a scratch area for numbers and short names, valid until flush();
+    //! put() the text written there before asking for more
+    virtual char* scratch(std::size_t i_size) = 0;
+
+    void putHex(std::uintptr_t i_value) {
+        char* p = scratch(s_maxNumberLength);
+        put(string_view_t(p, formatHex(i_value, p)));
+    }
+
+    void putDecimal(std::uint64_t i_value, std::size_t i_width = 0) {
+        char* p = scratch(s_maxNumberLength + i_width);
+        put(string_view_t(p, formatDecimal(i_value, i_width, p)));
+    }
+};
+
+//! copies into a fixed buffer and counts what does not fit
+class BufferOutput : public Output {
+public:
+    BufferOutput(char* o_buffer, std::size_t i_size)
+     : m_buffer(o_buffer, i_size) {
+    }
+
+    void put(string_view_t i_text) override {
+        m_buffer.put(i_text);
+    }
+
+    char* scratch(std::size_t i_size) override {
+        return i_size <= sizeof(m_scratch) ? m_scratch : nullptr;
+    }
+
+    std::size_t finish() {
+        return m_buffer.length();
+    }
+
+private:
+    FormatBuffer m_buffer;
+    char m_scratch[1024];
+};
+
+//! gathers the pieces in an iovec array and writes them in batches
+class FdOutput : public Output {
+public:
+    explicit FdOutput(int i_fd)
+     : m_fd(i_fd),
+       m_numVectors(0),
+       m_scratchUsed(0),
+       m_failed(false) {
+    }
+
+    void put(string_view_t i_text) override {
+        if (i_text.empty()) {
+            return;
+        }
+        if (m_numVectors == s_maxVectors) {
+            flush();
+        }
+        m_vectors[m_numVectors].iov_base = const_cast<char *>(i_text.data());
+        m_vectors[m_numVectors].iov_len = i_text.size();
+        m_numVectors += 1;
+    }
+
+    char* scratch(std::size_t i_size) override {
+        if (i_size > sizeof(m_scratch)) {
+            return nullptr;
+        }
+        //! the piece is put right after: make room for its iovec now,
+        //! as a flush() in put() would hand its scratch out again
+        if (m_numVectors == s_maxVectors || m_scratchUsed + i_size > sizeof(m_scratch)) {
+            flush();
+        }
+        char* p = m_scratch + m_scratchUsed;
+        m_scratchUsed += i_size;
+        return p;
+    }
+
+    //! writes everything gathered so far; a short write is resumed
+    bool_t flush() {
+        iovec* v = m_vectors;
+        std::size_t n = m_numVectors;
+        while (n && ! m_failed) {
+            ssize_t written = writev(m_fd, v, static_cast<int>(n));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                m_failed = true;
+                break;
+            }
+            std::size_t remaining = static_cast<std::size_t>(written);
+            while (n && remaining >= v->iov_len) {
+                remaining -= v->iov_len;
+                ++v;
+                --n;
+            }
+            if (n) {
+                v->iov_base = static_cast<char *>(v->iov_base) + remaining;
+                v->iov_len -= remaining;
+            }
+        }
+        m_numVectors = 0;
+        m_scratchUsed = 0;
+        return ! m_failed;
+    }
+
+private:
+    static const std::size_t s_maxVectors = 64;
+
+    int m_fd;
+    iovec m_vectors[s_maxVectors];
+    std::size_t m_numVectors;
+    char m_scratch[4096];
+    std::size_t m_scratchUsed;
+    bool_t m_failed;
+};
+
+void putFrame(Output& o_output, const Frame& i_frame, FrameFormat i_format) {
+    o_output.putHex(reinterpret_cast<std::uintptr_t>(i_frame.get()));
+    if (i_format == FrameFormat::Addresses) {
+        o_output.put("\n");
+        return;
+    }
+    o_output.put(" ");
+    if (! i_frame.hasSourceInfo()) {
+        o_output.put(" in ");
+        o_output.put(i_frame.getBinaryFilename());
+        o_output.put("\n");
+        return;
+    }
+    if (i_format == FrameFormat::Short) {
+        char* name = o_output.scratch(512);
+        if (name) {
+            o_output.put(string_view_t(name, Demangler::shortName(i_frame.getFunction(), name, 512)));
+        } else {
+            o_output.put(i_frame.getFunction());
+        }
+        o_output.put(" (");
+        o_output.put(baseName(i_frame.getSourceFilename()));
+        o_output.put(":");
+        o_output.putDecimal(i_frame.getSourceLineNumber());
+        o_output.put(")\n");
+        return;
+    }
+    o_output.put(i_frame.getFunction());
+    o_output.put(" at ");
+    o_output.put(i_frame.getSourceFilename());
+    o_output.put(":");
+    o_output.putDecimal(i_frame.getSourceLineNumber());
+    o_output.put("\n");
+}
+
+void putStacktrace(Output& o_output, const Stacktrace& i_stack, FrameFormat i_format) {
+    std::size_t index = 0;
+    for (const Frame& frame : i_stack.getFrames()) {
+        o_output.putDecimal(index, 3);
+        o_output.put("# ");
+        putFrame(o_output, frame, i_format);
+        index += 1;
+    }
+    if (i_stack.truncated()) {
+        o_output.put("  ... (truncated)\n");
+    }
+}
+
+}
+
+FormatBuffer::FormatBuffer(char* o_buffer, std::size_t i_size)
+ : m_buffer(i_size ? o_buffer : nullptr),
+   m_capacity(i_size ? i_size - 1 : 0),
+   m_length(0) {
+    if (m_buffer) {
+        m_buffer[0] = '\0';
+    }
+}
+
+FormatBuffer& FormatBuffer::put(string_view_t i_text) {
+    if (m_length < m_capacity) {
+        std::size_t n = i_text.size() < m_capacity - m_length ? i_text.size() : m_capacity - m_length;
+        std::memcpy(m_buffer + m_length, i_text.data(), n);
+        m_buffer[m_length + n] = '\0';
+    }
+    m_length += i_text.size();
+    return *this;
+}
+
+FormatBuffer& FormatBuffer::putHex(std::uintptr_t i_value) {
+    char digits[s_maxNumberLength];
+    return put(string_view_t(digits, formatHex(i_value, digits)));
+}
+
+FormatBuffer& FormatBuffer::putDecimal(std::uint64_t i_value, std::size_t i_width) {
+    char digits[s_maxNumberLength];
+    if (i_width > s_maxNumberLength - 4) {
+        i_width = s_maxNumberLength - 4;
+    }
+    return put(string_view_t(digits, formatDecimal(i_value, i_width, digits)));
+}
+
+void FormatBuffer::clear() {
+    m_length = 0;
+    if (m_buffer) {
+        m_buffer[0] = '\0';
+    }
+}
+
+std::size_t formatFrame(const Frame& i_frame,
+                        FrameFormat i_format,
+                        char* o_buffer,
+                        std::size_t i_size) {
+    BufferOutput output(o_buffer, i_size);
+    putFrame(output, i_frame, i_format);
+    return output.finish();
+}
+
+std::size_t formatStacktrace(const Stacktrace& i_stack,
+                             FrameFormat i_format,
+                             char* o_buffer,
+                             std::size_t i_size) {
+    BufferOutput output(o_buffer, i_size);
+    putStacktrace(output, i_stack, i_format);
+    return output.finish();
+}
+
+std::size_t formatAddresses(const native_frame_ptr_t* i_begin,
+                            std::size_t i_numFrames,
+                            bool_t i_truncated,
+                            char* o_buffer,
+                            std::size_t i_size) {
+    BufferOutput output(o_buffer, i_size);
+    for (std::size_t i = 0; i < i_numFrames; ++i) {
+        output.putDecimal(i, 3);
+        output.put("# ");
+        output.putHex(reinterpret_cast<std::uintptr_t>(i_begin[i]));
+        output.put("\n");
+    }
+    if (i_truncated) {
+        output.put("  ... (truncated)\n");
+    }
+    return output.finish();
+}
+
+bool_t writeStacktrace(int i_fd,
+                       const Stacktrace& i_stack,
+                       FrameFormat i_format) {
+    FdOutput output(i_fd);
+    putStacktrace(output, i_stack, i_format);
+    return output.flush();
+}
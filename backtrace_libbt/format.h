@@ -0,0 +1,92 @@
+#ifndef _BKTCE_FORMAT_H
+#define _BKTCE_FORMAT_H
+
+#include "bktce.h"
+
+//! What a formatted frame shows
+enum class FrameFormat {
+    //! the frame pointer only: "0x4005d6"; never symbolizes
+    Addresses,
+    //! the short function name and the source file's base name:
+    //! "0x4005d6 Foo::bar (foo.cpp:42)"
+    Short,
+    //! as Frame::toString(): "0x4005d6 Foo::bar(int) at /src/foo.cpp:42"
+    //! or "0x4005d6  in /usr/lib/libfoo.so"
+    Full
+};
+
+//! Formatting that never touches the heap, iostream or the locale;
+//! Each line ends with '\n'; the outputs are truncated to fit and
+//! always null-terminated (if i_size > 0); like snprintf(), the return
+//! value is the length the whole output would have had, so a caller
+//! can detect truncation and retry with a larger buffer;
+//! Short and Full symbolize the frames that are not resolved yet,
+//! which does allocate: resolve() the Stacktrace beforehand (or use
+//! Addresses) to format in a signal handler
+
+std::size_t formatFrame(const Frame& i_frame,
+                        FrameFormat i_format,
+                        char* o_buffer,
+                        std::size_t i_size);
+
+//! One line per frame, numbered like simple_backtrace() ("  0# ..."),
+//! plus "  ... (truncated)" if the trace is truncated
+std::size_t formatStacktrace(const Stacktrace& i_stack,
+                             FrameFormat i_format,
+                             char* o_buffer,
+                             std::size_t i_size);
+
+//! As formatStacktrace() with FrameFormat::Addresses, for raw frame
+//! pointers (e.g. a RawStacktrace)
+std::size_t formatAddresses(const native_frame_ptr_t* i_begin,
+                            std::size_t i_numFrames,
+                            bool_t i_truncated,
+                            char* o_buffer,
+                            std::size_t i_size);
+
+//! Writes the output of formatStacktrace() to a file descriptor with
+//! writev(2), pointing straight at the interned names instead of
+//! copying them; the length of the trace is unlimited; returns false
+//! if a write fails
+bool_t writeStacktrace(int i_fd,
+                       const Stacktrace& i_stack,
+                       FrameFormat i_format);
+
+//! Builds text in a fixed, caller-provided buffer; for code that can not
+//! allocate (signal handlers, allocator hooks); text that does not fit
+//! is counted but dropped; the buffer is always null-terminated
+class FormatBuffer {
+public:
+    FormatBuffer(char* o_buffer, std::size_t i_size);
+
+    FormatBuffer& put(string_view_t i_text);
+
+    //! "0x" and lower case hex digits
+    FormatBuffer& putHex(std::uintptr_t i_value);
+
+    //! right-aligned in i_width columns
+    FormatBuffer& putDecimal(std::uint64_t i_value, std::size_t i_width = 0);
+
+    const char* data() const {
+        return m_buffer;
+    }
+
+    //! the number of characters in the buffer
+    std::size_t size() const {
+        return m_length < m_capacity ? m_length : m_capacity;
+    }
+
+    //! the length the text would have without truncation
+    std::size_t length() const {
+        return m_length;
+    }
+
+    void clear();
+
+private:
+    char* m_buffer;
+    std::size_t m_capacity;
+    std::size_t m_length;
+};
+
+#endif // _BKTCE_FORMAT_H
@@ -0,0 +1,106 @@
+
+#include "frame_cache.h"
+
+FrameCache& FrameCache::instance() {
+    static FrameCache s_instance;
+    return s_instance;
+}
+
+FrameCache::FrameCache(std::size_t i_capacity)
+ : m_shardCapacity((i_capacity + s_numShards - 1) / s_numShards) {
+    if (! m_shardCapacity) {
+        m_shardCapacity = 1;
+    }
+    for (Shard& shard : m_shards) {
+        shard.m_order.reset(new std::uintptr_t[m_shardCapacity]);
+        shard.m_entries.reserve(m_shardCapacity);
+    }
+}
+
+FrameCache::Shard& FrameCache::shardOf(native_frame_ptr_t i_pc) {
+    //! the low bits of a PC are poorly distributed (call sites are
+    //! close to each other); mix them with a multiplicative hash
+    std::uintptr_t key = reinterpret_cast<std::uintptr_t>(i_pc);
+    std::uint64_t h = static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ULL;
+    return m_shards[(h >> 32) % s_numShards];
+}
+
+bool_t FrameCache::lookup(native_frame_ptr_t i_pc,
+                          unsigned long long i_generation,
+                          ResolvedFrame& o_frame) {
+    Shard& shard = shardOf(i_pc);
+    {
+        std::lock_guard<std::mutex> lock(shard.m_lock);
+        auto it = shard.m_entries.find(reinterpret_cast<std::uintptr_t>(i_pc));
+        if (it != shard.m_entries.end() && it->second.m_generation == i_generation) {
+            o_frame = it->second.m_frame;
+            shard.m_hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    shard.m_misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void FrameCache::insert(native_frame_ptr_t i_pc,
+                        unsigned long long i_generation,
+                        const ResolvedFrame& i_frame) {
+    Shard& shard = shardOf(i_pc);
+    std::uintptr_t key = reinterpret_cast<std::uintptr_t>(i_pc);
+    std::lock_guard<std::mutex> lock(shard.m_lock);
+    auto it = shard.m_entries.find(key);
+    if (it != shard.m_entries.end()) {
+        //! an entry of another generation is replaced in place: it
+        //! keeps its position in the eviction order
+        if (it->second.m_generation != i_generation) {
+            it->second = Entry{i_frame, i_generation};
+        }
+        return;
+    }
+
+    //! evict the oldest entry of the shard once it is full
+    std::size_t slot = shard.m_next % m_shardCapacity;
+    if (shard.m_next >= m_shardCapacity) {
+        shard.m_entries.erase(shard.m_order[slot]);
+    }
+    shard.m_order[slot] = key;
+    shard.m_next += 1;
+    shard.m_entries.emplace(key, Entry{i_frame, i_generation});
+}
+
+void FrameCache::clear() {
+    for (Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.m_lock);
+        shard.m_entries.clear();
+        shard.m_next = 0;
+    }
+}
+
+std::size_t FrameCache::size() const {
+    std::size_t total = 0;
+    for (const Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.m_lock);
+        total += shard.m_entries.size();
+    }
+    return total;
+}
+
+std::size_t FrameCache::capacity() const {
+    return m_shardCapacity * s_numShards;
+}
+
+std::uint64_t FrameCache::hits() const {
+    std::uint64_t total = 0;
+    for (const Shard& shard : m_shards) {
+        total += shard.m_hits.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::uint64_t FrameCache::misses() const {
+    std::uint64_t total = 0;
+    for (const Shard& shard : m_shards) {
+        total += shard.m_misses.load(std::memory_order_relaxed);
+    }
+    return total;
+}
@@ -0,0 +1,92 @@
+#ifndef _BKTCE_FRAME_CACHE_H
+#define _BKTCE_FRAME_CACHE_H
+
+#include "bktce.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+//! The symbolized information of one frame pointer; the names are
+//! StringTable ids
+struct ResolvedFrame {
+    string_id_t m_function = 0;
+    string_id_t m_sourceFilename = 0;
+    string_id_t m_binaryFilename = 0;
+    std::uint32_t m_sourceLineNumber = 0;
+};
+
+//! A process-wide, thread-safe, size-bounded cache that maps a frame
+//! pointer (PC) to its symbolized information;
+//! Services print traces from the same few hundred call sites over and
+//! over again; with this cache the repeated symbolization of a PC is a
+//! hash lookup instead of backtrace_pcinfo() + demangling;
+//! The PCs are spread over a fixed number of shards, each having its
+//! own lock, so that concurrent lookups rarely contend; when a shard is
+//! full the oldest entry of that shard is evicted (FIFO);
+//! A PC only means the same code while its library stays loaded: every
+//! entry is tagged with the generation of the Symbolizer (see
+//! Symbolizer::generation()) it was resolved in, and is only served to
+//! lookups of that generation
+class FrameCache {
+public:
+    //! The cache used by Frame::resolve()
+    static FrameCache& instance();
+
+    explicit FrameCache(std::size_t i_capacity = 65536);
+
+    //! Returns true and copies the cached information to o_frame if
+    //! i_pc has been resolved in i_generation before
+    bool_t lookup(native_frame_ptr_t i_pc,
+                  unsigned long long i_generation,
+                  ResolvedFrame& o_frame);
+
+    //! Records the information of i_pc, resolved in i_generation; an
+    //! existing entry of the same generation is kept
+    void insert(native_frame_ptr_t i_pc,
+                unsigned long long i_generation,
+                const ResolvedFrame& i_frame);
+
+    //! Drops every entry; the counters are kept
+    void clear();
+
+    std::size_t size() const;
+
+    std::size_t capacity() const;
+
+    std::uint64_t hits() const;
+
+    std::uint64_t misses() const;
+
+private:
+    FrameCache(const FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    //! each shard sits on its own cache line(s) so that the lock and
+    //! the counters of one shard do not false-share with its neighbour
+    struct Entry {
+        ResolvedFrame m_frame;
+        unsigned long long m_generation;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex m_lock;
+        std::unordered_map<std::uintptr_t, Entry> m_entries;
+        //! insertion order, used as a ring buffer for FIFO eviction
+        std::unique_ptr<std::uintptr_t[]> m_order;
+        std::size_t m_next = 0;
+        std::atomic<std::uint64_t> m_hits{0};
+        std::atomic<std::uint64_t> m_misses{0};
+    };
+
+    static const std::size_t s_numShards = 64;
+
+    Shard& shardOf(native_frame_ptr_t i_pc);
+
+    std::size_t m_shardCapacity;
+    Shard m_shards[s_numShards];
+};
+
+#endif // _BKTCE_FRAME_CACHE_H
@@ -0,0 +1,237 @@
+
+#include "raw_stacktrace.h"
+
+#include "cfi_unwinder.h"
+
+#include <atomic>
+#include <cstdint>
+
+#include <pthread.h>
+#include <ucontext.h>
+
+namespace {
+
+std::atomic<UnwindBackend> s_backend(UnwindBackend::Cfi);
+
+//! the highest address of the calling thread's stack; 0 if unknown;
+//! plain initial-exec TLS: reading it never allocates
+__thread std::uintptr_t t_stackEnd __attribute__((tls_model("initial-exec"))) = 0;
+__thread bool_t t_stackKnown __attribute__((tls_model("initial-exec"))) = false;
+
+#if defined(__x86_64__) || defined(__aarch64__)
+//! follows the frame records from i_fp and appends their return
+//! addresses to o_buffer; both ABIs lay a frame record out as
+//!   fp[0]: the caller's frame pointer
+//!   fp[1]: the return address into the caller
+//! the records must lie in [i_low, i_end); returns false if the chain
+//! is broken (or i_end is unknown)
+bool_t walkFrameRecords(std::uintptr_t i_fp,
+                        std::uintptr_t i_low,
+                        std::uintptr_t i_end,
+                        std::size_t i_numSkippedFrames,
+                        native_frame_ptr_t* o_buffer,
+                        std::size_t i_capacity,
+                        std::size_t& io_size,
+                        bool_t& o_truncated) {
+    if (i_fp < i_low || i_fp % sizeof(std::uintptr_t) || i_fp + 2 * sizeof(std::uintptr_t) > i_end) {
+        return false;
+    }
+    const std::uintptr_t* fp = reinterpret_cast<const std::uintptr_t *>(i_fp);
+    std::size_t numSkippedFrames = i_numSkippedFrames;
+    while (true) {
+        native_frame_ptr_t ip = reinterpret_cast<native_frame_ptr_t>(fp[1]);
+        if (! ip) {
+            return true;
+        }
+        if (numSkippedFrames) {
+            numSkippedFrames -= 1;
+        } else if (io_size == i_capacity) {
+            o_truncated = true;
+            return true;
+        } else {
+            o_buffer[io_size++] = ip;
+        }
+
+        //! the outermost frames (_start, clone, or libc's start code
+        //! that is built without frame pointers) leave a null or
+        //! garbage frame pointer behind: a value outside the rest of
+        //! the stack ends the walk; a value inside it must be further
+        //! up and aligned, or the chain is broken
+        std::uintptr_t next = fp[0];
+        if (next <= reinterpret_cast<std::uintptr_t>(fp) || next + 2 * sizeof(std::uintptr_t) > i_end) {
+            return ! (next >= i_low && next < i_end);
+        }
+        if (next % sizeof(std::uintptr_t)) {
+            return false;
+        }
+        fp = reinterpret_cast<const std::uintptr_t *>(next);
+    }
+}
+#endif
+
+}
+
+//! pthread_getattr_np() may read /proc/self/maps (main thread)
+std::uintptr_t threadStackEnd(bool_t i_lookUp) {
+    if (! t_stackKnown && i_lookUp) {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            void* addr = nullptr;
+            std::size_t size = 0;
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                t_stackEnd = reinterpret_cast<std::uintptr_t>(addr) + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+        t_stackKnown = true;
+    }
+    return t_stackEnd;
+}
+
+void setUnwindBackend(UnwindBackend i_backend) {
+    s_backend.store(i_backend, std::memory_order_relaxed);
+}
+
+UnwindBackend unwindBackend() {
+    return s_backend.load(std::memory_order_relaxed);
+}
+
+__attribute__((noinline))
+std::size_t unwindStack(native_frame_ptr_t* o_buffer,
+                        std::size_t i_capacity,
+                        std::size_t i_numSkippedFrames,
+                        bool_t* o_truncated) {
+    std::size_t size = 0;
+    //! skip this function as well
+    switch (s_backend.load(std::memory_order_relaxed)) {
+    case UnwindBackend::FramePointer:
+        size = unwindStackFramePointer(o_buffer, i_capacity, i_numSkippedFrames + 1, o_truncated);
+        break;
+    case UnwindBackend::CachedCfi:
+        size = unwindStackCachedCfi(o_buffer, i_capacity, i_numSkippedFrames + 1, o_truncated);
+        break;
+    default:
+        size = unwindStackCfi(o_buffer, i_capacity, i_numSkippedFrames + 1, o_truncated);
+        break;
+    }
+    //! keep this frame on the stack: a tail call would remove it and
+    //! throw the number of skipped frames off by one
+    __asm__ __volatile__("" ::: "memory");
+    return size;
+}
+
+__attribute__((noinline))
+std::size_t unwindStackFramePointer(native_frame_ptr_t* o_buffer,
+                                    std::size_t i_capacity,
+                                    std::size_t i_numSkippedFrames,
+                                    bool_t* o_truncated) {
+#if defined(__x86_64__) || defined(__aarch64__)
+    //! __builtin_frame_address(0) forces this function to have a frame
+    //! record
+    std::uintptr_t fp = reinterpret_cast<std::uintptr_t>(__builtin_frame_address(0));
+    std::size_t size = 0;
+    bool_t truncated = false;
+    if (walkFrameRecords(fp, fp, threadStackEnd(), i_numSkippedFrames, o_buffer, i_capacity, size, truncated)) {
+        if (o_truncated) {
+            *o_truncated = truncated;
+        }
+        return size;
+    }
+#endif
+    //! some frame on the stack does not keep a frame pointer (or the
+    //! stack bounds are unknown); start over with the CFI unwinder,
+    //! skipping this function too
+    std::size_t numFrames = unwindStackCfi(o_buffer, i_capacity, i_numSkippedFrames + 1, o_truncated);
+    __asm__ __volatile__("" ::: "memory");
+    return numFrames;
+}
+
+namespace {
+
+//! the interrupted function, then the callers its frame pointer leads
+//! to; a function that has no frame record at that point (in its
+//! prologue, or a leaf compiled without one) hides its caller; returns
+//! false if the chain is broken, with the frames found so far
+bool_t walkSignalFrameRecords(const void* i_ucontext,
+                              native_frame_ptr_t* o_buffer,
+                              std::size_t i_capacity,
+                              std::size_t& o_size,
+                              bool_t& o_truncated) {
+    const ucontext_t* uc = static_cast<const ucontext_t *>(i_ucontext);
+    o_size = 0;
+    o_truncated = false;
+#if defined(__x86_64__) || defined(__aarch64__)
+#if defined(__x86_64__)
+    std::uintptr_t pc = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+    std::uintptr_t sp = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+    std::uintptr_t fp = static_cast<std::uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+#else
+    std::uintptr_t pc = static_cast<std::uintptr_t>(uc->uc_mcontext.pc);
+    std::uintptr_t sp = static_cast<std::uintptr_t>(uc->uc_mcontext.sp);
+    std::uintptr_t fp = static_cast<std::uintptr_t>(uc->uc_mcontext.regs[29]);
+#endif
+    if (! i_capacity) {
+        o_truncated = true;
+        return true;
+    }
+    o_buffer[o_size++] = reinterpret_cast<native_frame_ptr_t>(pc);
+    return walkFrameRecords(fp, sp, threadStackEnd(false), 0, o_buffer, i_capacity, o_size, o_truncated);
+#else
+    (void)uc;
+    (void)o_buffer;
+    (void)i_capacity;
+    return false;
+#endif
+}
+
+}
+
+std::size_t unwindSignalFramePointer(const void* i_ucontext,
+                                     native_frame_ptr_t* o_buffer,
+                                     std::size_t i_capacity,
+                                     bool_t* o_truncated) {
+    std::size_t size = 0;
+    bool_t truncated = false;
+    walkSignalFrameRecords(i_ucontext, o_buffer, i_capacity, size, truncated);
+    if (o_truncated) {
+        *o_truncated = truncated;
+    }
+    return size;
+}
+
+std::size_t unwindSignalContext(const void* i_ucontext,
+                                native_frame_ptr_t* o_buffer,
+                                std::size_t i_capacity,
+                                bool_t* o_truncated) {
+    std::size_t size = 0;
+    bool_t truncated = false;
+    if (s_backend.load(std::memory_order_relaxed) == UnwindBackend::FramePointer) {
+        if (walkSignalFrameRecords(i_ucontext, o_buffer, i_capacity, size, truncated)) {
+            if (o_truncated) {
+                *o_truncated = truncated;
+            }
+            return size;
+        }
+        return CfiUnwinder::instance().unwind(i_ucontext, o_buffer, i_capacity, o_truncated);
+    }
+
+    //! never _Unwind_Backtrace: it looks up the FDE of every frame with
+    //! dl_iterate_phdr(), which takes the loader's lock the interrupted
+    //! code may hold; CfiUnwinder does not
+    size = CfiUnwinder::instance().unwind(i_ucontext, o_buffer, i_capacity, &truncated);
+    if (size < 2 && ! truncated) {
+        //! no CFI for the interrupted PC (e.g. generated code): its
+        //! frame records may still lead to the callers
+        std::size_t fpSize = 0;
+        bool_t fpTruncated = false;
+        walkSignalFrameRecords(i_ucontext, o_buffer, i_capacity, fpSize, fpTruncated);
+        if (fpSize >= size) {
+            size = fpSize;
+            truncated = fpTruncated;
+        }
+    }
+    if (o_truncated) {
+        *o_truncated = truncated;
+    }
+    return size;
+}
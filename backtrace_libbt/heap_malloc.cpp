@@ -0,0 +1,132 @@
+
+//! The allocator interposition layer of the heap profiler;
+//! This file is built into its own shared library (bktce_heapprof),
+//! link it or LD_PRELOAD it to route malloc and friends through
+//! HeapProfiler; glibc's operator new/delete call malloc/free, so C++
+//! allocations are covered as well;
+//! The profiler can also be started without touching the program:
+//!   BKTCE_HEAPPROF_INTERVAL=<bytes>  start sampling at load time
+//!   BKTCE_HEAPPROF_DUMP=<path>       write the report on SIGUSR2
+
+#include "heap_profiler.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <malloc.h>
+#include <signal.h>
+
+extern "C" {
+
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void* __libc_valloc(size_t);
+void __libc_free(void*);
+
+void* malloc(size_t i_size) {
+    void* p = __libc_malloc(i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler && p) {
+        profiler->onAlloc(p, i_size);
+    }
+    return p;
+}
+
+void free(void* i_ptr) {
+    HeapProfiler* profiler = HeapProfiler::active();
+    //! forget the pointer before the block can be handed out again
+    if (profiler) {
+        profiler->onFree(i_ptr);
+    }
+    __libc_free(i_ptr);
+}
+
+void* calloc(size_t i_num, size_t i_size) {
+    void* p = __libc_calloc(i_num, i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler && p) {
+        profiler->onAlloc(p, i_num * i_size);
+    }
+    return p;
+}
+
+void* realloc(void* i_ptr, size_t i_size) {
+    void* p = __libc_realloc(i_ptr, i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    //! a failed realloc leaves the block alone; realloc(ptr, 0) frees
+    //! it; another thread may have been handed a moved block's old
+    //! address meanwhile, but the stale entry comes first in its probe
+    //! chain, so it is the one forgotten
+    if (profiler && i_ptr && (p || ! i_size)) {
+        profiler->onFree(i_ptr);
+    }
+    if (profiler && p) {
+        profiler->onAlloc(p, i_size);
+    }
+    return p;
+}
+
+void* memalign(size_t i_alignment, size_t i_size) {
+    void* p = __libc_memalign(i_alignment, i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler && p) {
+        profiler->onAlloc(p, i_size);
+    }
+    return p;
+}
+
+void* aligned_alloc(size_t i_alignment, size_t i_size) {
+    void* p = __libc_memalign(i_alignment, i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler && p) {
+        profiler->onAlloc(p, i_size);
+    }
+    return p;
+}
+
+int posix_memalign(void** o_ptr, size_t i_alignment, size_t i_size) {
+    if (i_alignment % sizeof(void*) || (i_alignment & (i_alignment - 1))) {
+        return EINVAL;
+    }
+    void* p = __libc_memalign(i_alignment, i_size);
+    if (! p) {
+        return ENOMEM;
+    }
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler) {
+        profiler->onAlloc(p, i_size);
+    }
+    *o_ptr = p;
+    return 0;
+}
+
+void* valloc(size_t i_size) {
+    void* p = __libc_valloc(i_size);
+    HeapProfiler* profiler = HeapProfiler::active();
+    if (profiler && p) {
+        profiler->onAlloc(p, i_size);
+    }
+    return p;
+}
+
+}
+
+namespace {
+
+__attribute__((constructor))
+void startFromEnvironment() {
+    const char* interval = std::getenv("BKTCE_HEAPPROF_INTERVAL");
+    if (! interval) {
+        return;
+    }
+    HeapProfiler& profiler = HeapProfiler::instance();
+    profiler.start(std::strtoul(interval, nullptr, 10));
+    const char* path = std::getenv("BKTCE_HEAPPROF_DUMP");
+    if (path) {
+        profiler.dumpOnSignal(SIGUSR2, path);
+    }
+}
+
+}
@@ -0,0 +1,374 @@
+
+#include "heap_profiler.h"
+
+#include "raw_stacktrace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fstream>
+#include <new>
+#include <ostream>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
+
+namespace {
+
+//! the allocator hooks run before (and while) any C++ thread_local is
+//! constructed; plain initial-exec TLS never calls into the allocator
+__thread bool_t t_inGuard __attribute__((tls_model("initial-exec"))) = false;
+__thread bool_t t_seeded __attribute__((tls_model("initial-exec"))) = false;
+__thread std::int64_t t_untilSample __attribute__((tls_model("initial-exec"))) = 0;
+__thread std::uint64_t t_random __attribute__((tls_model("initial-exec"))) = 0;
+//! the HeapProfiler::m_epoch t_untilSample was drawn in
+__thread std::uint32_t t_epoch __attribute__((tls_model("initial-exec"))) = 0;
+
+void* reserve(std::size_t i_bytes) {
+    void* p = mmap(nullptr, i_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void lock(std::atomic_flag& io_lock) {
+    while (io_lock.test_and_set(std::memory_order_acquire)) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+void unlock(std::atomic_flag& io_lock) {
+    io_lock.clear(std::memory_order_release);
+}
+
+}
+
+std::atomic<HeapProfiler*> HeapProfiler::s_active(nullptr);
+
+HeapProfiler::Guard::Guard()
+ : m_owns(! t_inGuard) {
+    t_inGuard = true;
+}
+
+HeapProfiler::Guard::~Guard() {
+    if (m_owns) {
+        t_inGuard = false;
+    }
+}
+
+HeapProfiler& HeapProfiler::instance() {
+    static HeapProfiler* s_instance = new HeapProfiler;
+    return *s_instance;
+}
+
+HeapProfiler::HeapProfiler()
+ : m_interval(512 * 1024),
+   m_epoch(0),
+   m_stacks(nullptr),
+   m_dropped(0),
+   m_dumpPath() {
+    Allocation* entries = static_cast<Allocation *>(
+        reserve(s_numShards * s_shardCapacity * sizeof(Allocation)));
+    for (std::size_t i = 0; i < s_numShards; ++i) {
+        m_shards[i].m_lock.clear();
+        m_shards[i].m_size = 0;
+        m_shards[i].m_entries = entries + i * s_shardCapacity;
+    }
+    for (std::size_t i = 0; i < s_filterSize; ++i) {
+        m_filter[i].store(0, std::memory_order_relaxed);
+    }
+    //! zero-filled pages are valid, empty StackStats
+    m_stacks = static_cast<StackStats *>(reserve(s_maxStacks * sizeof(StackStats)));
+    sem_init(&m_dumpRequest, 0, 0);
+    StackDepot::instance();
+}
+
+void HeapProfiler::start(std::size_t i_samplingInterval) {
+    Guard guard;
+    //! initialize libgcc's unwinder and the depot outside the hooks
+    RawStacktrace<4> warmUp;
+    (void)warmUp;
+    m_interval.store(i_samplingInterval ? i_samplingInterval : 1);
+    m_epoch.fetch_add(1);
+    s_active.store(this, std::memory_order_release);
+}
+
+void HeapProfiler::stop() {
+    m_interval.store(0);
+}
+
+std::size_t HeapProfiler::hashPtr(std::uintptr_t i_ptr) {
+    std::uint64_t h = i_ptr;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return static_cast<std::size_t>(h);
+}
+
+std::int64_t HeapProfiler::nextInterval() {
+    if (! t_seeded) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        t_random = hashPtr(reinterpret_cast<std::uintptr_t>(&t_random)
+                           ^ static_cast<std::uintptr_t>(now.tv_nsec)) | 1;
+        t_seeded = true;
+    }
+    //! xorshift64*, then an exponentially distributed gap
+    t_random ^= t_random >> 12;
+    t_random ^= t_random << 25;
+    t_random ^= t_random >> 27;
+    std::uint64_t r = t_random * 0x2545F4914F6CDD1DULL;
+    double u = (static_cast<double>(r >> 11) + 1.0) / 9007199254740993.0;
+    double gap = -std::log(u) * static_cast<double>(m_interval.load(std::memory_order_relaxed));
+    return static_cast<std::int64_t>(std::min(gap, 1e15)) + 1;
+}
+
+__attribute__((noinline))
+void HeapProfiler::onAlloc(void* i_ptr, std::size_t i_size) {
+    if (t_inGuard) {
+        return;
+    }
+    t_untilSample -= static_cast<std::int64_t>(i_size);
+    if (t_untilSample > 0) {
+        return;
+    }
+    Guard guard;
+    if (! m_interval.load(std::memory_order_relaxed)) {
+        //! look again later: the profiler may be restarted
+        t_untilSample = s_stoppedGap;
+        return;
+    }
+    //! a thread's first allocation, or its first since the profiler
+    //! was (re)started, only draws a gap: the one it had was drawn
+    //! for another interval, or while stopped
+    std::uint32_t epoch = m_epoch.load(std::memory_order_relaxed);
+    bool_t current = t_seeded && t_epoch == epoch;
+    t_epoch = epoch;
+    t_untilSample = nextInterval();
+    if (current) {
+        sample(i_ptr, i_size);
+    }
+}
+
+__attribute__((noinline))
+void HeapProfiler::sample(void* i_ptr, std::size_t i_size) {
+    //! skip sample(), onAlloc() and the allocator hook
+    RawStacktrace<s_maxDepth> stack(3);
+    stack_id_t id = StackDepot::instance().put(stack);
+    StackStats* st = id ? stats(id) : nullptr;
+    if (! st) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    //! the probability that a block of i_size bytes is sampled is
+    //! 1 - exp(-i_size / interval); weigh the sample by its inverse
+    double interval = static_cast<double>(m_interval.load(std::memory_order_relaxed));
+    double p = 1.0 - std::exp(-static_cast<double>(i_size) / interval);
+    if (p <= 0.0) {
+        p = 1.0 / interval;
+    }
+    Allocation alloc;
+    alloc.m_ptr = reinterpret_cast<std::uintptr_t>(i_ptr);
+    alloc.m_stack = id;
+    alloc.m_count = static_cast<std::uint32_t>(std::min(1.0 / p + 0.5, 4294967295.0));
+    alloc.m_bytes = static_cast<std::uint64_t>(static_cast<double>(i_size) / p + 0.5);
+
+    std::size_t h = hashPtr(alloc.m_ptr);
+    Shard& shard = m_shards[h % s_numShards];
+    std::atomic<std::uint16_t>& filter = m_filter[(h >> 24) % s_filterSize];
+    filter.fetch_add(1, std::memory_order_relaxed);
+    lock(shard.m_lock);
+    if (shard.m_size >= s_shardCapacity * 3 / 4) {
+        unlock(shard.m_lock);
+        filter.fetch_sub(1, std::memory_order_relaxed);
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    std::size_t mask = s_shardCapacity - 1;
+    std::size_t i = (h >> 6) & mask;
+    while (shard.m_entries[i].m_ptr) {
+        i = (i + 1) & mask;
+    }
+    shard.m_entries[i] = alloc;
+    shard.m_size += 1;
+    unlock(shard.m_lock);
+
+    st->m_allocs.fetch_add(alloc.m_count, std::memory_order_relaxed);
+    st->m_allocBytes.fetch_add(alloc.m_bytes, std::memory_order_relaxed);
+}
+
+void HeapProfiler::onFree(void* i_ptr) {
+    if (! i_ptr) {
+        return;
+    }
+    std::uintptr_t ptr = reinterpret_cast<std::uintptr_t>(i_ptr);
+    std::size_t h = hashPtr(ptr);
+    std::atomic<std::uint16_t>& filter = m_filter[(h >> 24) % s_filterSize];
+    if (! filter.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    Shard& shard = m_shards[h % s_numShards];
+    std::size_t mask = s_shardCapacity - 1;
+    lock(shard.m_lock);
+    std::size_t i = (h >> 6) & mask;
+    while (shard.m_entries[i].m_ptr && shard.m_entries[i].m_ptr != ptr) {
+        i = (i + 1) & mask;
+    }
+    if (! shard.m_entries[i].m_ptr) {
+        unlock(shard.m_lock);
+        return;
+    }
+    Allocation alloc = shard.m_entries[i];
+
+    //! backward shift deletion keeps every probe chain contiguous
+    for (std::size_t j = (i + 1) & mask; shard.m_entries[j].m_ptr; j = (j + 1) & mask) {
+        std::size_t home = (hashPtr(shard.m_entries[j].m_ptr) >> 6) & mask;
+        bool_t stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (! stays) {
+            shard.m_entries[i] = shard.m_entries[j];
+            i = j;
+        }
+    }
+    shard.m_entries[i].m_ptr = 0;
+    shard.m_size -= 1;
+    unlock(shard.m_lock);
+    filter.fetch_sub(1, std::memory_order_relaxed);
+
+    StackStats* st = stats(alloc.m_stack);
+    if (st) {
+        st->m_frees.fetch_add(alloc.m_count, std::memory_order_relaxed);
+        st->m_freeBytes.fetch_add(alloc.m_bytes, std::memory_order_relaxed);
+    }
+}
+
+HeapProfiler::StackStats* HeapProfiler::stats(stack_id_t i_stack) {
+    std::size_t mask = s_maxStacks - 1;
+    std::size_t i = hashPtr(i_stack) & mask;
+    for (std::size_t probes = 0; probes < s_maxStacks; ++probes, i = (i + 1) & mask) {
+        stack_id_t id = m_stacks[i].m_stack.load(std::memory_order_acquire);
+        if (id == i_stack) {
+            return &m_stacks[i];
+        }
+        if (! id) {
+            stack_id_t expected = 0;
+            if (m_stacks[i].m_stack.compare_exchange_strong(expected, i_stack)
+                || expected == i_stack) {
+                return &m_stacks[i];
+            }
+        }
+    }
+    return nullptr;
+}
+
+void HeapProfiler::writeReport(std::ostream& o_stream) const {
+    Guard guard;
+    struct Row {
+        stack_id_t m_stack;
+        std::int64_t m_liveBytes;
+        std::int64_t m_liveCount;
+        std::uint64_t m_allocBytes;
+        std::uint64_t m_allocs;
+    };
+    std::vector<Row> rows;
+    std::int64_t total = 0;
+    for (std::size_t i = 0; i < s_maxStacks; ++i) {
+        const StackStats& st = m_stacks[i];
+        stack_id_t id = st.m_stack.load(std::memory_order_acquire);
+        if (! id) {
+            continue;
+        }
+        Row row;
+        row.m_stack = id;
+        row.m_allocBytes = st.m_allocBytes.load(std::memory_order_relaxed);
+        row.m_allocs = st.m_allocs.load(std::memory_order_relaxed);
+        row.m_liveBytes = static_cast<std::int64_t>(row.m_allocBytes - st.m_freeBytes.load(std::memory_order_relaxed));
+        row.m_liveCount = static_cast<std::int64_t>(row.m_allocs - st.m_frees.load(std::memory_order_relaxed));
+        total += row.m_liveBytes;
+        rows.push_back(row);
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& lhs, const Row& rhs) {
+        return lhs.m_liveBytes > rhs.m_liveBytes;
+    });
+
+    o_stream << "heap profile: " << rows.size() << " stacks, "
+             << total << " live bytes (estimated), "
+             << dropped() << " samples dropped\n";
+    for (const Row& row : rows) {
+        o_stream << "\n"
+                 << row.m_liveBytes << " live bytes in " << row.m_liveCount << " blocks; "
+                 << row.m_allocBytes << " bytes in " << row.m_allocs << " blocks allocated\n";
+        Stacktrace st = StackDepot::instance().toStacktrace(row.m_stack);
+        st.resolve();
+        for (const Frame& frame : st.getFrames()) {
+            o_stream << "    " << frame.toString();
+        }
+        if (st.truncated()) {
+            o_stream << "    ... (truncated)\n";
+        }
+    }
+}
+
+bool_t HeapProfiler::writeReport(const char* i_path) const {
+    Guard guard;
+    std::ofstream ofs(i_path);
+    if (! ofs) {
+        return false;
+    }
+    writeReport(ofs);
+    return true;
+}
+
+void HeapProfiler::onSignal(int) {
+    int savedErrno = errno;
+    sem_post(&instance().m_dumpRequest);
+    errno = savedErrno;
+}
+
+bool_t HeapProfiler::dumpOnSignal(int i_signal, const char* i_path) {
+    Guard guard;
+    if (m_dumper.joinable()) {
+        return false;
+    }
+    m_dumpPath = i_path;
+    m_dumper = std::thread(&HeapProfiler::dump, this);
+    struct sigaction action = {};
+    action.sa_handler = &HeapProfiler::onSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(i_signal, &action, nullptr) == 0;
+}
+
+void HeapProfiler::dump() {
+    Guard guard;
+    while (true) {
+        if (sem_wait(&m_dumpRequest) != 0) {
+            continue;
+        }
+        writeReport(m_dumpPath.c_str());
+    }
+}
+
+std::int64_t HeapProfiler::liveBytes() const {
+    std::int64_t total = 0;
+    for (std::size_t i = 0; i < s_maxStacks; ++i) {
+        const StackStats& st = m_stacks[i];
+        if (st.m_stack.load(std::memory_order_acquire)) {
+            total += static_cast<std::int64_t>(
+                st.m_allocBytes.load(std::memory_order_relaxed)
+                - st.m_freeBytes.load(std::memory_order_relaxed));
+        }
+    }
+    return total;
+}
+
+std::uint64_t HeapProfiler::dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,154 @@
+#ifndef _BKTCE_HEAP_PROFILER_H
+#define _BKTCE_HEAP_PROFILER_H
+
+#include "bktce.h"
+#include "stack_depot.h"
+
+#include <atomic>
+#include <iosfwd>
+#include <thread>
+
+#include <semaphore.h>
+
+//! A sampling heap profiler that attributes live heap bytes to the call
+//! stacks that allocated them;
+//! Allocations are sampled with a Poisson process over the allocated
+//! bytes: on average one sample per i_samplingInterval bytes, so large
+//! allocations are almost always seen and the small ones in proportion
+//! to their volume; each sample is weighted back to an unbiased
+//! estimate of the bytes (and allocations) it stands for;
+//! The profiler is fed by an allocator interposition layer; link (or
+//! LD_PRELOAD) the bktce_heapprof library, which overrides malloc and
+//! friends (and therefore the default operator new/delete), and call
+//! start(); the hooks cost a thread-local subtraction per allocation
+//! and one load per free while nothing is sampled;
+//! Sampled pointers and per-stack counters live in fixed-size tables
+//! in memory mapped up front: the hooks never allocate; samples that
+//! do not fit are counted as dropped
+class HeapProfiler {
+public:
+    //! The process-wide profiler; it is never destroyed
+    static HeapProfiler& instance();
+
+    //! The profiler if it is started, nullptr otherwise; this is what
+    //! the allocator hooks check, it never constructs the profiler
+    static HeapProfiler* active() {
+        return s_active.load(std::memory_order_acquire);
+    }
+
+    //! Starts sampling; i_samplingInterval is the mean number of bytes
+    //! between two samples
+    void start(std::size_t i_samplingInterval = 512 * 1024);
+
+    //! Stops sampling new allocations; frees of sampled pointers are
+    //! still accounted for
+    void stop();
+
+    //! Allocator hook: i_ptr is a new block of i_size bytes
+    void onAlloc(void* i_ptr, std::size_t i_size);
+
+    //! Allocator hook: i_ptr is about to be freed
+    void onFree(void* i_ptr);
+
+    //! Writes the stacks sorted by their estimated live bytes
+    void writeReport(std::ostream& o_stream) const;
+
+    //! Writes the report to a file; returns false if it can not be opened
+    bool_t writeReport(const char* i_path) const;
+
+    //! Writes the report to i_path every time the process receives
+    //! i_signal (e.g. SIGUSR2); the signal handler only wakes up a
+    //! dumper thread; returns false on failure
+    bool_t dumpOnSignal(int i_signal, const char* i_path);
+
+    //! Estimated bytes allocated by sampled stacks and not yet freed
+    std::int64_t liveBytes() const;
+
+    //! Number of samples lost because a table was full
+    std::uint64_t dropped() const;
+
+    //! Disables sampling on the calling thread while in scope; the
+    //! profiler uses it around its own allocations
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+
+        //! false if the calling thread is already inside a guard
+        bool_t owns() const {
+            return m_owns;
+        }
+
+    private:
+        bool_t m_owns;
+    };
+
+private:
+    static const std::size_t s_maxDepth = 64;
+    static const std::size_t s_numShards = 64;
+    static const std::size_t s_shardCapacity = 4096;
+    static const std::size_t s_filterSize = 1 << 16;
+    static const std::size_t s_maxStacks = 1 << 16;
+    //! bytes a thread allocates between two checks while stopped
+    static const std::int64_t s_stoppedGap = 1 << 20;
+
+    //! a sampled, not yet freed allocation
+    struct Allocation {
+        std::uintptr_t m_ptr;
+        stack_id_t m_stack;
+        std::uint32_t m_count;
+        std::uint64_t m_bytes;
+    };
+
+    //! open addressing table of sampled pointers, with backward shift
+    //! deletion; guarded by a spinlock (the hooks can not use a mutex
+    //! that may allocate or be held across a fork)
+    struct alignas(64) Shard {
+        std::atomic_flag m_lock;
+        std::size_t m_size;
+        Allocation* m_entries;
+    };
+
+    //! counters of one stack; all values are estimates
+    struct StackStats {
+        std::atomic<stack_id_t> m_stack;
+        std::atomic<std::uint64_t> m_allocs;
+        std::atomic<std::uint64_t> m_allocBytes;
+        std::atomic<std::uint64_t> m_frees;
+        std::atomic<std::uint64_t> m_freeBytes;
+    };
+
+    HeapProfiler();
+    HeapProfiler(const HeapProfiler&) = delete;
+    HeapProfiler& operator=(const HeapProfiler&) = delete;
+
+    std::int64_t nextInterval();
+
+    void sample(void* i_ptr, std::size_t i_size);
+
+    StackStats* stats(stack_id_t i_stack);
+
+    static std::size_t hashPtr(std::uintptr_t i_ptr);
+
+    static void onSignal(int i_signal);
+
+    void dump();
+
+    static std::atomic<HeapProfiler*> s_active;
+
+    std::atomic<std::size_t> m_interval;
+    //! incremented by start()
+    std::atomic<std::uint32_t> m_epoch;
+    Shard m_shards[s_numShards];
+    //! counts sampled pointers per hash bucket, so that a free of an
+    //! unsampled pointer (nearly all of them) is a single relaxed load
+    std::atomic<std::uint16_t> m_filter[s_filterSize];
+    StackStats* m_stacks;
+    std::atomic<std::uint64_t> m_dropped;
+
+    sem_t m_dumpRequest;
+    string_t m_dumpPath;
+    std::thread m_dumper;
+};
+
+#endif // _BKTCE_HEAP_PROFILER_H
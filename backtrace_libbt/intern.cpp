@@ -0,0 +1,81 @@
+
+#include "intern.h"
+
+#include <functional>
+#include <stdexcept>
+
+StringTable& StringTable::instance() {
+    //! never destroyed: frames may be printed from static destructors
+    static StringTable* s_instance = new StringTable;
+    return *s_instance;
+}
+
+StringTable::StringTable()
+ : m_nextId(1) {
+    for (std::atomic<Entry*>& page : m_pages) {
+        page.store(nullptr, std::memory_order_relaxed);
+    }
+    Entry* first = pageOf(s_emptyId);
+    first[s_emptyId].m_data = "";
+    first[s_emptyId].m_size = 0;
+}
+
+StringTable::Entry* StringTable::pageOf(string_id_t i_id) {
+    std::size_t index = i_id >> s_pageBits;
+    if (index >= s_numPages) {
+        throw std::length_error("StringTable is full");
+    }
+    Entry* page = m_pages[index].load(std::memory_order_acquire);
+    if (page) {
+        return page;
+    }
+    std::lock_guard<std::mutex> lock(m_pageLock);
+    page = m_pages[index].load(std::memory_order_relaxed);
+    if (! page) {
+        page = new Entry[s_pageSize];
+        m_pages[index].store(page, std::memory_order_release);
+    }
+    return page;
+}
+
+string_id_t StringTable::intern(string_view_t i_str) {
+    if (i_str.empty()) {
+        return s_emptyId;
+    }
+    Shard& shard = m_shards[std::hash<string_view_t>()(i_str) % s_numShards];
+    std::lock_guard<std::mutex> lock(shard.m_lock);
+    auto it = shard.m_ids.find(i_str);
+    if (it != shard.m_ids.end()) {
+        return it->second;
+    }
+
+    //! the entry is written before the id is handed out (through the
+    //! return value or through the shard's map under its lock), so
+    //! any thread that holds the id can read the entry
+    string_view_t stored = shard.m_arena.copy(i_str);
+    string_id_t id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+    Entry& entry = pageOf(id)[id & (s_pageSize - 1)];
+    entry.m_data = stored.data();
+    entry.m_size = stored.size();
+    shard.m_ids.emplace(stored, id);
+    return id;
+}
+
+string_view_t StringTable::get(string_id_t i_id) const {
+    const Entry* page = m_pages[i_id >> s_pageBits].load(std::memory_order_acquire);
+    const Entry& entry = page[i_id & (s_pageSize - 1)];
+    return string_view_t(entry.m_data, entry.m_size);
+}
+
+std::size_t StringTable::size() const {
+    return m_nextId.load(std::memory_order_relaxed);
+}
+
+std::size_t StringTable::bytesReserved() const {
+    std::size_t total = 0;
+    for (const Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.m_lock);
+        total += shard.m_arena.bytesReserved();
+    }
+    return total;
+}
@@ -0,0 +1,70 @@
+#ifndef _BKTCE_INTERN_H
+#define _BKTCE_INTERN_H
+
+#include "arena.h"
+#include "bktce.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+//! A process-wide, append-only table of unique strings;
+//! Function, source file and binary names repeat across frames and
+//! across traces; each distinct name is stored once and referred to
+//! by a 32-bit id, so a Frame holds three ids instead of three
+//! std::strings;
+//! id 0 is always the empty string;
+//! intern() locks one of 16 shards; get() never locks
+class StringTable {
+public:
+    static StringTable& instance();
+
+    static const string_id_t s_emptyId = 0;
+
+    StringTable();
+
+    //! Returns the id of i_str, adding it to the table if needed
+    string_id_t intern(string_view_t i_str);
+
+    //! Returns the string of an id returned by intern(); the view (and
+    //! the terminating null after it) stays valid for the lifetime of
+    //! the table
+    string_view_t get(string_id_t i_id) const;
+
+    //! Number of distinct strings
+    std::size_t size() const;
+
+    //! Number of bytes held by the string storage
+    std::size_t bytesReserved() const;
+
+private:
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+
+    struct Entry {
+        const char* m_data;
+        std::size_t m_size;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex m_lock;
+        std::unordered_map<string_view_t, string_id_t> m_ids;
+        Arena m_arena;
+    };
+
+    //! the entries live in fixed-size pages that are never moved, so
+    //! get() can read them without taking a lock
+    static const std::size_t s_pageBits = 12;
+    static const std::size_t s_pageSize = 1 << s_pageBits;
+    static const std::size_t s_numPages = 1024;
+    static const std::size_t s_numShards = 16;
+
+    Entry* pageOf(string_id_t i_id);
+
+    std::atomic<string_id_t> m_nextId;
+    std::atomic<Entry*> m_pages[s_numPages];
+    std::mutex m_pageLock;
+    Shard m_shards[s_numShards];
+};
+
+#endif // _BKTCE_INTERN_H
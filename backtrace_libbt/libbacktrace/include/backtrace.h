@@ -98,6 +98,22 @@ extern struct backtrace_state *backtrace_create_state (
     const char *filename, int threaded,
     backtrace_error_callback error_callback, void *data);
 
+/* Read the debug information of the ELF file FILENAME as if it were
+   loaded at BASE_ADDRESS (the value dl_iterate_phdr reports as
+   dlpi_addr; 0 for a non-PIE executable).  Once a module has been
+   added this way, STATE never looks at the modules of the running
+   process: it symbolizes the PCs of whatever process loaded the
+   modules, e.g. when reading a trace log written by another process
+   on another machine.  Call this before any other use of STATE.
+   Returns 1 on success, or if only the symbol table could be read; 0
+   on failure (after calling ERROR_CALLBACK).  */
+
+extern int backtrace_add_module (struct backtrace_state *state,
+				 const char *filename,
+				 uintptr_t base_address,
+				 backtrace_error_callback error_callback,
+				 void *data);
+
 /* The type of the callback argument to the backtrace_full function.
    DATA is the argument passed to backtrace_full.  PC is the program
    counter.  FILENAME is the name of the file containing PC, or NULL
@@ -166,6 +182,30 @@ extern int backtrace_pcinfo (struct backtrace_state *state, uintptr_t pc,
 			     backtrace_error_callback error_callback,
 			     void *data);
 
+/* The type of the callback argument to backtrace_pcinfo_batch.  It is
+   like backtrace_full_callback, with INDEX the position of PC in the
+   array passed to backtrace_pcinfo_batch.  */
+
+typedef int (*backtrace_batch_callback) (void *data, size_t index,
+					 uintptr_t pc, const char *filename,
+					 int lineno, const char *function);
+
+/* Like backtrace_pcinfo, for COUNT program counters at once.  The PCs
+   are sorted internally and resolved in one sweep per module and per
+   compilation unit, which is much cheaper than COUNT independent
+   lookups when the PCs are close to each other (a stack trace, a set
+   of samples).  The callback is called at least once for each PC
+   (more than once for inlined calls), grouped by module and in
+   ascending PC order rather than in array order; use INDEX to map the
+   results back.  This
+   returns the first non-zero value returned by CALLBACK, or 0.  */
+
+extern int backtrace_pcinfo_batch (struct backtrace_state *state,
+				   const uintptr_t *pcs, size_t count,
+				   backtrace_batch_callback callback,
+				   backtrace_error_callback error_callback,
+				   void *data);
+
 /* The type of the callback argument to backtrace_syminfo.  DATA and
    PC are the arguments passed to backtrace_syminfo.  SYMNAME is the
    name of the symbol for the corresponding code.  SYMVAL is the
@@ -192,6 +232,136 @@ extern int backtrace_syminfo (struct backtrace_state *state, uintptr_t addr,
 			      backtrace_error_callback error_callback,
 			      void *data);
 
+/* Read the debug information of every module of the process now.
+   The executable is read by the first call that needs debug
+   information, but a shared library is only read when one of its PCs
+   is first looked up, so that the libraries a program never
+   symbolizes cost nothing; call this before the lookups that must not
+   open or read files, e.g. in a signal handler.  Returns 1 on success,
+   0 on failure (after calling ERROR_CALLBACK).
+
+   This function, and every lookup of a PC that is in none of the
+   modules known so far, first checks the loader's counters of loaded
+   and unloaded objects with dl_iterate_phdr (which takes the loader's
+   lock): if they moved, the libraries loaded with dlopen since are
+   registered and the ones unloaded since are forgotten.  The lookups
+   of a PC in a known module do not check them: see
+   backtrace_refresh_modules, and backtrace_freeze_modules for the
+   lookups that must not take that lock.  */
+
+extern int backtrace_load_modules (struct backtrace_state *state,
+				   backtrace_error_callback error_callback,
+				   void *data);
+
+/* Check the loader's counters now (see backtrace_load_modules), and if
+   they moved, register the libraries loaded since and forget the ones
+   unloaded since.  A lookup takes a PC in the range of a library
+   unloaded since for that library: call this after dlclose, before
+   looking up the PCs of a library that may have been loaded at the
+   addresses of the unloaded one.  Returns 1 if a library was
+   registered or forgotten, 0 otherwise.  */
+
+extern int backtrace_refresh_modules (struct backtrace_state *state,
+				      backtrace_error_callback error_callback,
+				      void *data);
+
+/* If FROZEN, make the lookups of the calling thread skip the check of
+   the loader's counters (see backtrace_load_modules): they use the
+   modules known so far, and never take the loader's lock, which the
+   thread may hold already (e.g. a signal handler that interrupted
+   dlopen).  The other waits of a lookup are bounded.  If not FROZEN,
+   check them again.  backtrace_refresh_modules checks them either
+   way.  Returns the previous setting.  Without thread-local storage
+   this does nothing and returns 0.  */
+
+extern int backtrace_freeze_modules (int frozen);
+
+/* Like backtrace_load_modules, but read the shared libraries with
+   THREADS threads: the calling thread and THREADS - 1 threads it
+   starts, each reading the next library no other thread reads yet.
+   What each thread reads is published into STATE as it is done, as
+   when lookups read them.  This is only useful at startup, to take the
+   reading of many large libraries off the first traces: a library
+   read by a thread is not read faster, so the gain is bounded by the
+   largest library (the executable, read first, is not shared out).
+   STATE must be threaded; otherwise, or if THREADS is not above 1,
+   this is backtrace_load_modules.  ERROR_CALLBACK may be called by
+   several threads at once.  Returns 1 on success, 0 on failure.  */
+
+extern int backtrace_load_modules_parallel
+  (struct backtrace_state *state, int threads,
+   backtrace_error_callback error_callback, void *data);
+
+/* Counters of the work STATE has done, for measuring how it behaves
+   (e.g. how much work threads sharing STATE duplicate).  */
+
+struct backtrace_stats
+{
+  /* Number of times the debug information of the executable was read
+     (the symbol tables and the index of the compilation units).  In
+     threaded mode one thread reads it while the others wait, so more
+     than one means that a signal handler read it again.  */
+  size_t initializations;
+  /* Number of times the line and function information of a
+     compilation unit was read.  */
+  size_t units_read;
+  /* Of those, the reads of a unit that had been read already.  A unit
+     is read by the first thread that needs it while the others wait,
+     so this stays 0.  */
+  size_t units_reread;
+  /* Number of lookups that waited too long for another thread to read
+     the unit or the module of their PC, and answered with the symbol
+     only.  */
+  size_t symbol_only;
+  /* Number of backtrace_alloc calls that found the free list locked by
+     another thread and mapped fresh pages instead.  */
+  size_t alloc_lock_misses;
+  /* Bytes of anonymous memory mapped by backtrace_alloc.  */
+  size_t alloc_mapped_bytes;
+  /* Bytes of it unmapped again, e.g. the memory read from a shared
+     library once it is unloaded.  */
+  size_t alloc_unmapped_bytes;
+};
+
+/* Copy the counters of STATE to *STATS.  In threaded mode the
+   counters are read without synchronization: call this when the
+   threads are done for exact numbers.  */
+
+extern void backtrace_get_stats (struct backtrace_state *state,
+				 struct backtrace_stats *stats);
+
+/* What backtrace_prewarm_units did.  */
+
+struct backtrace_prewarm_stats
+{
+  /* Number of compilation units of the modules with debug info.  */
+  size_t units;
+  /* Of those, the units whose line and function information the call
+     read (the others had been read already).  */
+  size_t units_read;
+  /* Wall-clock time the call took, in nanoseconds.  */
+  uint64_t elapsed_ns;
+  /* Bytes of memory STATE mapped during the call.  */
+  size_t mapped_bytes;
+};
+
+/* Read every module, like backtrace_load_modules_parallel, then the
+   line and function information of every compilation unit, with
+   THREADS threads.  The lookups otherwise read a unit on its first
+   PC; after this call every lookup only searches.  Meant for offline
+   or batch symbolization, where all the units end up read anyway:
+   this takes much more memory than the units a program ever looks
+   up.  STATE must be threaded for THREADS above 1 to be used.  If
+   STATS is not NULL, it is set to what the call did.  ERROR_CALLBACK
+   may be called by several threads at once.  Returns 1 on success, 0
+   on failure.  */
+
+extern int backtrace_prewarm_units (struct backtrace_state *state,
+				    int threads,
+				    struct backtrace_prewarm_stats *stats,
+				    backtrace_error_callback error_callback,
+				    void *data);
+
 #ifdef __cplusplus
 } /* End extern "C".  */
 #endif
@@ -47,6 +47,9 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
+/* Define to 1 if you have the <pthread.h> header file and the library. */
+#define HAVE_PTHREAD 1
+
 /* Define to 1 if you have the `readlink' function. */
 #define HAVE_READLINK 1
 
@@ -65,6 +68,9 @@
 /* Define to 1 if you have the __sync functions */
 #define HAVE_SYNC_FUNCTIONS 1
 
+/* Define to 1 if the compiler supports __thread */
+#define HAVE_TLS 1
+
 /* Define to 1 if you have the <sys/ldr.h> header file. */
 /* #undef HAVE_SYS_LDR_H */
 
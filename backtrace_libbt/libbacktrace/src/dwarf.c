@@ -33,9 +33,11 @@ POSSIBILITY OF SUCH DAMAGE.  */
 #include "config.h"
 
 #include <errno.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "dwarf2.h"
 #include "filenames.h"
@@ -301,6 +303,10 @@ struct unit
      as needed, and therefore require care, as different threads may
      try to initialize them simultaneously.  */
 
+  /* 0 if the fields below have not been read, 1 while a thread reads
+     them, 2 once they are set.  In threaded mode only the thread that
+     moves it from 0 to 1 reads them (see dwarf_claim_unit).  */
+  int init;
   /* PC to line number mapping.  This is NULL if the values have not
      been read.  This is (struct line *) -1 if there was an error
      reading the values.  */
@@ -310,6 +316,9 @@ struct unit
   /* PC ranges to function.  */
   struct function_addrs *function_addrs;
   size_t function_addrs_count;
+  /* Number of times the fields above were read; only used for
+     backtrace_stats.  */
+  int reads;
 };
 
 /* An address range for a compilation unit.  This maps a PC value to a
@@ -366,8 +375,97 @@ struct dwarf_data
   /* A vector used for function addresses.  We keep this here so that
      we can grow the vector as we read more functions.  */
   struct function_vector fvec;
+  /* The arena of the module (see modarena.c), which what is read from
+     its units is allocated from; NULL if it has none.  */
+  struct backtrace_arena *arena;
 };
 
+/* Where the previous lookup of a batch (or of the thread, see
+   dwarf_fileline) landed.  PCs in a batch are looked up in ascending
+   order, and the frames of a stack trace mostly come from a few
+   units, so consecutive PCs usually fall in the same compilation unit
+   and close to each other in its line table; the cursor lets the next
+   lookup skip the searches.  */
+
+struct dwarf_lookup_cursor
+{
+  /* The module of the previous hit.  */
+  struct dwarf_data *ddata;
+  /* The unit address range of the previous hit.  */
+  struct unit_addrs *entry;
+  /* The line table of the unit of the previous hit, which LN points
+     into.  */
+  struct line *lines;
+  /* The line entry of the previous hit.  */
+  struct line *ln;
+  /* Set by a lookup that could only give the symbol name of the PC,
+     as another thread was reading its unit (see dwarf_wait_unit); its
+     result is not to be cached.  */
+  int partial;
+};
+
+#ifdef HAVE_TLS
+
+/* Number of entries of the per-thread PC cache of dwarf_fileline; a
+   power of two.  */
+#define DWARF_PC_CACHE_SIZE 128
+
+/* Number of results (the function and the calls inlined into it) one
+   entry of the PC cache holds; PCs with deeper inlining are not
+   cached.  */
+#define DWARF_PC_CACHE_RESULTS 3
+
+/* One call of the callback of backtrace_pcinfo.  */
+
+struct dwarf_pc_result
+{
+  const char *filename;
+  int lineno;
+  const char *function;
+};
+
+/* The results of a PC, none if it was not found.  The strings point
+   into the data of the module the PC was found in: that of the
+   executable lives as long as the state, that of a shared library in
+   the arena of the library (see modarena.c), which is unmapped once
+   the library is unloaded and retired and no read section that began
+   before can still see it (see rcu.c).  So an entry is only used if
+   the generation of the state has not changed since it was filled:
+   elf_refresh_modules moves the generation before it retires a
+   module, and dwarf_fileline, which runs in a read section, reads it
+   before looking at the entry.  A lookup that sees the generation of
+   the entry began its read section before the retirement, and the
+   strings it hands out stay mapped until that section ends.  */
+
+struct dwarf_pc_cache_entry
+{
+  /* The state the results come from; NULL if the entry is empty.  */
+  struct backtrace_state *state;
+  int generation;
+  uintptr_t pc;
+  size_t count;
+  struct dwarf_pc_result results[DWARF_PC_CACHE_RESULTS];
+};
+
+/* What dwarf_fileline remembers for the thread: the results of the
+   recent PCs, in a direct-mapped cache, and where the previous lookup
+   landed.  The unit and line data the cursor points to are only ever
+   published whole (see dwarf_lookup_pc), so other threads reading
+   more units do not invalidate them.  */
+
+struct dwarf_thread_cache
+{
+  /* The state and generation CURSOR belongs to.  */
+  struct backtrace_state *state;
+  int generation;
+  struct dwarf_lookup_cursor cursor;
+  struct dwarf_pc_cache_entry entries[DWARF_PC_CACHE_SIZE];
+};
+
+static __thread struct dwarf_thread_cache dwarf_thread_cache;
+
+#endif /* defined (HAVE_TLS) */
+
 /* Report an error for a DWARF buffer.  */
 
 static void
@@ -1490,10 +1588,12 @@ build_address_map (struct backtrace_state *state, uintptr_t base_address,
       memset (&abbrevs, 0, sizeof abbrevs);
 
       /* The actual line number mappings will be read as needed.  */
+      u->init = 0;
       u->lines = NULL;
       u->lines_count = 0;
       u->function_addrs = NULL;
       u->function_addrs_count = 0;
+      u->reads = 0;
 
       if (!find_address_ranges (state, base_address, &unit_buf,
 				dwarf_str, dwarf_str_size,
@@ -2634,16 +2734,134 @@ report_inlined_functions (uintptr_t pc, struct function *function,
   return 0;
 }
 
+/* The longest a lookup waits for another thread to read the unit of
+   its PC, in nanoseconds, before it answers with the symbol only.  A
+   thread may be waiting for itself: a signal handler symbolizing while
+   the interrupted code was reading the unit.  */
+
+#define DWARF_UNIT_WAIT_NS (20 * 1000 * 1000)
+
+/* Claim the reading of U.  Returns 1 if the caller is to read it, 0 if
+   another thread reads it or has read it.  */
+
+static int
+dwarf_claim_unit (struct backtrace_state *state, struct unit *u)
+{
+  if (!state->threaded)
+    {
+      if (u->init != 0)
+	return 0;
+      u->init = 1;
+      return 1;
+    }
+  return __sync_bool_compare_and_swap (&u->init, 0, 1);
+}
+
+/* Wait for the thread that reads U, at most DWARF_UNIT_WAIT_NS.
+   Returns the lines of U, NULL if they are still not read.  */
+
+static struct line *
+dwarf_wait_unit (struct backtrace_state *state, struct unit *u)
+{
+  struct timespec start;
+  struct timespec now;
+
+  if (!state->threaded)
+    return u->lines;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while (backtrace_atomic_load_int (&u->init) != 2)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      if ((now.tv_sec - start.tv_sec) * 1000000000L
+	  + (now.tv_nsec - start.tv_nsec) > DWARF_UNIT_WAIT_NS)
+	return NULL;
+      sched_yield ();
+    }
+  return backtrace_atomic_load_pointer (&u->lines);
+}
+
+/* Read the line number and function information of U, whose reading
+   the caller claimed, and store it in U.  Returns the lines of U, (struct line
+   *) -1 if the line number information could not be read.  */
+
+static struct line *
+dwarf_read_unit (struct backtrace_state *state, struct dwarf_data *ddata,
+		 struct unit *u, backtrace_error_callback error_callback,
+		 void *data)
+{
+  struct line *lines;
+  struct function_addrs *function_addrs;
+  size_t function_addrs_count;
+  struct line_header lhdr;
+  size_t count;
+  struct backtrace_arena *arena;
+
+  arena = backtrace_arena_switch (ddata->arena);
+  function_addrs = NULL;
+  function_addrs_count = 0;
+  count = 0;
+  backtrace_stats_add (state, units_read, 1);
+  if (state->threaded
+      ? __sync_fetch_and_add (&u->reads, 1) > 0
+      : u->reads++ > 0)
+    backtrace_stats_add (state, units_reread, 1);
+  if (read_line_info (state, ddata, error_callback, data, u, &lhdr,
+		      &lines, &count))
+    {
+      struct function_vector *pfvec;
+
+      /* If not threaded, reuse DDATA->FVEC for better memory
+	 consumption.  */
+      if (state->threaded)
+	pfvec = NULL;
+      else
+	pfvec = &ddata->fvec;
+      read_function_info (state, ddata, &lhdr, error_callback, data,
+			  u, pfvec, &function_addrs,
+			  &function_addrs_count);
+      free_line_header (state, &lhdr, error_callback, data);
+    }
+
+  /* Store the information we just read into the unit; we are the only
+     thread reading it (see dwarf_claim_unit).  We do have to write the
+     lines field last, so that the acquire-loads in dwarf_lookup_pc
+     ensure that the other fields are set.  */
+
+  if (!state->threaded)
+    {
+      u->lines_count = count;
+      u->function_addrs = function_addrs;
+      u->function_addrs_count = function_addrs_count;
+      u->lines = lines;
+      u->init = 2;
+    }
+  else
+    {
+      backtrace_atomic_store_size_t (&u->lines_count, count);
+      backtrace_atomic_store_pointer (&u->function_addrs, function_addrs);
+      backtrace_atomic_store_size_t (&u->function_addrs_count,
+				     function_addrs_count);
+      backtrace_atomic_store_pointer (&u->lines, lines);
+      backtrace_atomic_store_int (&u->init, 2);
+    }
+
+  backtrace_arena_switch (arena);
+  return lines;
+}
+
 /* Look for a PC in the DWARF mapping for one module.  On success,
    call CALLBACK and return whatever it returns.  On error, call
    ERROR_CALLBACK and return 0.  Sets *FOUND to 1 if the PC is found,
-   0 if not.  */
+   0 if not.  CURSOR may be NULL; if it is not, it is used to start
+   the searches from the position of the previous lookup, and it is
+   updated with the position of this one.  */
 
 static int
 dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
 		 uintptr_t pc, backtrace_full_callback callback,
 		 backtrace_error_callback error_callback, void *data,
-		 int *found)
+		 int *found, struct dwarf_lookup_cursor *cursor)
 {
   struct unit_addrs *entry;
   struct unit *u;
@@ -2658,9 +2876,17 @@ dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
 
   *found = 1;
 
-  /* Find an address range that includes PC.  */
-  entry = bsearch (&pc, ddata->addrs, ddata->addrs_count,
-		   sizeof (struct unit_addrs), unit_addrs_search);
+  /* Find an address range that includes PC.  Reuse the range of the
+     previous lookup if it covers PC.  */
+  if (cursor != NULL
+      && cursor->ddata == ddata
+      && cursor->entry != NULL
+      && pc >= cursor->entry->low
+      && pc < cursor->entry->high)
+    entry = cursor->entry;
+  else
+    entry = bsearch (&pc, ddata->addrs, ddata->addrs_count,
+		     sizeof (struct unit_addrs), unit_addrs_search);
 
   if (entry == NULL)
     {
@@ -2711,54 +2937,24 @@ dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
   new_data = 0;
   if (lines == NULL)
     {
-      size_t function_addrs_count;
-      struct line_header lhdr;
-      size_t count;
-
       /* We have never read the line information for this unit.  Read
-	 it now.  */
-
-      function_addrs = NULL;
-      function_addrs_count = 0;
-      if (read_line_info (state, ddata, error_callback, data, entry->u, &lhdr,
-			  &lines, &count))
-	{
-	  struct function_vector *pfvec;
-
-	  /* If not threaded, reuse DDATA->FVEC for better memory
-	     consumption.  */
-	  if (state->threaded)
-	    pfvec = NULL;
-	  else
-	    pfvec = &ddata->fvec;
-	  read_function_info (state, ddata, &lhdr, error_callback, data,
-			      entry->u, pfvec, &function_addrs,
-			      &function_addrs_count);
-	  free_line_header (state, &lhdr, error_callback, data);
-	  new_data = 1;
-	}
-
-      /* Atomically store the information we just read into the unit.
-	 If another thread is simultaneously writing, it presumably
-	 read the same information, and we don't care which one we
-	 wind up with; we just leak the other one.  We do have to
-	 write the lines field last, so that the acquire-loads above
-	 ensure that the other fields are set.  */
-
-      if (!state->threaded)
+	 it now, unless another thread does.  */
+      if (dwarf_claim_unit (state, u))
 	{
-	  u->lines_count = count;
-	  u->function_addrs = function_addrs;
-	  u->function_addrs_count = function_addrs_count;
-	  u->lines = lines;
+	  lines = dwarf_read_unit (state, ddata, u, error_callback, data);
+	  new_data = lines != (struct line *) (uintptr_t) -1;
 	}
       else
 	{
-	  backtrace_atomic_store_size_t (&u->lines_count, count);
-	  backtrace_atomic_store_pointer (&u->function_addrs, function_addrs);
-	  backtrace_atomic_store_size_t (&u->function_addrs_count,
-					 function_addrs_count);
-	  backtrace_atomic_store_pointer (&u->lines, lines);
+	  lines = dwarf_wait_unit (state, u);
+	  if (lines == NULL)
+	    {
+	      backtrace_stats_add (state, symbol_only, 1);
+	      if (cursor != NULL)
+		cursor->partial = 1;
+	      return backtrace_symbol_only (state, pc, callback,
+					    error_callback, data);
+	    }
 	}
     }
 
@@ -2771,14 +2967,38 @@ dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
 	 this PC.  */
       if (new_data)
 	return dwarf_lookup_pc (state, ddata, pc, callback, error_callback,
-				data, found);
+				data, found, cursor);
       return callback (data, pc, NULL, 0, NULL);
     }
 
-  /* Search for PC within this unit.  */
+  /* Search for PC within this unit.  When the previous lookup hit an
+     earlier line of the same unit, only search from there on.  */
+
+  if (cursor != NULL
+      && cursor->ddata == ddata
+      && cursor->entry != NULL
+      && cursor->entry->u == entry->u
+      && cursor->lines == lines
+      && cursor->ln != NULL
+      && pc >= cursor->ln->pc)
+    {
+      ln = cursor->ln;
+      if (pc >= (ln + 1)->pc)
+	ln = (struct line *) bsearch (&pc, ln + 1,
+				      entry->u->lines_count - (ln + 1 - lines),
+				      sizeof (struct line), line_search);
+    }
+  else
+    ln = (struct line *) bsearch (&pc, lines, entry->u->lines_count,
+				  sizeof (struct line), line_search);
 
-  ln = (struct line *) bsearch (&pc, lines, entry->u->lines_count,
-				sizeof (struct line), line_search);
+  if (cursor != NULL)
+    {
+      cursor->ddata = ddata;
+      cursor->entry = entry;
+      cursor->lines = lines;
+      cursor->ln = ln;
+    }
   if (ln == NULL)
     {
       /* The PC is between the low_pc and high_pc attributes of the
@@ -2798,13 +3018,16 @@ dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
 	      size_t filename_len;
 	      const char *dir;
 	      size_t dir_len;
+	      struct backtrace_arena *arena;
 	      char *s;
 
 	      filename_len = strlen (filename);
 	      dir = entry->u->comp_dir;
 	      dir_len = strlen (dir);
+	      arena = backtrace_arena_switch (ddata->arena);
 	      s = (char *) backtrace_alloc (state, dir_len + filename_len + 2,
 					    error_callback, data);
+	      backtrace_arena_switch (arena);
 	      if (s == NULL)
 		{
 		  *found = 0;
@@ -2858,8 +3081,58 @@ dwarf_lookup_pc (struct backtrace_state *state, struct dwarf_data *ddata,
 }
 
 
+#ifdef HAVE_TLS
+
+/* Data passed through dwarf_record_callback.  */
+
+struct dwarf_record_data
+{
+  /* The caller's callback and data.  */
+  backtrace_full_callback callback;
+  void *data;
+  /* The results seen so far.  */
+  struct dwarf_pc_cache_entry entry;
+  /* Whether there were more results than an entry holds.  */
+  int overflow;
+};
+
+/* Record a result for the PC cache, then pass it on.  */
+
+static int
+dwarf_record_callback (void *vdata, uintptr_t pc, const char *filename,
+		       int lineno, const char *function)
+{
+  struct dwarf_record_data *rdata = (struct dwarf_record_data *) vdata;
+
+  if (rdata->entry.count < DWARF_PC_CACHE_RESULTS)
+    {
+      struct dwarf_pc_result *result;
+
+      result = &rdata->entry.results[rdata->entry.count++];
+      result->filename = filename;
+      result->lineno = lineno;
+      result->function = function;
+    }
+  else
+    rdata->overflow = 1;
+  return rdata->callback (rdata->data, pc, filename, lineno, function);
+}
+
+/* The entry of the PC cache for PC.  */
+
+static struct dwarf_pc_cache_entry *
+dwarf_pc_cache_entry (uintptr_t pc)
+{
+  return &dwarf_thread_cache.entries[((pc >> 1) ^ (pc >> 8))
+				     & (DWARF_PC_CACHE_SIZE - 1)];
+}
+
+#endif /* defined (HAVE_TLS) */
+
 /* Return the file/line information for a PC using the DWARF mapping
-   we built earlier.  */
+   we built earlier.  The thread's PC cache answers the PCs it has
+   seen recently; the others are looked up in the module of the
+   previous lookup first, starting from the unit and line it found.  */
 
 static int
 dwarf_fileline (struct backtrace_state *state, uintptr_t pc,
@@ -2867,44 +3140,246 @@ dwarf_fileline (struct backtrace_state *state, uintptr_t pc,
 		backtrace_error_callback error_callback, void *data)
 {
   struct dwarf_data *ddata;
+  struct dwarf_data *tried;
+  struct dwarf_lookup_cursor *cursor;
+  backtrace_full_callback lookup_callback;
+  void *lookup_data;
   int found;
   int ret;
+#ifdef HAVE_TLS
+  struct dwarf_pc_cache_entry *entry;
+  struct dwarf_record_data rdata;
+  int generation;
 
   if (!state->threaded)
+    generation = state->generation;
+  else
+    generation = backtrace_atomic_load_int (&state->generation);
+
+  entry = dwarf_pc_cache_entry (pc);
+  if (entry->state == state
+      && entry->generation == generation
+      && entry->pc == pc)
     {
-      for (ddata = (struct dwarf_data *) state->fileline_data;
-	   ddata != NULL;
-	   ddata = ddata->next)
+      size_t i;
+
+      if (entry->count == 0)
+	return callback (data, pc, NULL, 0, NULL);
+      for (i = 0; i < entry->count; ++i)
 	{
-	  ret = dwarf_lookup_pc (state, ddata, pc, callback, error_callback,
-				 data, &found);
-	  if (ret != 0 || found)
+	  ret = callback (data, pc, entry->results[i].filename,
+			  entry->results[i].lineno,
+			  entry->results[i].function);
+	  if (ret != 0)
 	    return ret;
 	}
+      return 0;
     }
-  else
+
+  rdata.callback = callback;
+  rdata.data = data;
+  rdata.entry.state = state;
+  rdata.entry.generation = generation;
+  rdata.entry.pc = pc;
+  rdata.entry.count = 0;
+  rdata.overflow = 0;
+  lookup_callback = dwarf_record_callback;
+  lookup_data = &rdata;
+
+  cursor = &dwarf_thread_cache.cursor;
+  if (dwarf_thread_cache.state != state
+      || dwarf_thread_cache.generation != generation)
     {
-      struct dwarf_data **pp;
+      memset (cursor, 0, sizeof *cursor);
+      dwarf_thread_cache.state = state;
+      dwarf_thread_cache.generation = generation;
+    }
+#else
+  lookup_callback = callback;
+  lookup_data = data;
+  cursor = NULL;
+#endif
 
-      pp = (struct dwarf_data **) (void *) &state->fileline_data;
-      while (1)
+  tried = NULL;
+  ret = 0;
+  found = 0;
+  if (cursor != NULL)
+    cursor->partial = 0;
+  if (cursor != NULL && cursor->ddata != NULL)
+    {
+      tried = cursor->ddata;
+      ret = dwarf_lookup_pc (state, tried, pc, lookup_callback,
+			     error_callback, lookup_data, &found, cursor);
+    }
+
+  if (ret == 0 && !found)
+    {
+      struct backtrace_module_index *index;
+      size_t pos;
+
+      index = backtrace_module_index_load (state, &state->fileline_index);
+      pos = BACKTRACE_MODULE_INDEX_START;
+      while ((ddata = ((struct dwarf_data *)
+		       backtrace_module_index_next (index, pc, &pos)))
+	     != NULL)
 	{
-	  ddata = backtrace_atomic_load_pointer (pp);
-	  if (ddata == NULL)
+	  if (ddata == tried)
+	    continue;
+	  ret = dwarf_lookup_pc (state, ddata, pc, lookup_callback,
+				 error_callback, lookup_data, &found, cursor);
+	  if (ret != 0 || found)
 	    break;
+	}
+    }
 
-	  ret = dwarf_lookup_pc (state, ddata, pc, callback, error_callback,
-				 data, &found);
-	  if (ret != 0 || found)
-	    return ret;
+  if (ret != 0)
+    return ret;
 
-	  pp = &ddata->next;
-	}
+  if (!found)
+    {
+#ifdef HAVE_TLS
+      *entry = rdata.entry;
+#endif
+      return callback (data, pc, NULL, 0, NULL);
     }
 
-  /* FIXME: See if any libraries have been dlopen'ed.  */
+#ifdef HAVE_TLS
+  if (!rdata.overflow && !cursor->partial)
+    *entry = rdata.entry;
+#endif
 
-  return callback (data, pc, NULL, 0, NULL);
+  return 0;
+}
+
+/* One PC of a batch.  */
+
+struct dwarf_batch_pc
+{
+  /* The PC.  */
+  uintptr_t pc;
+  /* Index of PC in the caller's array.  */
+  size_t index;
+};
+
+/* Data passed through dwarf_batch_callback.  */
+
+struct dwarf_batch_data
+{
+  /* The caller's callback and data.  */
+  backtrace_batch_callback callback;
+  void *data;
+  /* Index of the PC being looked up.  */
+  size_t index;
+};
+
+/* Compare struct dwarf_batch_pc for qsort.  The index keeps the sort
+   stable.  */
+
+static int
+dwarf_batch_pc_compare (const void *v1, const void *v2)
+{
+  const struct dwarf_batch_pc *p1 = (const struct dwarf_batch_pc *) v1;
+  const struct dwarf_batch_pc *p2 = (const struct dwarf_batch_pc *) v2;
+
+  if (p1->pc < p2->pc)
+    return -1;
+  else if (p1->pc > p2->pc)
+    return 1;
+  else if (p1->index < p2->index)
+    return -1;
+  else if (p1->index > p2->index)
+    return 1;
+  else
+    return 0;
+}
+
+/* Forward a dwarf_lookup_pc result to the batch callback.  */
+
+static int
+dwarf_batch_callback (void *vdata, uintptr_t pc, const char *filename,
+		      int lineno, const char *function)
+{
+  struct dwarf_batch_data *bdata = (struct dwarf_batch_data *) vdata;
+
+  return bdata->callback (bdata->data, bdata->index, pc, filename, lineno,
+			  function);
+}
+
+/* Return the file/line information for an array of PCs.  The PCs
+   are sorted, then looked up in ascending order with a cursor, so
+   that PCs falling in the same compilation unit share the unit and
+   line table searches.  */
+
+static int
+dwarf_fileline_batch (struct backtrace_state *state, const uintptr_t *pcs,
+		      size_t count, backtrace_batch_callback callback,
+		      backtrace_error_callback error_callback, void *data)
+{
+  struct dwarf_batch_pc *sorted;
+  struct dwarf_batch_data bdata;
+  struct dwarf_lookup_cursor cursor;
+  struct backtrace_module_index *index;
+  size_t i;
+  int ret;
+
+  if (count == 0)
+    return 0;
+
+  sorted = ((struct dwarf_batch_pc *)
+	    backtrace_alloc (state, count * sizeof (struct dwarf_batch_pc),
+			     error_callback, data));
+  if (sorted == NULL)
+    return 0;
+
+  for (i = 0; i < count; ++i)
+    {
+      sorted[i].pc = pcs[i];
+      sorted[i].index = i;
+    }
+  backtrace_qsort (sorted, count, sizeof (struct dwarf_batch_pc),
+		   dwarf_batch_pc_compare);
+
+  bdata.callback = callback;
+  bdata.data = data;
+
+  ret = 0;
+  memset (&cursor, 0, sizeof cursor);
+  index = backtrace_module_index_load (state, &state->fileline_index);
+  for (i = 0; i < count; ++i)
+    {
+      struct dwarf_data *ddata;
+      size_t pos;
+      int found;
+
+      bdata.index = sorted[i].index;
+      found = 0;
+      pos = BACKTRACE_MODULE_INDEX_START;
+      while ((ddata = ((struct dwarf_data *)
+		       backtrace_module_index_next (index, sorted[i].pc,
+						    &pos)))
+	     != NULL)
+	{
+	  ret = dwarf_lookup_pc (state, ddata, sorted[i].pc,
+				 dwarf_batch_callback, error_callback,
+				 &bdata, &found, &cursor);
+	  if (ret != 0)
+	    goto done;
+	  if (found)
+	    break;
+	}
+
+      if (!found)
+	{
+	  ret = callback (data, sorted[i].index, sorted[i].pc, NULL, 0, NULL);
+	  if (ret != 0)
+	    break;
+	}
+    }
+
+ done:
+  backtrace_free (state, sorted, count * sizeof (struct dwarf_batch_pc),
+		  error_callback, data);
+  return ret;
 }
 
 /* Initialize our data structures from the DWARF debug info for a
@@ -2965,6 +3440,7 @@ build_dwarf_data (struct backtrace_state *state,
   fdata->dwarf_str_size = dwarf_str_size;
   fdata->is_bigendian = is_bigendian;
   memset (&fdata->fvec, 0, sizeof fdata->fvec);
+  fdata->arena = backtrace_arena_current ();
 
   return fdata;
 }
@@ -3000,42 +3476,220 @@ backtrace_dwarf_add (struct backtrace_state *state,
   if (fdata == NULL)
     return 0;
 
-  if (!state->threaded)
+  if (fdata->addrs_count > 0)
     {
-      struct dwarf_data **pp;
+      uintptr_t high;
+      size_t i;
 
-      for (pp = (struct dwarf_data **) (void *) &state->fileline_data;
-	   *pp != NULL;
-	   pp = &(*pp)->next)
-	;
-      *pp = fdata;
+      high = 0;
+      for (i = 0; i < fdata->addrs_count; ++i)
+	if (fdata->addrs[i].high > high)
+	  high = fdata->addrs[i].high;
+      if (!backtrace_module_index_add (state, &state->fileline_index,
+				       fdata->addrs[0].low, high, fdata,
+				       error_callback, data))
+	return 0;
     }
-  else
+
+  /* Lookups go through the index; the list only keeps the modules
+     that are never unloaded.  The memory of the others goes away with
+     their arena.  */
+  if (fdata->arena == NULL)
     {
-      while (1)
+      if (!state->threaded)
 	{
 	  struct dwarf_data **pp;
 
-	  pp = (struct dwarf_data **) (void *) &state->fileline_data;
-
+	  for (pp = (struct dwarf_data **) (void *) &state->fileline_data;
+	       *pp != NULL;
+	       pp = &(*pp)->next)
+	    ;
+	  *pp = fdata;
+	}
+      else
+	{
 	  while (1)
 	    {
-	      struct dwarf_data *p;
+	      struct dwarf_data **pp;
 
-	      p = backtrace_atomic_load_pointer (pp);
+	      pp = (struct dwarf_data **) (void *) &state->fileline_data;
 
-	      if (p == NULL)
-		break;
+	      while (1)
+		{
+		  struct dwarf_data *p;
 
-	      pp = &p->next;
-	    }
+		  p = backtrace_atomic_load_pointer (pp);
 
-	  if (__sync_bool_compare_and_swap (pp, NULL, fdata))
-	    break;
+		  if (p == NULL)
+		    break;
+
+		  pp = &p->next;
+		}
+
+	      if (__sync_bool_compare_and_swap (pp, NULL, fdata))
+		break;
+	    }
 	}
     }
 
   *fileline_fn = dwarf_fileline;
 
+  if (!state->threaded)
+    state->fileline_batch_fn = dwarf_fileline_batch;
+  else
+    backtrace_atomic_store_pointer (&state->fileline_batch_fn,
+				    dwarf_fileline_batch);
+
+  return 1;
+}
+
+/* A compilation unit for backtrace_dwarf_prewarm to read.  */
+
+struct dwarf_prewarm_unit
+{
+  struct dwarf_data *ddata;
+  struct unit *u;
+};
+
+/* Data shared by the threads of backtrace_dwarf_prewarm.  */
+
+struct dwarf_prewarm_data
+{
+  struct backtrace_state *state;
+  backtrace_error_callback error_callback;
+  void *data;
+  /* The units, each once.  */
+  struct dwarf_prewarm_unit *units;
+  size_t count;
+  /* The next unit to take.  */
+  size_t next;
+  /* Number of units read.  */
+  size_t read;
+};
+
+/* Compare struct dwarf_prewarm_unit for qsort, by unit.  */
+
+static int
+dwarf_prewarm_unit_compare (const void *v1, const void *v2)
+{
+  const struct dwarf_prewarm_unit *a1 = (const struct dwarf_prewarm_unit *) v1;
+  const struct dwarf_prewarm_unit *a2 = (const struct dwarf_prewarm_unit *) v2;
+
+  if (a1->u < a2->u)
+    return -1;
+  else if (a1->u > a2->u)
+    return 1;
+  return 0;
+}
+
+/* Read the units of PDATA that no thread reads or has read, taking the
+   next one until there are none left.  Run by every thread of
+   backtrace_dwarf_prewarm.  */
+
+static void *
+dwarf_prewarm_thread (void *vdata)
+{
+  struct dwarf_prewarm_data *pdata = (struct dwarf_prewarm_data *) vdata;
+  struct backtrace_state *state = pdata->state;
+
+  while (1)
+    {
+      size_t i;
+      struct unit *u;
+
+      if (!state->threaded)
+	i = pdata->next++;
+      else
+	i = __sync_fetch_and_add (&pdata->next, 1);
+      if (i >= pdata->count)
+	break;
+
+      u = pdata->units[i].u;
+      if (!dwarf_claim_unit (state, u))
+	continue;
+
+      dwarf_read_unit (state, pdata->units[i].ddata, u,
+		       pdata->error_callback, pdata->data);
+      if (!state->threaded)
+	++pdata->read;
+      else
+	__sync_fetch_and_add (&pdata->read, 1);
+    }
+  return NULL;
+}
+
+/* Read the line and function information of every compilation unit of
+   the modules in the file/line index of STATE.  The units are shared
+   out between the calling thread and THREADS - 1 worker threads.  */
+
+int
+backtrace_dwarf_prewarm (struct backtrace_state *state, int threads,
+			 size_t *units, size_t *units_read,
+			 backtrace_error_callback error_callback, void *data)
+{
+  struct backtrace_module_index *index;
+  struct dwarf_prewarm_data pdata;
+  size_t alloc;
+  size_t count;
+  size_t i;
+  size_t j;
+
+  *units = 0;
+  *units_read = 0;
+
+  index = backtrace_module_index_load (state, &state->fileline_index);
+  if (index == NULL)
+    return 1;
+
+  /* A unit has one address range per range of its code; list each
+     unit once.  */
+  alloc = 0;
+  for (i = 0; i < index->count; ++i)
+    alloc += ((struct dwarf_data *) index->ranges[i].data)->addrs_count;
+  if (alloc == 0)
+    return 1;
+
+  pdata.units = ((struct dwarf_prewarm_unit *)
+		 backtrace_alloc (state,
+				  alloc * sizeof (struct dwarf_prewarm_unit),
+				  error_callback, data));
+  if (pdata.units == NULL)
+    return 0;
+
+  count = 0;
+  for (i = 0; i < index->count; ++i)
+    {
+      struct dwarf_data *ddata;
+
+      ddata = (struct dwarf_data *) index->ranges[i].data;
+      for (j = 0; j < ddata->addrs_count; ++j)
+	{
+	  pdata.units[count].ddata = ddata;
+	  pdata.units[count].u = ddata->addrs[j].u;
+	  ++count;
+	}
+    }
+  backtrace_qsort (pdata.units, count, sizeof (struct dwarf_prewarm_unit),
+		   dwarf_prewarm_unit_compare);
+  j = 0;
+  for (i = 0; i < count; ++i)
+    if (j == 0 || pdata.units[i].u != pdata.units[j - 1].u)
+      pdata.units[j++] = pdata.units[i];
+
+  pdata.state = state;
+  pdata.error_callback = error_callback;
+  pdata.data = data;
+  pdata.count = j;
+  pdata.next = 0;
+  pdata.read = 0;
+
+  backtrace_run_workers (state, threads, dwarf_prewarm_thread, &pdata,
+			 error_callback, data);
+
+  *units = pdata.count;
+  *units_read = pdata.read;
+  backtrace_free (state, pdata.units,
+		  alloc * sizeof (struct dwarf_prewarm_unit), error_callback,
+		  data);
   return 1;
 }
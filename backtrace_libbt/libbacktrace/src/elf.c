@@ -33,10 +33,12 @@ POSSIBILITY OF SUCH DAMAGE.  */
 #include "config.h"
 
 #include <errno.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef HAVE_DL_ITERATE_PHDR
@@ -667,46 +669,71 @@ elf_initialize_syminfo (struct backtrace_state *state,
   return 1;
 }
 
-/* Add EDATA to the list in STATE.  */
+/* Add EDATA to the list and to the index of STATE.  Returns 1 on
+   success, 0 on failure.  */
 
-static void
+static int
 elf_add_syminfo_data (struct backtrace_state *state,
-		      struct elf_syminfo_data *edata)
+		      struct elf_syminfo_data *edata,
+		      backtrace_error_callback error_callback, void *data)
 {
-  if (!state->threaded)
+  if (edata->count > 0)
     {
-      struct elf_syminfo_data **pp;
-
-      for (pp = (struct elf_syminfo_data **) (void *) &state->syminfo_data;
-	   *pp != NULL;
-	   pp = &(*pp)->next)
-	;
-      *pp = edata;
+      uintptr_t high;
+      size_t i;
+
+      high = 0;
+      for (i = 0; i < edata->count; ++i)
+	if (edata->symbols[i].address + edata->symbols[i].size > high)
+	  high = edata->symbols[i].address + edata->symbols[i].size;
+      if (!backtrace_module_index_add (state, &state->syminfo_index,
+				       edata->symbols[0].address, high, edata,
+				       error_callback, data))
+	return 0;
     }
-  else
+
+  /* Lookups go through the index; the list only keeps the modules
+     that are never unloaded.  The memory of the others goes away with
+     their arena (see modarena.c).  */
+  if (backtrace_arena_current () == NULL)
     {
-      while (1)
+      if (!state->threaded)
 	{
 	  struct elf_syminfo_data **pp;
 
-	  pp = (struct elf_syminfo_data **) (void *) &state->syminfo_data;
-
+	  for (pp = (struct elf_syminfo_data **) (void *) &state->syminfo_data;
+	       *pp != NULL;
+	       pp = &(*pp)->next)
+	    ;
+	  *pp = edata;
+	}
+      else
+	{
 	  while (1)
 	    {
-	      struct elf_syminfo_data *p;
+	      struct elf_syminfo_data **pp;
 
-	      p = backtrace_atomic_load_pointer (pp);
+	      pp = (struct elf_syminfo_data **) (void *) &state->syminfo_data;
 
-	      if (p == NULL)
-		break;
+	      while (1)
+		{
+		  struct elf_syminfo_data *p;
 
-	      pp = &p->next;
-	    }
+		  p = backtrace_atomic_load_pointer (pp);
+
+		  if (p == NULL)
+		    break;
+
+		  pp = &p->next;
+		}
 
-	  if (__sync_bool_compare_and_swap (pp, NULL, edata))
-	    break;
+	      if (__sync_bool_compare_and_swap (pp, NULL, edata))
+		break;
+	    }
 	}
     }
+
+  return 1;
 }
 
 /* Return the symbol name and value for an ADDR.  */
@@ -717,41 +744,22 @@ elf_syminfo (struct backtrace_state *state, uintptr_t addr,
 	     backtrace_error_callback error_callback ATTRIBUTE_UNUSED,
 	     void *data)
 {
+  struct backtrace_module_index *index;
   struct elf_syminfo_data *edata;
   struct elf_symbol *sym = NULL;
+  size_t pos;
 
-  if (!state->threaded)
-    {
-      for (edata = (struct elf_syminfo_data *) state->syminfo_data;
-	   edata != NULL;
-	   edata = edata->next)
-	{
-	  sym = ((struct elf_symbol *)
-		 bsearch (&addr, edata->symbols, edata->count,
-			  sizeof (struct elf_symbol), elf_symbol_search));
-	  if (sym != NULL)
-	    break;
-	}
-    }
-  else
+  index = backtrace_module_index_load (state, &state->syminfo_index);
+  pos = BACKTRACE_MODULE_INDEX_START;
+  while ((edata = ((struct elf_syminfo_data *)
+		   backtrace_module_index_next (index, addr, &pos)))
+	 != NULL)
     {
-      struct elf_syminfo_data **pp;
-
-      pp = (struct elf_syminfo_data **) (void *) &state->syminfo_data;
-      while (1)
-	{
-	  edata = backtrace_atomic_load_pointer (pp);
-	  if (edata == NULL)
-	    break;
-
-	  sym = ((struct elf_symbol *)
-		 bsearch (&addr, edata->symbols, edata->count,
-			  sizeof (struct elf_symbol), elf_symbol_search));
-	  if (sym != NULL)
-	    break;
-
-	  pp = &edata->next;
-	}
+      sym = ((struct elf_symbol *)
+	     bsearch (&addr, edata->symbols, edata->count,
+		      sizeof (struct elf_symbol), elf_symbol_search));
+      if (sym != NULL)
+	break;
     }
 
   if (sym == NULL)
@@ -2969,7 +2977,13 @@ elf_add (struct backtrace_state *state, const char *filename, int descriptor,
 
       *found_sym = 1;
 
-      elf_add_syminfo_data (state, sdata);
+      if (!elf_add_syminfo_data (state, sdata, error_callback, data))
+	goto fail;
+
+      /* The symbols are published and point into the string table:
+	 keep it even if reading the debug info fails below.  */
+      strtab_view_valid = 0;
+      backtrace_arena_keep_view (state, &strtab_view, error_callback, data);
     }
 
   backtrace_release_view (state, &shdrs_view, error_callback, data);
@@ -3184,6 +3198,9 @@ elf_add (struct backtrace_state *state, const char *filename, int descriptor,
 			    error_callback, data, fileline_fn))
     goto fail;
 
+  if (debug_view_valid)
+    backtrace_arena_keep_view (state, &debug_view, error_callback, data);
+
   *found_dwarf = 1;
 
   return 1;
@@ -3210,6 +3227,15 @@ elf_add (struct backtrace_state *state, const char *filename, int descriptor,
   return 0;
 }
 
+/* The dl_iterate_phdr counters of loaded and unloaded objects.  */
+
+struct elf_phdr_counters
+{
+  int valid;
+  unsigned long long adds;
+  unsigned long long subs;
+};
+
 /* Data passed to phdr_callback.  */
 
 struct phdr_data
@@ -3222,30 +3248,672 @@ struct phdr_data
   int *found_dwarf;
   const char *exe_filename;
   int exe_descriptor;
+  struct elf_phdr_counters counters;
 };
 
-/* Callback passed to dl_iterate_phdr.  Load debug info from shared
-   libraries.  */
+/* A shared library whose debug info is read on first use.  */
+
+struct elf_lazy_module
+{
+  /* The file name, stored after the struct.  */
+  const char *filename;
+  /* The address the library is loaded at.  */
+  uintptr_t base_address;
+  /* The addresses of its PT_LOAD segments: LOW <= PC < HIGH.  */
+  uintptr_t low;
+  uintptr_t high;
+  /* 0 if the library has not been read, 1 while a thread reads it, 2
+     once it has been read (or failed to).  */
+  int loaded;
+  /* Non-zero once the library has been unloaded.  */
+  int retired;
+  /* The arena holding what was read from the library (see
+     modarena.c); set before LOADED becomes 2.  */
+  struct backtrace_arena *arena;
+  /* Non-zero once the arena has been retired.  */
+  int arena_retired;
+};
+
+/* Retire the arena of MODULE, which has been unloaded and read.  Both
+   the thread that read it and the one that unloaded it call this, and
+   the first one does it.  */
+
+static void
+elf_retire_arena (struct backtrace_state *state,
+		  struct elf_lazy_module *module,
+		  backtrace_error_callback error_callback, void *data)
+{
+  if (!state->threaded)
+    {
+      if (module->arena_retired)
+	return;
+      module->arena_retired = 1;
+    }
+  else if (!__sync_bool_compare_and_swap (&module->arena_retired, 0, 1))
+    return;
+  if (module->arena != NULL)
+    backtrace_arena_retire (state, module->arena, error_callback, data);
+}
+
+/* Publish the functions a module read with elf_add provides: the
+   symbol lookup if FOUND_SYM, the file/line lookup FILELINE_FN if
+   FOUND_DWARF.  */
+
+static void
+elf_publish_module (struct backtrace_state *state, int found_sym,
+		    int found_dwarf, fileline fileline_fn)
+{
+  if (!state->threaded)
+    {
+      if (found_sym)
+	state->syminfo_fn = elf_syminfo;
+      else if (state->syminfo_fn == NULL)
+	state->syminfo_fn = elf_nosyms;
+    }
+  else
+    {
+      if (found_sym)
+	backtrace_atomic_store_pointer (&state->syminfo_fn, elf_syminfo);
+      else
+	(void) __sync_bool_compare_and_swap (&state->syminfo_fn, NULL,
+					     elf_nosyms);
+    }
+
+  if (found_dwarf)
+    {
+      if (!state->threaded)
+	state->fileline_fn = fileline_fn;
+      else
+	backtrace_atomic_store_pointer (&state->fileline_fn, fileline_fn);
+    }
+  else
+    {
+      if (!state->threaded)
+	{
+	  if (state->fileline_fn == NULL)
+	    state->fileline_fn = elf_nodebug;
+	}
+      else
+	(void) __sync_bool_compare_and_swap (&state->fileline_fn, NULL,
+					     elf_nodebug);
+    }
+}
+
+/* The longest a thread waits for another one, in nanoseconds: for the
+   thread that reads a module its lookup needs, or for the thread that
+   lists the modules.  A thread may be waiting for itself: a signal
+   handler symbolizing while the interrupted code was doing that.  */
+
+#define ELF_WAIT_NS (20 * 1000 * 1000)
+
+/* Return non-zero if more than ELF_WAIT_NS passed since START.  */
+
+static int
+elf_waited_too_long (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return ((now.tv_sec - start->tv_sec) * 1000000000L
+	  + (now.tv_nsec - start->tv_nsec) > ELF_WAIT_NS);
+}
+
+/* Read the debug info of MODULE unless it has been read.  In threaded
+   mode exactly one thread reads it; the others wait for it if WAIT, so
+   that their lookup sees the module, or else return at once.  Returns
+   0 if another thread still reads it (after ELF_WAIT_NS if WAIT), 1
+   once it is read.  */
+
+static int
+elf_load_module (struct backtrace_state *state, struct elf_lazy_module *module,
+		 int wait, backtrace_error_callback error_callback, void *data)
+{
+  int descriptor;
+  int does_not_exist;
+  int found_sym;
+  int found_dwarf;
+  fileline elf_fileline_fn;
+  struct backtrace_arena *arena;
+
+  if (!state->threaded)
+    {
+      /* Reading it already: this is a signal handler that interrupted
+	 the reading.  */
+      if (module->loaded != 0)
+	return module->loaded == 2;
+      module->loaded = 1;
+    }
+  else
+    {
+      if (backtrace_atomic_load_int (&module->loaded) == 2)
+	return 1;
+      if (!__sync_bool_compare_and_swap (&module->loaded, 0, 1))
+	{
+	  struct timespec start;
+
+	  if (!wait)
+	    return 0;
+	  clock_gettime (CLOCK_MONOTONIC, &start);
+	  while (backtrace_atomic_load_int (&module->loaded) != 2)
+	    {
+	      if (elf_waited_too_long (&start))
+		return 0;
+	      sched_yield ();
+	    }
+	  return 1;
+	}
+    }
+
+  /* Without an arena what is read is allocated from the state, and
+     stays allocated once the library is unloaded.  */
+  module->arena = backtrace_arena_create (state, error_callback, data);
+  descriptor = backtrace_open (module->filename, error_callback, data,
+			       &does_not_exist);
+  if (descriptor >= 0)
+    {
+      found_sym = 0;
+      found_dwarf = 0;
+      elf_fileline_fn = elf_nodebug;
+      arena = backtrace_arena_switch (module->arena);
+      /* If elf_add fails once it published the symbols (e.g. on DWARF
+	 it can not read), they are still there to look up.  */
+      if (elf_add (state, module->filename, descriptor, module->base_address,
+		   error_callback, data, &elf_fileline_fn, &found_sym,
+		   &found_dwarf, 0, 0)
+	  || found_sym)
+	elf_publish_module (state, found_sym, found_dwarf, elf_fileline_fn);
+      backtrace_arena_switch (arena);
+    }
+
+  /* If the library was unloaded while we read it, the thread that
+     retired it may have missed what we just added.  */
+  if (state->threaded && backtrace_atomic_load_int (&module->retired))
+    {
+      backtrace_module_index_remove (state, &state->fileline_index,
+				     module->low, module->high,
+				     error_callback, data);
+      backtrace_module_index_remove (state, &state->syminfo_index,
+				     module->low, module->high,
+				     error_callback, data);
+    }
+
+  /* The compare and swap is a full barrier: either we see RETIRED
+     below or the thread that retires the module sees LOADED.  */
+  if (!state->threaded)
+    module->loaded = 2;
+  else
+    (void) __sync_bool_compare_and_swap (&module->loaded, 1, 2);
+
+  /* The thread that retired the library left its arena to us.  */
+  if (state->threaded
+      ? backtrace_atomic_load_int (&module->retired)
+      : module->retired)
+    elf_retire_arena (state, module, error_callback, data);
+  return 1;
+}
+
+#ifdef HAVE_TLS
+
+/* The range of the module elf_load_modules last found read, per
+   thread; the PCs of a trace mostly come from a few modules.  */
+
+struct elf_loaded_range
+{
+  struct backtrace_state *state;
+  int generation;
+  uintptr_t low;
+  uintptr_t high;
+};
+
+static __thread struct elf_loaded_range elf_loaded_range;
+
+#endif /* defined (HAVE_TLS) */
+
+/* Set *LOW and *HIGH to the range of the PT_LOAD segments of the
+   object described by INFO.  Returns 0 if it has none.  */
+
+static int
+elf_module_range (struct dl_phdr_info *info, uintptr_t *low, uintptr_t *high)
+{
+  size_t i;
+
+  *low = (uintptr_t) -1;
+  *high = 0;
+  for (i = 0; i < info->dlpi_phnum; ++i)
+    {
+      if (info->dlpi_phdr[i].p_type != PT_LOAD)
+	continue;
+      if (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr < *low)
+	*low = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+      if (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr
+	  + info->dlpi_phdr[i].p_memsz > *high)
+	*high = (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr
+		 + info->dlpi_phdr[i].p_memsz);
+    }
+  return *low < *high;
+}
+
+/* Register the shared library described by INFO, to be read on first
+   use.  Only its address range is recorded now.  The executable, read
+   up front, is registered as LOADED, so that its PCs are not searched
+   for a module to read on every lookup.  Returns 1 if it registered
+   a module.  */
+
+static int
+elf_register_module (struct backtrace_state *state,
+		     struct dl_phdr_info *info, int loaded,
+		     backtrace_error_callback error_callback, void *data)
+{
+  struct backtrace_module_index *index;
+  struct elf_lazy_module *module;
+  uintptr_t low;
+  uintptr_t high;
+  size_t len;
+  size_t i;
+  char *filename;
+
+  if (!elf_module_range (info, &low, &high))
+    return 0;
+
+  /* Threads that initialize the state at the same time each register
+     every library; keep one.  This only saves the allocation: the
+     library may be registered before ours is published, which
+     backtrace_module_index_add_unique tells.  */
+  index = backtrace_module_index_load (state, &state->lazy_index);
+  for (i = 0; index != NULL && i < index->count; ++i)
+    if (index->ranges[i].low == low && index->ranges[i].high == high)
+      return 0;
+
+  len = info->dlpi_name != NULL ? strlen (info->dlpi_name) : 0;
+  module = ((struct elf_lazy_module *)
+	    backtrace_alloc (state, sizeof *module + len + 1, error_callback,
+			     data));
+  if (module == NULL)
+    return 0;
+  filename = (char *) (module + 1);
+  memcpy (filename, len > 0 ? info->dlpi_name : "", len + 1);
+  module->filename = filename;
+  module->base_address = info->dlpi_addr;
+  module->low = low;
+  module->high = high;
+  module->loaded = loaded ? 2 : 0;
+  module->retired = 0;
+  module->arena = NULL;
+  module->arena_retired = 0;
+
+  if (backtrace_module_index_add_unique (state, &state->lazy_index, low,
+					 high, module, error_callback,
+					 data) != 1)
+    {
+      backtrace_free (state, module, sizeof *module + len + 1,
+		      error_callback, data);
+      return 0;
+    }
+  return 1;
+}
+
+/* Read the counters from INFO, if it is recent enough to hold them.  */
+
+static void
+elf_read_phdr_counters (struct dl_phdr_info *info, size_t size,
+			struct elf_phdr_counters *counters)
+{
+  counters->valid = (size >= offsetof (struct dl_phdr_info, dlpi_subs)
+		     + sizeof info->dlpi_subs);
+  if (counters->valid)
+    {
+      counters->adds = info->dlpi_adds;
+      counters->subs = info->dlpi_subs;
+    }
+}
+
+/* Callback passed to dl_iterate_phdr to read the counters; they are
+   the same in every call, so stop at the first one.  */
+
+static int
+#ifdef __i386__
+__attribute__ ((__force_align_arg_pointer__))
+#endif
+elf_counters_callback (struct dl_phdr_info *info, size_t size, void *pdata)
+{
+  elf_read_phdr_counters (info, size, (struct elf_phdr_counters *) pdata);
+  return 1;
+}
+
+/* Data passed to elf_refresh_callback.  */
+
+struct elf_refresh_data
+{
+  struct backtrace_state *state;
+  backtrace_error_callback error_callback;
+  void *data;
+  /* The registered modules, and which of them are still loaded.  */
+  struct backtrace_module_index *index;
+  char *seen;
+  /* Zero to mark the modules still loaded, non-zero to register the
+     new ones.  */
+  int registering;
+  /* Set if a module was registered or retired.  */
+  int changed;
+};
+
+/* Callback passed to dl_iterate_phdr by elf_refresh_modules.  */
+
+static int
+#ifdef __i386__
+__attribute__ ((__force_align_arg_pointer__))
+#endif
+elf_refresh_callback (struct dl_phdr_info *info,
+		      size_t size ATTRIBUTE_UNUSED, void *pdata)
+{
+  struct elf_refresh_data *rd = (struct elf_refresh_data *) pdata;
+  const char *name;
+  uintptr_t low;
+  uintptr_t high;
+  size_t i;
+
+  name = info->dlpi_name != NULL ? info->dlpi_name : "";
+  if (rd->registering)
+    {
+      /* The executable is never unloaded.  */
+      if (name[0] != '\0'
+	  && elf_register_module (rd->state, info, 0, rd->error_callback,
+				  rd->data))
+	rd->changed = 1;
+      return 0;
+    }
+
+  if (!elf_module_range (info, &low, &high))
+    return 0;
+  for (i = 0; i < rd->index->count; ++i)
+    {
+      struct elf_lazy_module *module;
+
+      module = (struct elf_lazy_module *) rd->index->ranges[i].data;
+      if (module->low == low
+	  && module->high == high
+	  && module->base_address == info->dlpi_addr
+	  && strcmp (module->filename, name) == 0)
+	rd->seen[i] = 1;
+    }
+  return 0;
+}
+
+/* Forget MODULE, which has been unloaded: remove it and what was read
+   from it from the indexes, and retire its record.  Lookups running
+   meanwhile still see it or not, but never block.  */
+
+static void
+elf_retire_module (struct backtrace_state *state,
+		   struct elf_lazy_module *module,
+		   backtrace_error_callback error_callback, void *data)
+{
+  if (!state->threaded)
+    module->retired = 1;
+  else
+    (void) __sync_bool_compare_and_swap (&module->retired, 0, 1);
+
+  backtrace_module_index_remove (state, &state->lazy_index, module->low,
+				 module->high, error_callback, data);
+  backtrace_module_index_remove (state, &state->fileline_index, module->low,
+				 module->high, error_callback, data);
+  backtrace_module_index_remove (state, &state->syminfo_index, module->low,
+				 module->high, error_callback, data);
+
+  /* Free what was read from the module once no lookup can be using
+     it, unless a thread still reads it: that thread will.  */
+  if ((state->threaded
+       ? backtrace_atomic_load_int (&module->loaded)
+       : module->loaded) == 2)
+    elf_retire_arena (state, module, error_callback, data);
+  backtrace_rcu_retire (state, module,
+			sizeof *module + strlen (module->filename) + 1,
+			error_callback, data);
+}
+
+/* Return non-zero if COUNTERS are those of the modules last listed.  */
+
+static int
+elf_modules_current (struct backtrace_state *state,
+		     const struct elf_phdr_counters *counters)
+{
+  if (!state->threaded)
+    return (counters->adds == state->modules_adds
+	    && counters->subs == state->modules_subs);
+  return (counters->adds == __sync_fetch_and_add (&state->modules_adds, 0)
+	  && counters->subs == __sync_fetch_and_add (&state->modules_subs, 0));
+}
+
+/* If objects were loaded or unloaded since the modules were last
+   listed, register the new ones and retire the unloaded ones.  This
+   is the refresh_modules function of the state, called by the lookups
+   of a PC in no known module and by backtrace_refresh_modules.  When
+   nothing changed it costs one dl_iterate_phdr call that stops at its
+   first object, which is what tells (through the adds/subs counters
+   of the loader) that nothing changed.  */
+
+static int
+elf_refresh_modules (struct backtrace_state *state,
+		     backtrace_error_callback error_callback, void *data)
+{
+  struct elf_phdr_counters counters;
+  struct elf_refresh_data rd;
+  struct backtrace_arena *arena;
+  size_t i;
+  int changed;
+
+  changed = 0;
+  counters.valid = 0;
+  dl_iterate_phdr (elf_counters_callback, (void *) &counters);
+  if (!counters.valid || elf_modules_current (state, &counters))
+    return 0;
+
+  if (state->threaded)
+    {
+      struct timespec start;
+
+      /* Another thread lists the modules: wait for it, as the library
+	 of our PC may be one it registers, or one it retires; past
+	 ELF_WAIT_NS, go on with the modules known so far.  */
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      while (!__sync_bool_compare_and_swap (&state->lock_modules, 0, 1))
+	{
+	  if (elf_waited_too_long (&start))
+	    return 0;
+	  sched_yield ();
+	}
+      if (elf_modules_current (state, &counters))
+	{
+	  backtrace_atomic_store_int (&state->lock_modules, 0);
+	  return 0;
+	}
+    }
+
+  /* The module records belong to the state, even in a signal handler
+     that interrupted the reading of a module.  */
+  arena = backtrace_arena_switch (NULL);
+
+  rd.state = state;
+  rd.error_callback = error_callback;
+  rd.data = data;
+  rd.changed = 0;
+  rd.index = backtrace_module_index_load (state, &state->lazy_index);
+  if (rd.index != NULL)
+    {
+      struct elf_lazy_module **unloaded;
+      size_t count;
+
+      rd.seen = (char *) backtrace_alloc (state, rd.index->count,
+					  error_callback, data);
+      if (rd.seen == NULL)
+	goto done;
+      memset (rd.seen, 0, rd.index->count);
+      rd.registering = 0;
+      dl_iterate_phdr (elf_refresh_callback, (void *) &rd);
+
+      /* Retiring a module replaces the index; collect the modules
+	 first.  */
+      count = rd.index->count;
+      unloaded = ((struct elf_lazy_module **)
+		  backtrace_alloc (state, count * sizeof *unloaded,
+				   error_callback, data));
+      if (unloaded == NULL)
+	{
+	  backtrace_free (state, rd.seen, count, error_callback, data);
+	  goto done;
+	}
+      for (i = 0; i < count; ++i)
+	{
+	  unloaded[i] = (struct elf_lazy_module *) rd.index->ranges[i].data;
+	  if (rd.seen[i] || unloaded[i]->filename[0] == '\0')
+	    unloaded[i] = NULL;
+	}
+      backtrace_free (state, rd.seen, count, error_callback, data);
+
+      /* A lookup that starts once a module is retired must not use a
+	 cache pointing into it: its memory may go away before the
+	 lookup ends (see rcu.c).  */
+      if (!state->threaded)
+	++state->generation;
+      else
+	__sync_fetch_and_add (&state->generation, 1);
+
+      for (i = 0; i < count; ++i)
+	if (unloaded[i] != NULL)
+	  {
+	    elf_retire_module (state, unloaded[i], error_callback, data);
+	    rd.changed = 1;
+	  }
+      backtrace_free (state, unloaded, count * sizeof *unloaded,
+		      error_callback, data);
+    }
+
+  /* Register the new objects once the unloaded ones are gone, as a
+     new one may have taken the addresses of an unloaded one.  */
+  rd.registering = 1;
+  dl_iterate_phdr (elf_refresh_callback, (void *) &rd);
+  changed = rd.changed;
+
+  /* The per-thread caches may hold the results of an unloaded module,
+     or that a PC of a new one was not found: drop them whenever the
+     loader's counters moved, whether or not a module changed here.  */
+  if (!state->threaded)
+    ++state->generation;
+  else
+    __sync_fetch_and_add (&state->generation, 1);
+
+  /* Objects loaded while we listed them are seen by the next call.  */
+  if (!state->threaded)
+    {
+      state->modules_adds = counters.adds;
+      state->modules_subs = counters.subs;
+    }
+  else
+    {
+      __sync_lock_test_and_set (&state->modules_adds, counters.adds);
+      __sync_lock_test_and_set (&state->modules_subs, counters.subs);
+    }
+
+ done:
+  backtrace_arena_switch (arena);
+  if (state->threaded)
+    backtrace_atomic_store_int (&state->lock_modules, 0);
+  return changed;
+}
+
+/* Read the modules containing *PC, or all of them if PC is NULL.  This
+   is the load_modules function of the state; a lookup of a PC in no
+   known module has looked for the libraries loaded since first.  Threads reading all the modules at once share the work: each
+   skips the modules another one reads, then waits for them at the
+   end.  */
+
+static int
+elf_load_modules (struct backtrace_state *state, const uintptr_t *pc,
+		  backtrace_error_callback error_callback, void *data)
+{
+  struct backtrace_module_index *index;
+  struct elf_lazy_module *module;
+  size_t pos;
+  int ret;
+#ifdef HAVE_TLS
+  int generation;
+
+  if (!state->threaded)
+    generation = state->generation;
+  else
+    generation = backtrace_atomic_load_int (&state->generation);
+
+  if (pc != NULL
+      && elf_loaded_range.state == state
+      && elf_loaded_range.generation == generation
+      && *pc >= elf_loaded_range.low
+      && *pc < elf_loaded_range.high)
+    return 1;
+#endif
+
+  index = backtrace_module_index_load (state, &state->lazy_index);
+  ret = 1;
+  if (pc == NULL)
+    {
+      for (pos = 0; index != NULL && pos < index->count; ++pos)
+	elf_load_module (state,
+			 (struct elf_lazy_module *) index->ranges[pos].data,
+			 0, error_callback, data);
+      for (pos = 0; index != NULL && pos < index->count; ++pos)
+	{
+	  module = (struct elf_lazy_module *) index->ranges[pos].data;
+	  if (!elf_load_module (state, module, 1, error_callback, data))
+	    ret = 0;
+	}
+      return ret;
+    }
+
+  pos = BACKTRACE_MODULE_INDEX_START;
+  while ((module = ((struct elf_lazy_module *)
+		    backtrace_module_index_next (index, *pc, &pos)))
+	 != NULL)
+    {
+      if (!elf_load_module (state, module, 1, error_callback, data))
+	{
+	  ret = 0;
+	  continue;
+	}
+#ifdef HAVE_TLS
+      /* Only a module that is read: the next lookups have to wait for
+	 the others.  */
+      elf_loaded_range.state = state;
+      elf_loaded_range.generation = generation;
+      elf_loaded_range.low = index->ranges[pos].low;
+      elf_loaded_range.high = index->ranges[pos].high;
+#endif
+    }
+  return ret;
+}
+
+/* Callback passed to dl_iterate_phdr.  Read the debug info of a PIE
+   executable; register the shared libraries.  */
 
 static int
 #ifdef __i386__
 __attribute__ ((__force_align_arg_pointer__))
 #endif
-phdr_callback (struct dl_phdr_info *info, size_t size ATTRIBUTE_UNUSED,
-	       void *pdata)
+phdr_callback (struct dl_phdr_info *info, size_t size, void *pdata)
 {
   struct phdr_data *pd = (struct phdr_data *) pdata;
   const char *filename;
   int descriptor;
-  int does_not_exist;
   fileline elf_fileline_fn;
   int found_dwarf;
 
   /* There is not much we can do if we don't have the module name,
      unless executable is ET_DYN, where we expect the very first
      phdr_callback to be for the PIE.  */
+  if (!pd->counters.valid)
+    elf_read_phdr_counters (info, size, &pd->counters);
+
   if (info->dlpi_name == NULL || info->dlpi_name[0] == '\0')
     {
+      elf_register_module (pd->state, info, 1, pd->error_callback, pd->data);
       if (pd->exe_descriptor == -1)
 	return 0;
       filename = pd->exe_filename;
@@ -3260,11 +3928,8 @@ phdr_callback (struct dl_phdr_info *info, size_t size ATTRIBUTE_UNUSED,
 	  pd->exe_descriptor = -1;
 	}
 
-      filename = info->dlpi_name;
-      descriptor = backtrace_open (info->dlpi_name, pd->error_callback,
-				   pd->data, &does_not_exist);
-      if (descriptor < 0)
-	return 0;
+      elf_register_module (pd->state, info, 0, pd->error_callback, pd->data);
+      return 0;
     }
 
   if (elf_add (pd->state, filename, descriptor, info->dlpi_addr,
@@ -3298,7 +3963,9 @@ backtrace_initialize (struct backtrace_state *state, const char *filename,
 
   ret = elf_add (state, filename, descriptor, 0, error_callback, data,
 		 &elf_fileline_fn, &found_sym, &found_dwarf, 1, 0);
-  if (!ret)
+  /* Go on with the symbols if the debug info could not be read (e.g.
+     DWARF this reader does not know).  */
+  if (!ret && !found_sym)
     return 0;
 
   pd.state = state;
@@ -3309,9 +3976,39 @@ backtrace_initialize (struct backtrace_state *state, const char *filename,
   pd.found_dwarf = &found_dwarf;
   pd.exe_filename = filename;
   pd.exe_descriptor = ret < 0 ? descriptor : -1;
+  pd.counters.valid = 0;
 
   dl_iterate_phdr (phdr_callback, (void *) &pd);
 
+  /* Threads that initialize the state at the same time read the same
+     counters, or the later ones.  */
+  if (pd.counters.valid)
+    {
+      if (!state->threaded)
+	{
+	  state->modules_adds = pd.counters.adds;
+	  state->modules_subs = pd.counters.subs;
+	}
+      else
+	{
+	  __sync_lock_test_and_set (&state->modules_adds, pd.counters.adds);
+	  __sync_lock_test_and_set (&state->modules_subs, pd.counters.subs);
+	}
+    }
+
+  if (!state->threaded)
+    {
+      state->load_modules_fn = elf_load_modules;
+      state->refresh_modules_fn = elf_refresh_modules;
+    }
+  else
+    {
+      backtrace_atomic_store_pointer (&state->load_modules_fn,
+				      elf_load_modules);
+      backtrace_atomic_store_pointer (&state->refresh_modules_fn,
+				      elf_refresh_modules);
+    }
+
   if (!state->threaded)
     {
       if (found_sym)
@@ -3338,3 +4035,41 @@ backtrace_initialize (struct backtrace_state *state, const char *filename,
 
   return 1;
 }
+
+/* Add the ELF file FILENAME, loaded at BASE_ADDRESS, to STATE without
+   looking at the running process.  */
+
+int
+backtrace_add_module (struct backtrace_state *state, const char *filename,
+		      uintptr_t base_address,
+		      backtrace_error_callback error_callback, void *data)
+{
+  int descriptor;
+  int does_not_exist;
+  int found_sym;
+  int found_dwarf;
+  fileline elf_fileline_fn = elf_nodebug;
+
+  descriptor = backtrace_open (filename, error_callback, data,
+			       &does_not_exist);
+  if (descriptor < 0)
+    {
+      if (does_not_exist)
+	error_callback (data, filename, ENOENT);
+      return 0;
+    }
+
+  found_sym = 0;
+  found_dwarf = 0;
+  /* Keep the symbols if the debug info could not be read.  */
+  if (!elf_add (state, filename, descriptor, base_address, error_callback,
+		data, &elf_fileline_fn, &found_sym, &found_dwarf, 0, 0)
+      && !found_sym)
+    return 0;
+
+  /* A non-NULL fileline_fn also tells fileline_initialize that the
+     modules are known already.  */
+  elf_publish_module (state, found_sym, found_dwarf, elf_fileline_fn);
+
+  return 1;
+}
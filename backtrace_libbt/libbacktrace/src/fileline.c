@@ -36,9 +36,16 @@ POSSIBILITY OF SUCH DAMAGE.  */
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "backtrace.h"
 #include "internal.h"
 
@@ -46,20 +53,24 @@ POSSIBILITY OF SUCH DAMAGE.  */
 #define getexecname() NULL
 #endif
 
-/* Initialize the fileline information from the executable.  Returns 1
-   on success, 0 on failure.  */
+#ifdef HAVE_TLS
+
+/* Non-zero while the thread reads the executable (see
+   fileline_initialize).  */
+
+static __thread int fileline_initializing;
+
+#endif
+
+/* Return 1 if the fileline information of STATE is initialized, 0 if
+   its initialization failed, -1 if it is not initialized yet.  */
 
 static int
-fileline_initialize (struct backtrace_state *state,
-		     backtrace_error_callback error_callback, void *data)
+fileline_initialized (struct backtrace_state *state,
+		      backtrace_error_callback error_callback, void *data)
 {
   int failed;
   fileline fileline_fn;
-  int pass;
-  int called_error_callback;
-  int descriptor;
-  const char *filename;
-  char buf[64];
 
   if (!state->threaded)
     failed = state->fileline_initialization_failed;
@@ -76,11 +87,26 @@ fileline_initialize (struct backtrace_state *state,
     fileline_fn = state->fileline_fn;
   else
     fileline_fn = backtrace_atomic_load_pointer (&state->fileline_fn);
-  if (fileline_fn != NULL)
-    return 1;
+  return fileline_fn != NULL ? 1 : -1;
+}
 
-  /* We have not initialized the information.  Do it now.  */
+/* Read the executable and register the shared libraries.  Returns 1 on
+   success, 0 on failure.  */
 
+static int
+fileline_read_executable (struct backtrace_state *state,
+			  backtrace_error_callback error_callback,
+			  void *data)
+{
+  int failed;
+  fileline fileline_fn;
+  int pass;
+  int called_error_callback;
+  int descriptor;
+  const char *filename;
+  char buf[64];
+
+  failed = 0;
   descriptor = -1;
   called_error_callback = 0;
   for (pass = 0; pass < 5; ++pass)
@@ -140,6 +166,7 @@ fileline_initialize (struct backtrace_state *state,
 
   if (!failed)
     {
+      backtrace_stats_add (state, initializations, 1);
       if (!backtrace_initialize (state, filename, descriptor, error_callback,
 				 data, &fileline_fn))
 	failed = 1;
@@ -158,29 +185,549 @@ fileline_initialize (struct backtrace_state *state,
     state->fileline_fn = fileline_fn;
   else
     {
-      backtrace_atomic_store_pointer (&state->fileline_fn, fileline_fn);
-
       /* Note that if two threads initialize at once, one of the data
-	 sets may be leaked.  */
+	 sets may be leaked.  The first one is kept: by now the modules
+	 read on first use (see elf.c) may have replaced it.  */
+      (void) __sync_bool_compare_and_swap (&state->fileline_fn, NULL,
+					   fileline_fn);
     }
 
   return 1;
 }
 
-/* Given a PC, find the file name, line number, and function name.  */
+/* Initialize the fileline information from the executable.  Returns 1
+   on success, 0 on failure.  */
+
+static int
+fileline_initialize (struct backtrace_state *state,
+		     backtrace_error_callback error_callback, void *data)
+{
+  int ret;
+
+  ret = fileline_initialized (state, error_callback, data);
+  if (ret >= 0)
+    return ret;
+
+  if (!state->threaded)
+    return fileline_read_executable (state, error_callback, data);
+
+#ifdef HAVE_TLS
+  /* One thread reads the executable while the others wait for it:
+     threads that read it at once duplicate the work, and all their
+     results but one leak.  A signal handler that interrupted the
+     reading thread reads it again.  */
+  if (!fileline_initializing)
+    {
+      while (!__sync_bool_compare_and_swap (&state->lock_initialization, 0,
+					    1))
+	{
+	  ret = fileline_initialized (state, error_callback, data);
+	  if (ret >= 0)
+	    return ret;
+	  sched_yield ();
+	}
+      ret = fileline_initialized (state, error_callback, data);
+      if (ret < 0)
+	{
+	  fileline_initializing = 1;
+	  ret = fileline_read_executable (state, error_callback, data);
+	  fileline_initializing = 0;
+	}
+      backtrace_atomic_store_int (&state->lock_initialization, 0);
+      return ret;
+    }
+#endif
+
+  return fileline_read_executable (state, error_callback, data);
+}
+
+/* Read the modules containing *PC (all of them if PC is NULL) if they
+   have not been read yet.  Returns 0 if one of them is still being
+   read by another thread: the lookup of PC can only be answered with
+   its symbol (see backtrace_symbol_only).  */
+
+static int
+fileline_load_modules (struct backtrace_state *state, const uintptr_t *pc,
+		       backtrace_error_callback error_callback, void *data)
+{
+  load_modules load_modules_fn;
+
+  if (!state->threaded)
+    load_modules_fn = state->load_modules_fn;
+  else
+    load_modules_fn = backtrace_atomic_load_pointer (&state->load_modules_fn);
+
+  if (load_modules_fn == NULL)
+    return 1;
+  return load_modules_fn (state, pc, error_callback, data);
+}
+
+#ifdef HAVE_TLS
+
+/* Non-zero if the lookups of the thread use the modules known so far
+   (see backtrace_freeze_modules).  */
+
+static __thread int fileline_frozen;
+
+#endif
+
+/* Pick up the libraries loaded or unloaded since the modules were
+   listed.  Unless FORCE, a thread whose lookups are frozen (see
+   backtrace_freeze_modules) does not.  */
+
+static int
+fileline_refresh_modules (struct backtrace_state *state, int force,
+			  backtrace_error_callback error_callback,
+			  void *data)
+{
+  refresh_modules refresh_modules_fn;
+
+#ifdef HAVE_TLS
+  if (fileline_frozen && !force)
+    return 0;
+#else
+  (void) force;
+#endif
+
+  if (!state->threaded)
+    refresh_modules_fn = state->refresh_modules_fn;
+  else
+    refresh_modules_fn
+      = backtrace_atomic_load_pointer (&state->refresh_modules_fn);
+
+  if (refresh_modules_fn == NULL)
+    return 0;
+  return refresh_modules_fn (state, error_callback, data);
+}
+
+/* Return non-zero if PC is in none of the modules listed so far: it
+   may be in a library loaded since.  A PC in the range of a library
+   unloaded since is taken for the old library, until
+   backtrace_refresh_modules is called.  */
+
+static int
+fileline_unknown_pc (struct backtrace_state *state, uintptr_t pc)
+{
+  struct backtrace_module_index *index;
+  size_t pos;
+
+  if ((!state->threaded
+       ? state->refresh_modules_fn
+       : backtrace_atomic_load_pointer (&state->refresh_modules_fn)) == NULL)
+    return 0;
+  index = backtrace_module_index_load (state, &state->lazy_index);
+  pos = BACKTRACE_MODULE_INDEX_START;
+  return backtrace_module_index_next (index, pc, &pos) == NULL;
+}
+
+/* Pick up the libraries loaded or unloaded since the modules were
+   listed.  */
+
+int
+backtrace_refresh_modules (struct backtrace_state *state,
+			   backtrace_error_callback error_callback,
+			   void *data)
+{
+  int epoch;
+  int ret;
+
+  epoch = backtrace_rcu_read_lock (state);
+  ret = 0;
+  if (fileline_initialize (state, error_callback, data)
+      && !state->fileline_initialization_failed)
+    ret = fileline_refresh_modules (state, 1, error_callback, data);
+  backtrace_rcu_read_unlock (state, epoch);
+  return ret;
+}
+
+/* Make the lookups of the calling thread use the modules known so
+   far, or not.  */
+
+int
+backtrace_freeze_modules (int frozen)
+{
+#ifdef HAVE_TLS
+  int previous;
+
+  previous = fileline_frozen;
+  fileline_frozen = frozen;
+  return previous;
+#else
+  (void) frozen;
+  return 0;
+#endif
+}
+
+/* Return the file/line function of STATE; reading a module may have
+   replaced it.  */
+
+static fileline
+fileline_function (struct backtrace_state *state)
+{
+  if (!state->threaded)
+    return state->fileline_fn;
+  return backtrace_atomic_load_pointer (&state->fileline_fn);
+}
+
+/* Run FN (ARG) in the calling thread and in THREADS - 1 worker
+   threads.  See internal.h.  */
+
+void
+backtrace_run_workers (struct backtrace_state *state, int threads,
+		       void *(*fn) (void *), void *arg,
+		       backtrace_error_callback error_callback, void *data)
+{
+#ifdef HAVE_PTHREAD
+  pthread_t *workers;
+  int started;
+  int i;
+
+  workers = NULL;
+  started = 0;
+  if (state->threaded && threads > 1)
+    {
+      workers = ((pthread_t *)
+		 backtrace_alloc (state, (threads - 1) * sizeof (pthread_t),
+				  error_callback, data));
+      /* If a thread can not be started, the others do its share.  */
+      while (workers != NULL
+	     && started < threads - 1
+	     && pthread_create (&workers[started], NULL, fn, arg) == 0)
+	++started;
+    }
+#else
+  (void) state;
+  (void) threads;
+  (void) error_callback;
+  (void) data;
+#endif
+
+  fn (arg);
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < started; ++i)
+    pthread_join (workers[i], NULL);
+  if (workers != NULL)
+    backtrace_free (state, workers, (threads - 1) * sizeof (pthread_t),
+		    error_callback, data);
+#endif
+}
+
+/* Data passed to fileline_load_modules_thread.  */
+
+struct fileline_load_data
+{
+  struct backtrace_state *state;
+  backtrace_error_callback error_callback;
+  void *data;
+};
+
+/* A thread of fileline_load_all.  */
+
+static void *
+fileline_load_modules_thread (void *vdata)
+{
+  struct fileline_load_data *ldata = (struct fileline_load_data *) vdata;
+  int epoch;
+
+  epoch = backtrace_rcu_read_lock (ldata->state);
+  fileline_load_modules (ldata->state, NULL, ldata->error_callback,
+			 ldata->data);
+  backtrace_rcu_read_unlock (ldata->state, epoch);
+  return NULL;
+}
+
+/* Read every module now, after looking for libraries loaded or
+   unloaded since the modules were listed, THREADS modules at a time.
+   The executable is read first, by the calling thread; the shared
+   libraries are then shared out between it and THREADS - 1 worker
+   threads, each taking the next library no thread reads yet (see
+   elf_load_modules).  A state that is not threaded can not be shared,
+   and is read by the calling thread alone.  */
+
+static int
+fileline_load_all (struct backtrace_state *state, int threads,
+		   backtrace_error_callback error_callback, void *data)
+{
+  struct fileline_load_data ldata;
+
+  if (!fileline_initialize (state, error_callback, data))
+    return 0;
+
+  fileline_refresh_modules (state, 0, error_callback, data);
+
+  ldata.state = state;
+  ldata.error_callback = error_callback;
+  ldata.data = data;
+  backtrace_run_workers (state, threads, fileline_load_modules_thread,
+			 &ldata, error_callback, data);
+
+  return 1;
+}
+
+/* Read every module now.  */
+
+int
+backtrace_load_modules (struct backtrace_state *state,
+			backtrace_error_callback error_callback, void *data)
+{
+  return backtrace_load_modules_parallel (state, 1, error_callback, data);
+}
+
+/* Read every module now, THREADS modules at a time.  */
+
+int
+backtrace_load_modules_parallel (struct backtrace_state *state, int threads,
+				 backtrace_error_callback error_callback,
+				 void *data)
+{
+  int epoch;
+  int ret;
+
+  epoch = backtrace_rcu_read_lock (state);
+  ret = fileline_load_all (state, threads, error_callback, data);
+  backtrace_rcu_read_unlock (state, epoch);
+  return ret;
+}
+
+/* Read every module and every compilation unit now, with THREADS
+   threads.  */
+
+int
+backtrace_prewarm_units (struct backtrace_state *state, int threads,
+			 struct backtrace_prewarm_stats *stats,
+			 backtrace_error_callback error_callback, void *data)
+{
+  struct backtrace_stats before;
+  struct backtrace_stats after;
+  struct timespec start;
+  struct timespec end;
+  size_t units;
+  size_t units_read;
+  int epoch;
+  int ret;
+
+  backtrace_get_stats (state, &before);
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  units = 0;
+  units_read = 0;
+  epoch = backtrace_rcu_read_lock (state);
+  ret = (fileline_load_all (state, threads, error_callback, data)
+	 && backtrace_dwarf_prewarm (state, threads, &units, &units_read,
+				     error_callback, data));
+  backtrace_rcu_read_unlock (state, epoch);
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  backtrace_get_stats (state, &after);
+
+  if (stats != NULL)
+    {
+      stats->units = units;
+      stats->units_read = units_read;
+      stats->elapsed_ns = ((uint64_t) (end.tv_sec - start.tv_sec)
+			   * 1000000000
+			   + (uint64_t) end.tv_nsec - (uint64_t) start.tv_nsec);
+      stats->mapped_bytes = (after.alloc_mapped_bytes
+			     - before.alloc_mapped_bytes);
+    }
+  return ret;
+}
+
+/* Data passed through fileline_symbol_callback.  */
+
+struct fileline_symbol_data
+{
+  backtrace_full_callback callback;
+  void *data;
+  int ret;
+};
+
+/* Pass the symbol of a PC on as its function name.  */
+
+static void
+fileline_symbol_callback (void *vdata, uintptr_t pc, const char *symname,
+			  uintptr_t symval ATTRIBUTE_UNUSED,
+			  uintptr_t symsize ATTRIBUTE_UNUSED)
+{
+  struct fileline_symbol_data *sdata = (struct fileline_symbol_data *) vdata;
+
+  sdata->ret = sdata->callback (sdata->data, pc, NULL, 0, symname);
+}
+
+/* Answer a lookup of PC with the symbol that contains it, without file
+   and line: its debug information is being read by another thread.  */
+
+int
+backtrace_symbol_only (struct backtrace_state *state, uintptr_t pc,
+		       backtrace_full_callback callback,
+		       backtrace_error_callback error_callback, void *data)
+{
+  syminfo syminfo_fn;
+  struct fileline_symbol_data sdata;
+
+  if (!state->threaded)
+    syminfo_fn = state->syminfo_fn;
+  else
+    syminfo_fn = (syminfo) backtrace_atomic_load_pointer (&state->syminfo_fn);
+  if (syminfo_fn == NULL)
+    return callback (data, pc, NULL, 0, NULL);
+
+  sdata.callback = callback;
+  sdata.data = data;
+  sdata.ret = 0;
+  syminfo_fn (state, pc, fileline_symbol_callback, error_callback, &sdata);
+  return sdata.ret;
+}
+
+/* Given a PC, find the file name, line number, and function name.
+   The module data is read in a read section (see rcu.c): a library
+   unloaded meanwhile is retired, not freed under us.  */
 
 int
 backtrace_pcinfo (struct backtrace_state *state, uintptr_t pc,
 		  backtrace_full_callback callback,
 		  backtrace_error_callback error_callback, void *data)
 {
+  int epoch;
+  int ret;
+
+  epoch = backtrace_rcu_read_lock (state);
+  ret = 0;
+  if (fileline_initialize (state, error_callback, data)
+      && !state->fileline_initialization_failed)
+    {
+      if (fileline_unknown_pc (state, pc))
+	fileline_refresh_modules (state, 0, error_callback, data);
+      if (fileline_load_modules (state, &pc, error_callback, data))
+	ret = fileline_function (state) (state, pc, callback, error_callback,
+					 data);
+      else
+	{
+	  backtrace_stats_add (state, symbol_only, 1);
+	  ret = backtrace_symbol_only (state, pc, callback, error_callback,
+				       data);
+	}
+    }
+  backtrace_rcu_read_unlock (state, epoch);
+  return ret;
+}
+
+/* Data passed through fileline_batch_callback.  */
+
+struct fileline_batch_data
+{
+  backtrace_batch_callback callback;
+  void *data;
+  size_t index;
+};
+
+/* Adapt a backtrace_full_callback call to a backtrace_batch_callback
+   one.  */
+
+static int
+fileline_batch_callback (void *vdata, uintptr_t pc, const char *filename,
+			 int lineno, const char *function)
+{
+  struct fileline_batch_data *bdata = (struct fileline_batch_data *) vdata;
+
+  return bdata->callback (bdata->data, bdata->index, pc, filename, lineno,
+			  function);
+}
+
+/* Look up each of the COUNT PCs of PCS; see backtrace_pcinfo_batch.  */
+
+static int
+fileline_batch_pcinfo (struct backtrace_state *state, const uintptr_t *pcs,
+		       size_t count, backtrace_batch_callback callback,
+		       backtrace_error_callback error_callback, void *data)
+{
+  fileline_batch fileline_batch_fn;
+  fileline fileline_fn;
+  struct fileline_batch_data bdata;
+  char *pending;
+  size_t i;
+  int ret;
+
   if (!fileline_initialize (state, error_callback, data))
     return 0;
 
   if (state->fileline_initialization_failed)
     return 0;
 
-  return state->fileline_fn (state, pc, callback, error_callback, data);
+  /* The modules are listed again at most once per batch.  */
+  for (i = 0; i < count; ++i)
+    if (fileline_unknown_pc (state, pcs[i]))
+      {
+	fileline_refresh_modules (state, 0, error_callback, data);
+	break;
+      }
+
+  /* PENDING marks the PCs whose module another thread still reads.  */
+  pending = NULL;
+  for (i = 0; i < count; ++i)
+    if (!fileline_load_modules (state, &pcs[i], error_callback, data))
+      {
+	if (pending == NULL)
+	  {
+	    pending = (char *) backtrace_alloc (state, count, error_callback,
+						data);
+	    if (pending == NULL)
+	      return 0;
+	    memset (pending, 0, count);
+	  }
+	pending[i] = 1;
+      }
+
+  if (!state->threaded)
+    fileline_batch_fn = state->fileline_batch_fn;
+  else
+    fileline_batch_fn = backtrace_atomic_load_pointer (&state->fileline_batch_fn);
+
+  if (fileline_batch_fn != NULL && pending == NULL)
+    return fileline_batch_fn (state, pcs, count, callback, error_callback,
+			      data);
+
+  /* No batch support (e.g. no debug info), or PCs that can only get
+     their symbol: one PC at a time.  */
+  fileline_fn = fileline_function (state);
+  bdata.callback = callback;
+  bdata.data = data;
+  ret = 0;
+  for (i = 0; i < count && ret == 0; ++i)
+    {
+      bdata.index = i;
+      if (pending != NULL && pending[i])
+	{
+	  backtrace_stats_add (state, symbol_only, 1);
+	  ret = backtrace_symbol_only (state, pcs[i], fileline_batch_callback,
+				       error_callback, &bdata);
+	}
+      else
+	ret = fileline_fn (state, pcs[i], fileline_batch_callback,
+			   error_callback, &bdata);
+    }
+  if (pending != NULL)
+    backtrace_free (state, pending, count, error_callback, data);
+  return ret;
+}
+
+/* Given an array of PCs, find the file name, line number, and function
+   name of each.  */
+
+int
+backtrace_pcinfo_batch (struct backtrace_state *state, const uintptr_t *pcs,
+			size_t count, backtrace_batch_callback callback,
+			backtrace_error_callback error_callback, void *data)
+{
+  int epoch;
+  int ret;
+
+  epoch = backtrace_rcu_read_lock (state);
+  ret = fileline_batch_pcinfo (state, pcs, count, callback, error_callback,
+			       data);
+  backtrace_rcu_read_unlock (state, epoch);
+  return ret;
 }
 
 /* Given a PC, find the symbol for it, and its value.  */
@@ -190,12 +737,25 @@ backtrace_syminfo (struct backtrace_state *state, uintptr_t pc,
 		   backtrace_syminfo_callback callback,
 		   backtrace_error_callback error_callback, void *data)
 {
-  if (!fileline_initialize (state, error_callback, data))
-    return 0;
+  int epoch;
+  int ret;
 
-  if (state->fileline_initialization_failed)
-    return 0;
+  epoch = backtrace_rcu_read_lock (state);
+  ret = 0;
+  if (fileline_initialize (state, error_callback, data)
+      && !state->fileline_initialization_failed)
+    {
+      if (fileline_unknown_pc (state, pc))
+	fileline_refresh_modules (state, 0, error_callback, data);
+      (void) fileline_load_modules (state, &pc, error_callback, data);
 
-  state->syminfo_fn (state, pc, callback, error_callback, data);
-  return 1;
+      if (!state->threaded)
+	state->syminfo_fn (state, pc, callback, error_callback, data);
+      else
+	((syminfo) backtrace_atomic_load_pointer (&state->syminfo_fn))
+	  (state, pc, callback, error_callback, data);
+      ret = 1;
+    }
+  backtrace_rcu_read_unlock (state, epoch);
+  return ret;
 }
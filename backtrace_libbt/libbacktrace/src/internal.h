@@ -64,6 +64,7 @@ POSSIBILITY OF SUCH DAMAGE.  */
 #define __sync_bool_compare_and_swap(A, B, C) (abort(), 1)
 #define __sync_lock_test_and_set(A, B) (abort(), 0)
 #define __sync_lock_release(A) abort()
+#define __sync_fetch_and_add(A, B) (abort(), 0)
 
 #endif /* !defined (HAVE_SYNC_FUNCTIONS) */
 
@@ -115,6 +116,34 @@ typedef int (*fileline) (struct backtrace_state *state, uintptr_t pc,
 			 backtrace_full_callback callback,
 			 backtrace_error_callback error_callback, void *data);
 
+/* The type of the function that collects file/line information for
+   an array of PCs.  This is like backtrace_pcinfo_batch.  */
+
+typedef int (*fileline_batch) (struct backtrace_state *state,
+			       const uintptr_t *pcs, size_t count,
+			       backtrace_batch_callback callback,
+			       backtrace_error_callback error_callback,
+			       void *data);
+
+/* The type of the function that reads the debug information of the
+   modules that are read on first use: the modules containing *PC, or
+   all of them if PC is NULL.  Returns 0 if a module containing *PC is
+   still being read by another thread after waiting for it, 1
+   otherwise.  */
+
+typedef int (*load_modules) (struct backtrace_state *state,
+			      const uintptr_t *pc,
+			      backtrace_error_callback error_callback,
+			      void *data);
+
+/* The type of the function that registers the modules loaded since
+   the modules were listed, and forgets the ones unloaded since.
+   Returns 1 if they changed.  */
+
+typedef int (*refresh_modules) (struct backtrace_state *state,
+				backtrace_error_callback error_callback,
+				void *data);
+
 /* The type of the function that collects symbol information.  This is
    like backtrace_syminfo.  */
 
@@ -138,18 +167,166 @@ struct backtrace_state
   fileline fileline_fn;
   /* The data to pass to FILELINE_FN.  */
   void *fileline_data;
+  /* The function that returns file/line information for an array of
+     PCs, or NULL if only FILELINE_FN is available.  It uses
+     FILELINE_DATA.  */
+  fileline_batch fileline_batch_fn;
   /* The function that returns symbol information.  */
   syminfo syminfo_fn;
   /* The data to pass to SYMINFO_FN.  */
   void *syminfo_data;
+  /* The modules of FILELINE_DATA and of SYMINFO_DATA by address.  */
+  struct backtrace_module_index *fileline_index;
+  struct backtrace_module_index *syminfo_index;
+  /* The modules whose debug information is read on first use, and the
+     function that reads it; NULL if there are none.  */
+  struct backtrace_module_index *lazy_index;
+  load_modules load_modules_fn;
+  /* The function that looks for modules loaded or unloaded since; NULL
+     if the modules cannot change.  */
+  refresh_modules refresh_modules_fn;
+  /* The dl_iterate_phdr counters of loaded and unloaded objects when
+     the modules were last listed, and whether a thread is listing
+     them again.  */
+  unsigned long long modules_adds;
+  unsigned long long modules_subs;
+  int lock_modules;
+  /* Whether a thread reads the executable (see fileline.c).  */
+  int lock_initialization;
+  /* Incremented when modules are loaded or unloaded: what the
+     per-thread lookup caches hold is only valid for one generation.  */
+  int generation;
+  /* The memory retired while other threads may still read it (see
+     rcu.c).  */
+  int rcu_epoch;
+  int rcu_readers[2];
+  int lock_rcu;
+  struct backtrace_retired *rcu_pending;
+  struct backtrace_retired *rcu_waiting;
   /* Whether initializing the file/line information failed.  */
   int fileline_initialization_failed;
   /* The lock for the freelist.  */
   int lock_alloc;
   /* The freelist when using mmap.  */
   struct backtrace_freelist_struct *freelist;
+  /* What backtrace_get_stats returns.  */
+  struct backtrace_stats stats;
+};
+
+/* The address range of a module, in a struct backtrace_module_index.  */
+
+struct backtrace_module_range
+{
+  /* Range is LOW <= PC < HIGH.  */
+  uintptr_t low;
+  uintptr_t high;
+  /* The highest HIGH of this range and of the ranges before it.  */
+  uintptr_t max_high;
+  /* The data of the module (struct dwarf_data, struct
+     elf_syminfo_data).  */
+  void *data;
+};
+
+/* The modules of a state sorted by address, so that the module of a
+   PC is found with one binary search rather than one per module (see
+   modindex.c).  */
+
+struct backtrace_module_index
+{
+  /* Number of ranges.  */
+  size_t count;
+  /* The ranges, sorted by LOW.  */
+  struct backtrace_module_range ranges[];
 };
 
+/* The first value of the position of backtrace_module_index_next.  */
+
+#define BACKTRACE_MODULE_INDEX_START ((size_t) -1)
+
+/* Return the index published at *PINDEX; NULL if it is empty.  */
+
+extern struct backtrace_module_index *backtrace_module_index_load
+  (struct backtrace_state *state, struct backtrace_module_index **pindex);
+
+/* Publish a copy of the index at *PINDEX with the range [LOW, HIGH) of
+   MODULE added.  Returns 1 on success, 0 on failure.  */
+
+extern int backtrace_module_index_add (struct backtrace_state *state,
+				       struct backtrace_module_index **pindex,
+				       uintptr_t low, uintptr_t high,
+				       void *module,
+				       backtrace_error_callback error_callback,
+				       void *data);
+
+/* Like backtrace_module_index_add, unless the index has the range
+   [LOW, HIGH) already: then returns -1, and MODULE is not added.  The
+   check and the publication are one compare and swap.  */
+
+extern int backtrace_module_index_add_unique
+  (struct backtrace_state *state, struct backtrace_module_index **pindex,
+   uintptr_t low, uintptr_t high, void *module,
+   backtrace_error_callback error_callback, void *data);
+
+/* Publish a copy of the index at *PINDEX without the ranges that
+   start in [LOW, HIGH).  Returns 1 on success, 0 on failure.  */
+
+extern int backtrace_module_index_remove
+  (struct backtrace_state *state, struct backtrace_module_index **pindex,
+   uintptr_t low, uintptr_t high, backtrace_error_callback error_callback,
+   void *data);
+
+/* Return the next module of INDEX whose range contains PC; NULL when
+   there are no more.  */
+
+extern void *backtrace_module_index_next
+  (const struct backtrace_module_index *index, uintptr_t pc, size_t *pos);
+
+/* Enter and leave a section during which the memory published in
+   STATE is not freed (see rcu.c).  */
+
+extern int backtrace_rcu_read_lock (struct backtrace_state *state);
+extern void backtrace_rcu_read_unlock (struct backtrace_state *state,
+				       int epoch);
+
+/* Free MEM, of SIZE bytes, once no thread can be reading it.  */
+
+extern void backtrace_rcu_retire (struct backtrace_state *state, void *mem,
+				  size_t size,
+				  backtrace_error_callback error_callback,
+				  void *data);
+
+/* A function that frees MEM, of SIZE bytes.  */
+
+typedef void (*backtrace_release_fn) (struct backtrace_state *state,
+				      void *mem, size_t size,
+				      backtrace_error_callback error_callback,
+				      void *data);
+
+/* Like backtrace_rcu_retire, but free MEM with RELEASE.  */
+
+extern void backtrace_rcu_retire_release
+  (struct backtrace_state *state, void *mem, size_t size,
+   backtrace_release_fn release, backtrace_error_callback error_callback,
+   void *data);
+
+/* Free the retired memory that no thread can be reading any more.  */
+
+extern void backtrace_rcu_collect (struct backtrace_state *state,
+				   backtrace_error_callback error_callback,
+				   void *data);
+
+/* Add V to the counter FIELD of the statistics of STATE.  */
+
+#define backtrace_stats_add(state, field, v)			\
+  do								\
+    {								\
+      if ((state)->threaded)					\
+	__sync_fetch_and_add (&(state)->stats.field, (v));	\
+      else							\
+	(state)->stats.field += (v);				\
+    }								\
+  while (0)
+
 /* Open a file for reading.  Returns -1 on error.  If DOES_NOT_EXIST
    is not NULL, *DOES_NOT_EXIST will be set to 0 normally and set to 1
    if the file does not exist.  If the file does not exist and
@@ -216,6 +393,54 @@ extern void backtrace_free (struct backtrace_state *state, void *mem,
 			    backtrace_error_callback error_callback,
 			    void *data);
 
+/* The memory read from one module, released at once when the module
+   is unloaded (see modarena.c).  */
+
+struct backtrace_arena;
+
+/* Create an arena.  Returns NULL on failure.  */
+
+extern struct backtrace_arena *backtrace_arena_create
+  (struct backtrace_state *state, backtrace_error_callback error_callback,
+   void *data);
+
+/* Make ARENA, which may be NULL, the arena backtrace_alloc uses in the
+   calling thread.  Returns the previous one.  */
+
+extern struct backtrace_arena *backtrace_arena_switch
+  (struct backtrace_arena *arena);
+
+/* Return the arena of the calling thread; NULL if it has none.  */
+
+extern struct backtrace_arena *backtrace_arena_current (void);
+
+/* Allocate SIZE bytes from ARENA.  */
+
+extern void *backtrace_arena_alloc (struct backtrace_state *state,
+				    struct backtrace_arena *arena, size_t size,
+				    backtrace_error_callback error_callback,
+				    void *data);
+
+/* Free memory allocated from ARENA.  Returns 0 if ADDR was not.  */
+
+extern int backtrace_arena_free (struct backtrace_state *state,
+				 struct backtrace_arena *arena, void *addr,
+				 size_t size);
+
+/* Release VIEW with the arena of the calling thread.  */
+
+extern void backtrace_arena_keep_view (struct backtrace_state *state,
+				       const struct backtrace_view *view,
+				       backtrace_error_callback error_callback,
+				       void *data);
+
+/* Release ARENA once no thread can be reading its memory.  */
+
+extern void backtrace_arena_retire (struct backtrace_state *state,
+				    struct backtrace_arena *arena,
+				    backtrace_error_callback error_callback,
+				    void *data);
+
 /* A growable vector of some struct.  This is used for more efficient
    allocation when we don't know the final size of some group of data
    that we want to represent as an array.  */
@@ -292,6 +517,37 @@ extern int backtrace_dwarf_add (struct backtrace_state *state,
 				backtrace_error_callback error_callback,
 				void *data, fileline *fileline_fn);
 
+/* Answer a lookup of PC with the symbol that contains it, without file
+   and line, when its debug information is being read by another
+   thread.  Calls CALLBACK once and returns what it returns.  */
+
+extern int backtrace_symbol_only (struct backtrace_state *state, uintptr_t pc,
+				  backtrace_full_callback callback,
+				  backtrace_error_callback error_callback,
+				  void *data);
+
+/* Run FN (ARG) in the calling thread and, if STATE is threaded, in
+   THREADS - 1 worker threads; return once every call returned.  A
+   worker that can not be started is not retried: FN is expected to
+   share the work out through ARG, so the others do its share.  */
+
+extern void backtrace_run_workers (struct backtrace_state *state,
+				   int threads, void *(*fn) (void *),
+				   void *arg,
+				   backtrace_error_callback error_callback,
+				   void *data);
+
+/* Read the line and function information of every compilation unit
+   of the DWARF modules of STATE with THREADS threads.  Sets *UNITS to
+   the number of units and *UNITS_READ to the number read by the call.
+   Returns 1 on success, 0 on failure.  */
+
+extern int backtrace_dwarf_prewarm (struct backtrace_state *state,
+				    int threads, size_t *units,
+				    size_t *units_read,
+				    backtrace_error_callback error_callback,
+				    void *data);
+
 /* A test-only hook for elf_uncompress_zdebug.  */
 
 extern int backtrace_uncompress_zdebug (struct backtrace_state *,
@@ -117,6 +117,13 @@ backtrace_alloc (struct backtrace_state *state,
   size_t pagesize;
   size_t asksize;
   void *page;
+  struct backtrace_arena *arena;
+
+  /* The memory read from a module comes from its arena (see
+     modarena.c).  */
+  arena = backtrace_arena_current ();
+  if (arena != NULL)
+    return backtrace_arena_alloc (state, arena, size, error_callback, data);
 
   ret = NULL;
 
@@ -130,7 +137,9 @@ backtrace_alloc (struct backtrace_state *state,
   else
     locked = __sync_lock_test_and_set (&state->lock_alloc, 1) == 0;
 
-  if (locked)
+  if (!locked)
+    backtrace_stats_add (state, alloc_lock_misses, 1);
+  else
     {
       for (pp = &state->freelist; *pp != NULL; pp = &(*pp)->next)
 	{
@@ -173,6 +182,7 @@ backtrace_alloc (struct backtrace_state *state,
 	}
       else
 	{
+	  backtrace_stats_add (state, alloc_mapped_bytes, asksize);
 	  size = (size + 7) & ~ (size_t) 7;
 	  if (size < asksize)
 	    backtrace_free (state, (char *) page + size, asksize - size,
@@ -193,6 +203,11 @@ backtrace_free (struct backtrace_state *state, void *addr, size_t size,
 		void *data ATTRIBUTE_UNUSED)
 {
   int locked;
+  struct backtrace_arena *arena;
+
+  arena = backtrace_arena_current ();
+  if (arena != NULL && backtrace_arena_free (state, arena, addr, size))
+    return;
 
   /* If we are freeing a large aligned block, just release it back to
      the system.  This case arises when growing a vector for a large
@@ -210,7 +225,10 @@ backtrace_free (struct backtrace_state *state, void *addr, size_t size,
 	  /* If munmap fails for some reason, just add the block to
 	     the freelist.  */
 	  if (munmap (addr, size) == 0)
-	    return;
+	    {
+	      backtrace_stats_add (state, alloc_unmapped_bytes, size);
+	      return;
+	    }
 	}
     }
 
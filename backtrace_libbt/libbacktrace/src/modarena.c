@@ -0,0 +1,443 @@
+/* modarena.c -- The memory of the modules that can be unloaded.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+    (1) Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+    (2) Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+    (3) The name of the author may not be used to
+    endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.  */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backtrace.h"
+#include "internal.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_FAILED
+#define MAP_FAILED ((void *)-1)
+#endif
+
+/* What is read from a shared library (its symbols, its DWARF data and
+   the views of its file they point into) is only used while the
+   library is loaded.  It is allocated from an arena of the library
+   rather than from the free list of the state, so that once the
+   library is unloaded it can all be unmapped at once, when no reader
+   can see it any more (see rcu.c); the free list keeps at most 16
+   blocks and leaks the others.
+
+   The arena is that of the calling thread, which backtrace_alloc and
+   backtrace_free look at: the code that reads a module does not have
+   to know where its memory comes from.  The memory shared between the
+   modules (the module indexes, the retired lists) must not come from
+   an arena; the code that allocates it leaves the arena of the thread
+   meanwhile.
+
+   Allocating only bumps a pointer in a chunk, with a compare and swap
+   in threaded mode: the units of a module may be read by several
+   threads at once.  Freeing does nothing, but for the large blocks
+   that have a mapping of their own (the vectors of a large module, as
+   they grow): the memory of the arena only goes away with it.  */
+
+/* The size of a chunk, and the size from which a block gets its own
+   mapping.  */
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_LARGE_SIZE (16 * 1024)
+
+/* A chunk of an arena; the blocks follow the header.  */
+
+struct arena_chunk
+{
+  /* The previous chunk.  */
+  struct arena_chunk *next;
+  /* The size of the chunk, and how much of it is used.  */
+  size_t size;
+  size_t used;
+};
+
+/* A large block with its own mapping.  */
+
+struct arena_block
+{
+  struct arena_block *next;
+  void *base;
+  size_t size;
+  /* Non-zero once the block has been unmapped.  */
+  int freed;
+};
+
+/* A view of the file of the module.  */
+
+struct arena_view
+{
+  struct arena_view *next;
+  struct backtrace_view view;
+};
+
+struct backtrace_arena
+{
+  /* The chunks, the current one first; the first chunk mapped, at the
+     end of the list, holds this struct.  */
+  struct arena_chunk *chunks;
+  /* The large blocks.  */
+  struct arena_block *blocks;
+  /* The views to release with the arena.  */
+  struct arena_view *views;
+};
+
+#ifdef HAVE_TLS
+
+/* The arena the calling thread allocates from; NULL for the memory of
+   the state.  */
+
+static __thread struct backtrace_arena *arena_current;
+
+#endif
+
+/* Round SIZE up for alignment; we assume that no type we care about
+   is more than 8 bytes.  */
+
+static size_t
+arena_round (size_t size)
+{
+  return (size + 7) & ~ (size_t) 7;
+}
+
+/* Map SIZE bytes for ARENA.  */
+
+static void *
+arena_map (struct backtrace_state *state, size_t size,
+	   backtrace_error_callback error_callback, void *data)
+{
+  void *p;
+
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	    -1, 0);
+  if (p == MAP_FAILED)
+    {
+      if (error_callback)
+	error_callback (data, "mmap", errno);
+      return NULL;
+    }
+  backtrace_stats_add (state, alloc_mapped_bytes, size);
+  return p;
+}
+
+/* Unmap SIZE bytes at P.  */
+
+static void
+arena_unmap (struct backtrace_state *state, void *p, size_t size)
+{
+  if (munmap (p, size) == 0)
+    backtrace_stats_add (state, alloc_unmapped_bytes, size);
+}
+
+/* Push ITEM, whose first field is the next pointer, on the list at
+   *PLIST.  */
+
+static void
+arena_push (struct backtrace_state *state, void **plist, void **item)
+{
+  if (!state->threaded)
+    {
+      *item = *plist;
+      *plist = item;
+      return;
+    }
+  do
+    *item = backtrace_atomic_load_pointer (plist);
+  while (!__sync_bool_compare_and_swap (plist, *item, item));
+}
+
+/* Create an arena.  Returns NULL on failure.  */
+
+struct backtrace_arena *
+backtrace_arena_create (struct backtrace_state *state,
+			backtrace_error_callback error_callback, void *data)
+{
+  struct arena_chunk *chunk;
+  struct backtrace_arena *arena;
+
+  chunk = ((struct arena_chunk *)
+	   arena_map (state, ARENA_CHUNK_SIZE, error_callback, data));
+  if (chunk == NULL)
+    return NULL;
+  chunk->next = NULL;
+  chunk->size = ARENA_CHUNK_SIZE;
+  chunk->used = arena_round (sizeof *chunk) + arena_round (sizeof *arena);
+  arena = ((struct backtrace_arena *)
+	   ((char *) chunk + arena_round (sizeof *chunk)));
+  arena->chunks = chunk;
+  arena->blocks = NULL;
+  arena->views = NULL;
+  return arena;
+}
+
+/* Make ARENA, which may be NULL, the arena of the calling thread.
+   Returns the previous one.  Without TLS there is no arena: the
+   memory of the modules is never freed.  */
+
+struct backtrace_arena *
+backtrace_arena_switch (struct backtrace_arena *arena)
+{
+#ifdef HAVE_TLS
+  struct backtrace_arena *previous;
+
+  previous = arena_current;
+  arena_current = arena;
+  return previous;
+#else
+  (void) arena;
+  return NULL;
+#endif
+}
+
+/* Return the arena of the calling thread; NULL if it has none.  */
+
+struct backtrace_arena *
+backtrace_arena_current (void)
+{
+#ifdef HAVE_TLS
+  return arena_current;
+#else
+  return NULL;
+#endif
+}
+
+/* Allocate SIZE bytes from ARENA.  */
+
+void *
+backtrace_arena_alloc (struct backtrace_state *state,
+		       struct backtrace_arena *arena, size_t size,
+		       backtrace_error_callback error_callback, void *data)
+{
+  size = arena_round (size);
+
+  if (size >= ARENA_LARGE_SIZE)
+    {
+      struct arena_block *block;
+      size_t pagesize;
+
+      block = ((struct arena_block *)
+	       backtrace_arena_alloc (state, arena, sizeof *block,
+				      error_callback, data));
+      if (block == NULL)
+	return NULL;
+      pagesize = getpagesize ();
+      block->size = (size + pagesize - 1) & ~ (pagesize - 1);
+      block->base = arena_map (state, block->size, error_callback, data);
+      if (block->base == NULL)
+	return NULL;
+      block->freed = 0;
+      arena_push (state, (void **) &arena->blocks, (void **) block);
+      return block->base;
+    }
+
+  while (1)
+    {
+      struct arena_chunk *chunk;
+      struct arena_chunk *fresh;
+      size_t used;
+
+      if (!state->threaded)
+	{
+	  chunk = arena->chunks;
+	  used = chunk->used;
+	}
+      else
+	{
+	  chunk = backtrace_atomic_load_pointer (&arena->chunks);
+	  used = __sync_fetch_and_add (&chunk->used, 0);
+	}
+      if (used + size <= chunk->size)
+	{
+	  if (!state->threaded)
+	    {
+	      chunk->used = used + size;
+	      return (char *) chunk + used;
+	    }
+	  if (__sync_bool_compare_and_swap (&chunk->used, used, used + size))
+	    return (char *) chunk + used;
+	  continue;
+	}
+
+      /* The chunk is full: start another one.  If another thread does
+	 too, use its chunk.  */
+      fresh = ((struct arena_chunk *)
+	       arena_map (state, ARENA_CHUNK_SIZE, error_callback, data));
+      if (fresh == NULL)
+	return NULL;
+      fresh->next = chunk;
+      fresh->size = ARENA_CHUNK_SIZE;
+      fresh->used = arena_round (sizeof *fresh) + size;
+      if (!state->threaded)
+	{
+	  arena->chunks = fresh;
+	  return (char *) fresh + arena_round (sizeof *fresh);
+	}
+      if (__sync_bool_compare_and_swap (&arena->chunks, chunk, fresh))
+	return (char *) fresh + arena_round (sizeof *fresh);
+      arena_unmap (state, fresh, ARENA_CHUNK_SIZE);
+    }
+}
+
+/* Free SIZE bytes at ADDR if they were allocated from ARENA: unmap
+   them if they are a large block, else leave them be.  Returns 0 if
+   they were not allocated from ARENA.  */
+
+int
+backtrace_arena_free (struct backtrace_state *state,
+		      struct backtrace_arena *arena, void *addr,
+		      size_t size ATTRIBUTE_UNUSED)
+{
+  struct arena_chunk *chunk;
+  struct arena_block *block;
+
+  if (!state->threaded)
+    block = arena->blocks;
+  else
+    block = backtrace_atomic_load_pointer (&arena->blocks);
+  for (; block != NULL; block = block->next)
+    {
+      if ((char *) addr < (char *) block->base
+	  || (char *) addr >= (char *) block->base + block->size
+	  || (state->threaded
+	      ? backtrace_atomic_load_int (&block->freed)
+	      : block->freed))
+	continue;
+
+      /* The unused end of a vector, or a vector that moved on after
+	 it was finished, stays until the arena goes away.  */
+      if (addr != block->base)
+	return 1;
+
+      if (!state->threaded)
+	block->freed = 1;
+      else if (!__sync_bool_compare_and_swap (&block->freed, 0, 1))
+	return 1;
+      arena_unmap (state, block->base, block->size);
+      return 1;
+    }
+
+  /* Part of a chunk; it stays until the arena goes away.  */
+  if (!state->threaded)
+    chunk = arena->chunks;
+  else
+    chunk = backtrace_atomic_load_pointer (&arena->chunks);
+  for (; chunk != NULL; chunk = chunk->next)
+    if ((char *) addr >= (char *) chunk
+	&& (char *) addr < (char *) chunk + chunk->size)
+      return 1;
+  return 0;
+}
+
+/* Release VIEW with the arena of the calling thread, rather than
+   never.  */
+
+void
+backtrace_arena_keep_view (struct backtrace_state *state,
+			   const struct backtrace_view *view,
+			   backtrace_error_callback error_callback,
+			   void *data)
+{
+  struct backtrace_arena *arena;
+  struct arena_view *kept;
+
+  arena = backtrace_arena_current ();
+  if (arena == NULL)
+    return;
+  kept = ((struct arena_view *)
+	  backtrace_arena_alloc (state, arena, sizeof *kept, error_callback,
+				 data));
+  if (kept == NULL)
+    return;
+  kept->view = *view;
+  arena_push (state, (void **) &arena->views, (void **) kept);
+}
+
+/* An error callback that ignores the error.  */
+
+static void
+arena_ignore_error (void *data ATTRIBUTE_UNUSED,
+		    const char *msg ATTRIBUTE_UNUSED,
+		    int errnum ATTRIBUTE_UNUSED)
+{
+}
+
+/* Release the memory of the arena MEM; this is the release function
+   backtrace_arena_retire passes to backtrace_rcu_retire_release.  */
+
+static void
+arena_release (struct backtrace_state *state, void *mem,
+	       size_t size ATTRIBUTE_UNUSED,
+	       backtrace_error_callback error_callback, void *data)
+{
+  struct backtrace_arena *arena = (struct backtrace_arena *) mem;
+  struct arena_view *view;
+  struct arena_block *block;
+  struct arena_chunk *chunk;
+
+  /* The collector of rcu.c may have no error callback.  */
+  if (error_callback == NULL)
+    error_callback = arena_ignore_error;
+
+  for (view = arena->views; view != NULL; view = view->next)
+    backtrace_release_view (state, &view->view, error_callback, data);
+  for (block = arena->blocks; block != NULL; block = block->next)
+    if (!block->freed)
+      arena_unmap (state, block->base, block->size);
+
+  /* The last chunk holds the arena.  */
+  chunk = arena->chunks;
+  while (chunk != NULL)
+    {
+      struct arena_chunk *next;
+
+      next = chunk->next;
+      arena_unmap (state, chunk, chunk->size);
+      chunk = next;
+    }
+}
+
+/* Release ARENA and what was allocated from it once no reader can see
+   it any more.  */
+
+void
+backtrace_arena_retire (struct backtrace_state *state,
+			struct backtrace_arena *arena,
+			backtrace_error_callback error_callback, void *data)
+{
+  backtrace_rcu_retire_release (state, arena, 0, arena_release,
+				error_callback, data);
+}
@@ -0,0 +1,343 @@
+/* modindex.c -- Map a PC to the module that contains it.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+    (1) Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+    (2) Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+    (3) The name of the author may not be used to
+    endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.  */
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "backtrace.h"
+#include "internal.h"
+
+/* The index is an array of the address ranges of the modules, sorted
+   by start address.  It is never modified once published: adding a
+   module copies it, and the copy replaces it with a compare and swap,
+   so readers only need an acquire load.  Removing the modules of an
+   unloaded library works the same way.  A replaced array is retired
+   (see rcu.c): in threaded mode a reader may still be searching it.  */
+
+/* Return the index published at *PINDEX; NULL if it is empty.  */
+
+struct backtrace_module_index *
+backtrace_module_index_load (struct backtrace_state *state,
+			     struct backtrace_module_index **pindex)
+{
+  if (!state->threaded)
+    return *pindex;
+  return backtrace_atomic_load_pointer (pindex);
+}
+
+/* Size in bytes of an index of COUNT ranges.  */
+
+static size_t
+module_index_size (size_t count)
+{
+  return (sizeof (struct backtrace_module_index)
+	  + count * sizeof (struct backtrace_module_range));
+}
+
+/* Replace the index OLD at *PINDEX with INDEX, whose ranges are set
+   but not their max_high, and retire OLD.  Returns 0 if another thread
+   replaced OLD first.  */
+
+static int
+module_index_publish (struct backtrace_state *state,
+		      struct backtrace_module_index **pindex,
+		      struct backtrace_module_index *old,
+		      struct backtrace_module_index *index,
+		      backtrace_error_callback error_callback, void *data)
+{
+  uintptr_t max_high;
+  size_t i;
+
+  max_high = 0;
+  for (i = 0; i < index->count; ++i)
+    {
+      if (index->ranges[i].high > max_high)
+	max_high = index->ranges[i].high;
+      index->ranges[i].max_high = max_high;
+    }
+
+  if (!state->threaded)
+    *pindex = index;
+  else if (!__sync_bool_compare_and_swap (pindex, old, index))
+    return 0;
+
+  if (old != NULL)
+    backtrace_rcu_retire (state, old, module_index_size (old->count),
+			  error_callback, data);
+  return 1;
+}
+
+/* Add the range [LOW, HIGH) of the module DATA to the index at
+   *PINDEX, allocating from the state.  If UNIQUE and the index has
+   that range already, return -1 instead.  */
+
+static int
+module_index_add (struct backtrace_state *state,
+		  struct backtrace_module_index **pindex,
+		  uintptr_t low, uintptr_t high, void *module, int unique,
+		  backtrace_error_callback error_callback, void *data)
+{
+  int epoch;
+
+  epoch = backtrace_rcu_read_lock (state);
+  while (1)
+    {
+      struct backtrace_module_index *old;
+      struct backtrace_module_index *index;
+      size_t old_count;
+      size_t pos;
+
+      old = backtrace_module_index_load (state, pindex);
+      old_count = old != NULL ? old->count : 0;
+
+      /* Checked in the index the new one replaces: a thread that adds
+	 the same range meanwhile makes the compare and swap fail.  */
+      for (pos = 0; unique && pos < old_count; ++pos)
+	if (old->ranges[pos].low == low && old->ranges[pos].high == high)
+	  {
+	    backtrace_rcu_read_unlock (state, epoch);
+	    return -1;
+	  }
+
+      index = ((struct backtrace_module_index *)
+	       backtrace_alloc (state, module_index_size (old_count + 1),
+				error_callback, data));
+      if (index == NULL)
+	{
+	  backtrace_rcu_read_unlock (state, epoch);
+	  return 0;
+	}
+
+      /* Keep the sort stable: a module added later goes after the
+	 modules starting at the same address.  */
+      pos = 0;
+      while (pos < old_count && old->ranges[pos].low <= low)
+	++pos;
+      if (pos > 0)
+	memcpy (index->ranges, old->ranges,
+		pos * sizeof (struct backtrace_module_range));
+      index->ranges[pos].low = low;
+      index->ranges[pos].high = high;
+      index->ranges[pos].data = module;
+      if (pos < old_count)
+	memcpy (index->ranges + pos + 1, old->ranges + pos,
+		(old_count - pos) * sizeof (struct backtrace_module_range));
+      index->count = old_count + 1;
+
+      if (module_index_publish (state, pindex, old, index, error_callback,
+				data))
+	{
+	  backtrace_rcu_read_unlock (state, epoch);
+	  return 1;
+	}
+
+      /* Another thread changed the index meanwhile; start again from
+	 its index.  */
+      backtrace_free (state, index, module_index_size (old_count + 1),
+		      error_callback, data);
+    }
+}
+
+/* Remove the ranges starting in [LOW, HIGH) from the index at
+   *PINDEX, allocating from the state.  */
+
+static int
+module_index_remove (struct backtrace_state *state,
+		     struct backtrace_module_index **pindex,
+		     uintptr_t low, uintptr_t high,
+		     backtrace_error_callback error_callback, void *data)
+{
+  int epoch;
+
+  epoch = backtrace_rcu_read_lock (state);
+  while (1)
+    {
+      struct backtrace_module_index *old;
+      struct backtrace_module_index *index;
+      size_t count;
+      size_t i;
+
+      old = backtrace_module_index_load (state, pindex);
+      count = 0;
+      for (i = 0; old != NULL && i < old->count; ++i)
+	if (old->ranges[i].low < low || old->ranges[i].low >= high)
+	  ++count;
+      if (old == NULL || count == old->count)
+	{
+	  backtrace_rcu_read_unlock (state, epoch);
+	  return 1;
+	}
+
+      index = ((struct backtrace_module_index *)
+	       backtrace_alloc (state, module_index_size (count),
+				error_callback, data));
+      if (index == NULL)
+	{
+	  backtrace_rcu_read_unlock (state, epoch);
+	  return 0;
+	}
+
+      index->count = 0;
+      for (i = 0; i < old->count; ++i)
+	if (old->ranges[i].low < low || old->ranges[i].low >= high)
+	  index->ranges[index->count++] = old->ranges[i];
+
+      if (module_index_publish (state, pindex, old, index, error_callback,
+				data))
+	{
+	  backtrace_rcu_read_unlock (state, epoch);
+	  return 1;
+	}
+
+      backtrace_free (state, index, module_index_size (count),
+		      error_callback, data);
+    }
+}
+
+/* Add the range [LOW, HIGH) of the module DATA to the index at
+   *PINDEX.  Returns 1 on success, 0 on failure.  */
+
+int
+backtrace_module_index_add (struct backtrace_state *state,
+			    struct backtrace_module_index **pindex,
+			    uintptr_t low, uintptr_t high, void *module,
+			    backtrace_error_callback error_callback,
+			    void *data)
+{
+  struct backtrace_arena *arena;
+  int ret;
+
+  /* The index belongs to the state, not to the module the calling
+     thread may be reading.  */
+  arena = backtrace_arena_switch (NULL);
+  ret = module_index_add (state, pindex, low, high, module, 0,
+			  error_callback, data);
+  backtrace_arena_switch (arena);
+  return ret;
+}
+
+/* Add the range [LOW, HIGH) of the module DATA to the index at
+   *PINDEX, unless it is there already.  Returns 1 on success, -1 if
+   the range is there already, 0 on failure.  */
+
+int
+backtrace_module_index_add_unique (struct backtrace_state *state,
+				   struct backtrace_module_index **pindex,
+				   uintptr_t low, uintptr_t high,
+				   void *module,
+				   backtrace_error_callback error_callback,
+				   void *data)
+{
+  struct backtrace_arena *arena;
+  int ret;
+
+  arena = backtrace_arena_switch (NULL);
+  ret = module_index_add (state, pindex, low, high, module, 1,
+			  error_callback, data);
+  backtrace_arena_switch (arena);
+  return ret;
+}
+
+/* Remove the ranges starting in [LOW, HIGH) from the index at
+   *PINDEX.  Returns 1 on success, 0 on failure.  */
+
+int
+backtrace_module_index_remove (struct backtrace_state *state,
+			       struct backtrace_module_index **pindex,
+			       uintptr_t low, uintptr_t high,
+			       backtrace_error_callback error_callback,
+			       void *data)
+{
+  struct backtrace_arena *arena;
+  int ret;
+
+  arena = backtrace_arena_switch (NULL);
+  ret = module_index_remove (state, pindex, low, high, error_callback, data);
+  backtrace_arena_switch (arena);
+  return ret;
+}
+
+/* Return the modules of INDEX whose range contains PC, one per call,
+   the one starting at the highest address first.  *POS holds the
+   position in INDEX between the calls; set it to
+   BACKTRACE_MODULE_INDEX_START before the first call.  Returns NULL
+   when there are no more.  */
+
+void *
+backtrace_module_index_next (const struct backtrace_module_index *index,
+			     uintptr_t pc, size_t *pos)
+{
+  size_t i;
+
+  if (index == NULL)
+    return NULL;
+
+  if (*pos == BACKTRACE_MODULE_INDEX_START)
+    {
+      size_t lo;
+      size_t hi;
+
+      /* Find the last range starting at or below PC.  */
+      lo = 0;
+      hi = index->count;
+      while (lo < hi)
+	{
+	  size_t mid;
+
+	  mid = lo + (hi - lo) / 2;
+	  if (index->ranges[mid].low <= pc)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      i = lo;
+    }
+  else
+    i = *pos;
+
+  /* Ranges may overlap (e.g. the DWARF of a module can describe code
+     that was discarded at link time at address 0), so walk down while
+     an earlier range may still reach PC.  */
+  while (i > 0 && index->ranges[i - 1].max_high > pc)
+    {
+      --i;
+      if (pc < index->ranges[i].high)
+	{
+	  *pos = i;
+	  return index->ranges[i].data;
+	}
+    }
+  *pos = 0;
+  return NULL;
+}
@@ -0,0 +1,227 @@
+/* rcu.c -- Free memory that concurrent lookups may still read.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+    (1) Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+    (2) Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+    (3) The name of the author may not be used to
+    endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.  */
+
+
+#include "config.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "backtrace.h"
+#include "internal.h"
+
+/* Memory that was unpublished while other threads may still read it
+   (a replaced module index, the record of an unloaded module) is
+   retired rather than freed.  Readers never wait: they count
+   themselves in one of two counters, chosen by the parity of an epoch
+   number.  Retired memory is freed once every reader that may have
+   seen it is gone:
+
+   - memory retired during epoch E goes to a pending list;
+   - the epoch moves to E + 1 only when no reader of E - 1 is left,
+     since the readers of E + 1 share its counter; the pending list
+     then waits for the readers of E (and before) to leave;
+   - once the counter of E is zero, the waiting list is freed.
+
+   Moving the epoch and freeing is done by whichever thread retires
+   memory or leaves a read section while some is retired, one at a
+   time; a thread that finds another one collecting leaves the work to
+   it, or to the next one.  In non-threaded mode nothing else can be
+   reading, and retired memory is freed at once.  */
+
+/* A retired block.  */
+
+struct backtrace_retired
+{
+  /* The next block of the list.  */
+  struct backtrace_retired *next;
+  /* The memory and its size.  */
+  void *mem;
+  size_t size;
+  /* The function that frees it.  */
+  backtrace_release_fn release;
+};
+
+/* Enter a read section of STATE: until the matching
+   backtrace_rcu_read_unlock, memory this thread finds published will
+   not be freed.  Read sections may nest.  Returns the value to pass
+   to backtrace_rcu_read_unlock.  */
+
+int
+backtrace_rcu_read_lock (struct backtrace_state *state)
+{
+  int epoch;
+
+  if (!state->threaded)
+    return 0;
+
+  while (1)
+    {
+      epoch = backtrace_atomic_load_int (&state->rcu_epoch);
+      __sync_fetch_and_add (&state->rcu_readers[epoch & 1], 1);
+
+      /* If the epoch moved before we were counted, the collector may
+	 not have seen us; count ourselves in the new epoch.  */
+      if (backtrace_atomic_load_int (&state->rcu_epoch) == epoch)
+	return epoch;
+      __sync_fetch_and_sub (&state->rcu_readers[epoch & 1], 1);
+    }
+}
+
+/* Leave the read section entered when backtrace_rcu_read_lock
+   returned EPOCH.  A reader leaving may be what retired memory waits
+   for, so try to free it.  */
+
+void
+backtrace_rcu_read_unlock (struct backtrace_state *state, int epoch)
+{
+  if (!state->threaded)
+    return;
+  __sync_fetch_and_sub (&state->rcu_readers[epoch & 1], 1);
+
+  if (backtrace_atomic_load_pointer (&state->rcu_pending) != NULL
+      || backtrace_atomic_load_pointer (&state->rcu_waiting) != NULL)
+    backtrace_rcu_collect (state, NULL, NULL);
+}
+
+/* Free the blocks of the list LIST.  */
+
+static void
+rcu_free_list (struct backtrace_state *state, struct backtrace_retired *list,
+	       backtrace_error_callback error_callback, void *data)
+{
+  while (list != NULL)
+    {
+      struct backtrace_retired *next;
+
+      next = list->next;
+      list->release (state, list->mem, list->size, error_callback, data);
+      backtrace_free (state, list, sizeof *list, error_callback, data);
+      list = next;
+    }
+}
+
+/* Free the retired memory of STATE that no reader can see any more,
+   and move the epoch if that lets more of it be freed later.  */
+
+void
+backtrace_rcu_collect (struct backtrace_state *state,
+		       backtrace_error_callback error_callback, void *data)
+{
+  int epoch;
+
+  if (!state->threaded)
+    return;
+
+  if (!__sync_bool_compare_and_swap (&state->lock_rcu, 0, 1))
+    return;
+
+  epoch = backtrace_atomic_load_int (&state->rcu_epoch);
+
+  /* The waiting list was unpublished before the epoch moved to EPOCH;
+     only the readers of EPOCH - 1 and before may still see it.  */
+  if (state->rcu_waiting != NULL
+      && backtrace_atomic_load_int (&state->rcu_readers[(epoch - 1) & 1]) == 0)
+    {
+      rcu_free_list (state, state->rcu_waiting, error_callback, data);
+      backtrace_atomic_store_pointer (&state->rcu_waiting, NULL);
+    }
+
+  if (state->rcu_waiting == NULL
+      && backtrace_atomic_load_pointer (&state->rcu_pending) != NULL
+      && backtrace_atomic_load_int (&state->rcu_readers[(epoch + 1) & 1]) == 0)
+    {
+      struct backtrace_retired *pending;
+
+      do
+	pending = backtrace_atomic_load_pointer (&state->rcu_pending);
+      while (!__sync_bool_compare_and_swap (&state->rcu_pending, pending,
+					    NULL));
+      backtrace_atomic_store_int (&state->rcu_epoch, epoch + 1);
+      __sync_synchronize ();
+      backtrace_atomic_store_pointer (&state->rcu_waiting, pending);
+
+      /* The readers of EPOCH may all be gone already.  */
+      if (backtrace_atomic_load_int (&state->rcu_readers[epoch & 1]) == 0)
+	{
+	  rcu_free_list (state, pending, error_callback, data);
+	  backtrace_atomic_store_pointer (&state->rcu_waiting, NULL);
+	}
+    }
+
+  backtrace_atomic_store_int (&state->lock_rcu, 0);
+}
+
+/* Free MEM, of SIZE bytes, once no reader of STATE can see it any
+   more.  MEM must have been unpublished already.  */
+
+void
+backtrace_rcu_retire (struct backtrace_state *state, void *mem, size_t size,
+		      backtrace_error_callback error_callback, void *data)
+{
+  backtrace_rcu_retire_release (state, mem, size, backtrace_free,
+				error_callback, data);
+}
+
+/* Like backtrace_rcu_retire, but free MEM with RELEASE.  */
+
+void
+backtrace_rcu_retire_release (struct backtrace_state *state, void *mem,
+			      size_t size, backtrace_release_fn release,
+			      backtrace_error_callback error_callback,
+			      void *data)
+{
+  struct backtrace_retired *retired;
+  struct backtrace_arena *arena;
+
+  if (!state->threaded)
+    {
+      release (state, mem, size, error_callback, data);
+      return;
+    }
+
+  /* The retired list belongs to the state, not to the module the
+     calling thread may be reading.  */
+  arena = backtrace_arena_switch (NULL);
+  retired = ((struct backtrace_retired *)
+	     backtrace_alloc (state, sizeof *retired, error_callback, data));
+  backtrace_arena_switch (arena);
+  if (retired == NULL)
+    return;
+  retired->mem = mem;
+  retired->size = size;
+  retired->release = release;
+  do
+    retired->next = backtrace_atomic_load_pointer (&state->rcu_pending);
+  while (!__sync_bool_compare_and_swap (&state->rcu_pending, retired->next,
+					retired));
+
+  backtrace_rcu_collect (state, error_callback, data);
+}
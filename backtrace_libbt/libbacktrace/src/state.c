@@ -70,3 +70,12 @@ backtrace_create_state (const char *filename, int threaded,
 
   return state;
 }
+
+/* Copy the counters of STATE.  */
+
+void
+backtrace_get_stats (struct backtrace_state *state,
+		     struct backtrace_stats *stats)
+{
+  *stats = state->stats;
+}
@@ -0,0 +1,12 @@
+#include "loader.h"
+
+#include <link.h>
+
+unsigned long long loaderGeneration() {
+    unsigned long long generation = 0;
+    dl_iterate_phdr([](dl_phdr_info* i_info, size_t, void* o_data) -> int {
+        *static_cast<unsigned long long *>(o_data) = i_info->dlpi_adds + i_info->dlpi_subs;
+        return 1;
+    }, &generation);
+    return generation;
+}
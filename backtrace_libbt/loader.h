@@ -0,0 +1,10 @@
+#ifndef _BKTCE_LOADER_H
+#define _BKTCE_LOADER_H
+
+//! Returns the number of libraries the dynamic loader has loaded and
+//! unloaded so far (dlpi_adds + dlpi_subs); it changes whenever the
+//! set of modules may have; one dl_iterate_phdr() step, which takes the
+//! loader's lock: not async-signal-safe
+unsigned long long loaderGeneration();
+
+#endif // _BKTCE_LOADER_H
@@ -0,0 +1,310 @@
+
+#include "profiler.h"
+
+#include "cfi_unwinder.h"
+#include "demangle.h"
+#include "raw_stacktrace.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <ostream>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+pid_t getThreadId() {
+    return static_cast<pid_t>(syscall(SYS_gettid));
+}
+
+//! deletes the registration when a registered thread exits
+struct ThreadRegistration {
+    //! the Profiler::ThreadState of this thread
+    void* m_state = nullptr;
+
+    ~ThreadRegistration() {
+        if (m_state) {
+            Profiler::instance().unregisterThread();
+        }
+    }
+};
+
+thread_local ThreadRegistration t_registration;
+
+}
+
+Profiler& Profiler::instance() {
+    static Profiler* s_instance = new Profiler;
+    return *s_instance;
+}
+
+Profiler::Profiler()
+ : m_samples(0),
+   m_droppedByDepot(0),
+   m_frequencyHz(100),
+   m_running(false),
+   m_oldAction(),
+   m_stopCollector(false) {
+    //! the depot must exist before the first sample is collected
+    StackDepot::instance();
+}
+
+void Profiler::onSignal(int, siginfo_t* i_info, void* i_context) {
+    int savedErrno = errno;
+    ThreadState* state = static_cast<ThreadState *>(i_info->si_value.sival_ptr);
+    if (i_info->si_code != SI_TIMER || ! state) {
+        errno = savedErrno;
+        return;
+    }
+
+    std::uint32_t head = state->m_head.load(std::memory_order_relaxed);
+    std::uint32_t tail = state->m_tail.load(std::memory_order_acquire);
+    if (head - tail >= s_ringSize) {
+        state->m_dropped.fetch_add(1, std::memory_order_relaxed);
+        errno = savedErrno;
+        return;
+    }
+
+    Sample& sample = state->m_ring[head % s_ringSize];
+    bool_t truncated = false;
+    std::size_t size = unwindSignalContext(i_context, sample.m_frames, s_maxDepth, &truncated);
+    sample.m_size = static_cast<std::uint32_t>(size);
+    sample.m_truncated = truncated;
+    state->m_head.store(head + 1, std::memory_order_release);
+    errno = savedErrno;
+}
+
+void Profiler::arm(ThreadState* i_state, bool_t i_enabled) {
+    itimerspec spec = {};
+    if (i_enabled) {
+        long interval = 1000000000L / (m_frequencyHz ? m_frequencyHz : 1);
+        spec.it_interval.tv_sec = interval / 1000000000L;
+        spec.it_interval.tv_nsec = interval % 1000000000L;
+        spec.it_value = spec.it_interval;
+    }
+    timer_settime(i_state->m_timer, 0, &spec, nullptr);
+}
+
+bool_t Profiler::start(unsigned i_frequencyHz) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running.load()) {
+        return false;
+    }
+
+    //! make sure the module tables of the CFI unwinder and libgcc's
+    //! unwinder are initialized outside the handler
+    CfiUnwinder::instance();
+    RawStacktrace<4> warmUp;
+    (void)warmUp;
+
+    struct sigaction action = {};
+    action.sa_sigaction = &Profiler::onSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &m_oldAction) != 0) {
+        return false;
+    }
+
+    m_frequencyHz = i_frequencyHz;
+    m_running.store(true);
+    {
+        std::lock_guard<std::mutex> collectorLock(m_collectorMutex);
+        m_stopCollector = false;
+    }
+    m_collector = std::thread(&Profiler::collect, this);
+    for (ThreadState* state : m_threads) {
+        if (state->m_inUse) {
+            arm(state, true);
+        }
+    }
+    return true;
+}
+
+void Profiler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (! m_running.load()) {
+            return;
+        }
+        for (ThreadState* state : m_threads) {
+            if (state->m_inUse) {
+                arm(state, false);
+            }
+        }
+        m_running.store(false);
+    }
+    {
+        std::lock_guard<std::mutex> collectorLock(m_collectorMutex);
+        m_stopCollector = true;
+    }
+    m_collectorWakeUp.notify_one();
+    m_collector.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    drain();
+    //! the handler stays installed: a signal may still be pending;
+    //! it ignores signals that do not come from one of our timers
+}
+
+bool_t Profiler::running() const {
+    return m_running.load();
+}
+
+bool_t Profiler::registerThread() {
+    if (t_registration.m_state) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ThreadState* state = nullptr;
+    for (ThreadState* candidate : m_threads) {
+        if (! candidate->m_inUse) {
+            state = candidate;
+            break;
+        }
+    }
+    bool_t recycled = state != nullptr;
+    if (! recycled) {
+        state = new ThreadState;
+        state->m_head.store(0);
+        state->m_tail.store(0);
+        state->m_dropped.store(0);
+    }
+
+    sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_value.sival_ptr = state;
+    event._sigev_un._tid = getThreadId();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &state->m_timer) != 0) {
+        if (! recycled) {
+            delete state;
+        }
+        return false;
+    }
+    //! look the stack up now: the handler can not, and the frame
+    //! pointer walk needs it
+    threadStackEnd();
+    state->m_inUse = true;
+    if (! recycled) {
+        m_threads.push_back(state);
+    }
+    if (m_running.load()) {
+        arm(state, true);
+    }
+    t_registration.m_state = state;
+    return true;
+}
+
+void Profiler::unregisterThread() {
+    ThreadState* state = static_cast<ThreadState *>(t_registration.m_state);
+    if (! state) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //! delete the timer with SIGPROF blocked, then discard a signal that
+    //! may already be pending, so that the handler can not run on a
+    //! state that has been handed over to another thread
+    sigset_t profMask;
+    sigset_t oldMask;
+    sigemptyset(&profMask);
+    sigaddset(&profMask, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profMask, &oldMask);
+    timer_delete(state->m_timer);
+    timespec noWait = {0, 0};
+    while (sigtimedwait(&profMask, nullptr, &noWait) == SIGPROF) {
+    }
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+    state->m_inUse = false;
+    t_registration.m_state = nullptr;
+}
+
+void Profiler::collect() {
+    std::unique_lock<std::mutex> collectorLock(m_collectorMutex);
+    while (! m_stopCollector) {
+        m_collectorWakeUp.wait_for(collectorLock, std::chrono::milliseconds(100));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        drain();
+    }
+}
+
+void Profiler::drain() {
+    StackDepot& depot = StackDepot::instance();
+    for (ThreadState* state : m_threads) {
+        std::uint32_t tail = state->m_tail.load(std::memory_order_relaxed);
+        std::uint32_t head = state->m_head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const Sample& sample = state->m_ring[tail % s_ringSize];
+            stack_id_t id = depot.put(sample.m_frames, sample.m_size, sample.m_truncated);
+            if (id) {
+                ++m_counts[id];
+                ++m_samples;
+            } else {
+                ++m_droppedByDepot;
+            }
+        }
+        state->m_tail.store(tail, std::memory_order_release);
+    }
+}
+
+void Profiler::writeFolded(std::ostream& o_stream) const {
+    std::map<string_t, std::uint64_t> folded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        char name[256];
+        for (const auto& entry : m_counts) {
+            Stacktrace st = StackDepot::instance().toStacktrace(entry.first);
+            st.resolve();
+            const std::vector<Frame>& frames = st.getFrames();
+            string_t line;
+            //! folded stacks list the outermost frame first
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+                if (! line.empty()) {
+                    line += ';';
+                }
+                string_view_t function = it->getFunction();
+                if (function.empty()) {
+                    std::snprintf(name, sizeof(name), "%p", it->get());
+                    line += name;
+                } else {
+                    Demangler::shortName(function, name, sizeof(name));
+                    line += name;
+                }
+            }
+            //! symbolization may merge distinct PCs into one line
+            folded[line] += entry.second;
+        }
+    }
+    for (const auto& entry : folded) {
+        o_stream << entry.first << ' ' << entry.second << '\n';
+    }
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    drain();
+    m_counts.clear();
+    m_samples = 0;
+    m_droppedByDepot = 0;
+    for (ThreadState* state : m_threads) {
+        state->m_dropped.store(0);
+    }
+}
+
+std::uint64_t Profiler::samples() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_samples;
+}
+
+std::uint64_t Profiler::dropped() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::uint64_t dropped = m_droppedByDepot;
+    for (ThreadState* state : m_threads) {
+        dropped += state->m_dropped.load();
+    }
+    return dropped;
+}
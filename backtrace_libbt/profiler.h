@@ -0,0 +1,121 @@
+#ifndef _BKTCE_PROFILER_H
+#define _BKTCE_PROFILER_H
+
+#include "bktce.h"
+#include "stack_depot.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
+#include <time.h>
+
+//! An in-process sampling CPU profiler;
+//! Every registered thread owns a POSIX timer that measures the
+//! thread's CPU time and delivers SIGPROF to that very thread
+//! (SIGEV_THREAD_ID), so samples are proportional to the CPU each
+//! thread burns rather than to wall time;
+//! The signal handler only unwinds the raw frame pointers into the
+//! thread's single-producer/single-consumer ring, starting from the
+//! interrupted registers (see unwindSignalContext()); it neither
+//! allocates nor locks; a collector thread drains the rings into a StackDepot
+//! and counts samples per unique stack; symbolization is deferred to
+//! writeFolded(), which prints one line per stack in the folded format
+//! of flamegraph.pl ("root;caller;callee count");
+//! Threads are not profiled unless they call registerThread(); a
+//! registered thread is unregistered automatically when it exits;
+//! Samples are unwound by CfiUnwinder or the frame pointers whatever
+//! the backend of unwindStack(): _Unwind_Backtrace takes a lock in
+//! dl_iterate_phdr, which a sample that interrupts dlopen()/dlclose()
+//! on the same thread would deadlock on; CfiUnwinder only sees the
+//! libraries loaded before start() or its last refresh()
+class Profiler {
+public:
+    //! The process-wide profiler; it is never destroyed
+    static Profiler& instance();
+
+    //! Installs the SIGPROF handler, arms the timers of the registered
+    //! threads and starts the collector; returns false if the profiler
+    //! is already running or the handler can not be installed
+    bool_t start(unsigned i_frequencyHz = 100);
+
+    //! Disarms the timers, stops the collector and drains the samples
+    //! that are still in the rings; the aggregated profile is kept
+    void stop();
+
+    bool_t running() const;
+
+    //! Creates the CPU timer of the calling thread (armed right away if
+    //! the profiler is running); returns false on failure
+    bool_t registerThread();
+
+    //! Deletes the CPU timer of the calling thread
+    void unregisterThread();
+
+    //! Writes the aggregated profile in the folded stack format
+    void writeFolded(std::ostream& o_stream) const;
+
+    //! Drops the aggregated profile
+    void reset();
+
+    //! Number of samples aggregated so far
+    std::uint64_t samples() const;
+
+    //! Number of samples lost because a ring (or the depot) was full
+    std::uint64_t dropped() const;
+
+private:
+    static const std::size_t s_maxDepth = 64;
+    static const std::size_t s_ringSize = 64;
+
+    struct Sample {
+        std::uint32_t m_size;
+        std::uint32_t m_truncated;
+        native_frame_ptr_t m_frames[s_maxDepth];
+    };
+
+    //! per-thread state; it is recycled, never freed, because a
+    //! signal may still refer to it after the thread is gone
+    struct ThreadState {
+        timer_t m_timer;
+        bool_t m_inUse;
+        std::atomic<std::uint32_t> m_head;
+        std::atomic<std::uint32_t> m_tail;
+        std::atomic<std::uint64_t> m_dropped;
+        Sample m_ring[s_ringSize];
+    };
+
+    Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    static void onSignal(int i_signal, siginfo_t* i_info, void* i_context);
+
+    void arm(ThreadState* i_state, bool_t i_enabled);
+
+    void collect();
+
+    void drain();
+
+    mutable std::mutex m_mutex;
+    std::vector<ThreadState*> m_threads;
+    std::unordered_map<stack_id_t, std::uint64_t> m_counts;
+    std::uint64_t m_samples;
+    std::uint64_t m_droppedByDepot;
+
+    unsigned m_frequencyHz;
+    std::atomic<bool_t> m_running;
+    struct sigaction m_oldAction;
+
+    std::thread m_collector;
+    std::mutex m_collectorMutex;
+    std::condition_variable m_collectorWakeUp;
+    bool_t m_stopCollector;
+};
+
+#endif // _BKTCE_PROFILER_H
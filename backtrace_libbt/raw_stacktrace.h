@@ -0,0 +1,164 @@
+#ifndef _BKTCE_RAW_STACKTRACE_H
+#define _BKTCE_RAW_STACKTRACE_H
+
+#include "bktce.h"
+
+//! Unwinds the calling thread's stack with _Unwind_Backtrace and writes
+//! the frame pointers to o_buffer; the first recorded frame is the
+//! caller of unwindStack(), after skipping i_numSkippedFrames frames;
+//! At most i_capacity frame pointers are written; if the stack has
+//! more frames than that, *o_truncated is set to true (o_truncated
+//! may be null);
+//! Returns the number of frame pointers written;
+//! This function does not allocate
+std::size_t unwindStack(native_frame_ptr_t* o_buffer,
+                        std::size_t i_capacity,
+                        std::size_t i_numSkippedFrames,
+                        bool_t* o_truncated);
+
+//! How unwindStack() walks the stack
+enum class UnwindBackend {
+    //! _Unwind_Backtrace: works for any code that has unwind tables,
+    //! but interprets the DWARF CFI of every frame (and looks up its FDE)
+    Cfi,
+    //! follows the chain of saved frame pointers: a couple of loads per
+    //! frame, but only correct if every frame on the stack is built with
+    //! -fno-omit-frame-pointer; the walk ends at the first frame
+    //! pointer outside the thread's stack, and falls back to Cfi if a
+    //! frame pointer inside the stack does not point further up
+    FramePointer,
+    //! bktce's own CFI unwinder (see CfiUnwinder): no frame pointers
+    //! needed, no lock taken, rules cached per PC; falls back to Cfi
+    //! at a frame it can not step through
+    CachedCfi
+};
+
+//! Selects the backend of unwindStack() for the whole process
+//! (default: Cfi)
+void setUnwindBackend(UnwindBackend i_backend);
+
+UnwindBackend unwindBackend();
+
+//! The backends; same contract as unwindStack()
+std::size_t unwindStackCfi(native_frame_ptr_t* o_buffer,
+                           std::size_t i_capacity,
+                           std::size_t i_numSkippedFrames,
+                           bool_t* o_truncated);
+
+std::size_t unwindStackFramePointer(native_frame_ptr_t* o_buffer,
+                                    std::size_t i_capacity,
+                                    std::size_t i_numSkippedFrames,
+                                    bool_t* o_truncated);
+
+std::size_t unwindStackCachedCfi(native_frame_ptr_t* o_buffer,
+                                 std::size_t i_capacity,
+                                 std::size_t i_numSkippedFrames,
+                                 bool_t* o_truncated);
+
+//! Unwinds the stack a signal interrupted, from the registers saved in
+//! i_ucontext (the third argument of an SA_SIGINFO handler): the first
+//! recorded frame is the interrupted PC, then its callers; neither the
+//! handler nor the signal trampoline is recorded; otherwise same
+//! contract as unwindStack();
+//! FramePointer walks from the saved frame pointer and falls back to
+//! CfiUnwinder::unwind(); the other backends run CfiUnwinder::unwind()
+//! and fall back to the frame pointers if it can not step past the
+//! interrupted PC; never calls _Unwind_Backtrace, never allocates nor
+//! locks;
+//! The frame pointers are only checked against the end of the stack
+//! if the thread has looked it up before (see threadStackEnd())
+std::size_t unwindSignalContext(const void* i_ucontext,
+                                native_frame_ptr_t* o_buffer,
+                                std::size_t i_capacity,
+                                bool_t* o_truncated);
+
+//! The frame pointer walk of unwindSignalContext(): the interrupted PC,
+//! then the return addresses of the frame records its saved frame
+//! pointer leads to, as far as the chain holds
+std::size_t unwindSignalFramePointer(const void* i_ucontext,
+                                     native_frame_ptr_t* o_buffer,
+                                     std::size_t i_capacity,
+                                     bool_t* o_truncated);
+
+//! The highest address of the calling thread's stack, 0 if unknown;
+//! it is looked up with pthread_getattr_np() on the first call of each
+//! thread, which is not async-signal-safe: capture once on a thread
+//! before capturing in its signal handlers, or pass i_lookUp = false
+//! to get 0 rather than look it up
+std::uintptr_t threadStackEnd(bool_t i_lookUp = true);
+
+//! A stack trace of at most N raw frame pointers, stored inline;
+//! Capturing never touches the heap, so it can be done inside
+//! allocators, in lock-held regions and in signal handlers (note that
+//! the very first _Unwind_Backtrace call of the process initializes
+//! libgcc's unwinder; capture once outside the handler to be safe);
+//! No symbolization happens here; convert it to a Stacktrace when the
+//! frames need to be resolved;
+//! If the stack is deeper than the requested depth the trace is marked
+//! as truncated rather than silently losing the exterior frames
+template<std::size_t N>
+class RawStacktrace {
+public:
+    //! frame 0 is the function that constructs the trace, unless
+    //! i_numSkippedFrames says otherwise;
+    //! i_maxDepth is clamped to N
+    __attribute__((noinline))
+    explicit RawStacktrace(std::size_t i_numSkippedFrames = 0,
+                           std::size_t i_maxDepth = N)
+     : m_size(0),
+       m_truncated(false) {
+        //! skip the constructor itself
+        m_size = unwindStack(
+            m_frames,
+            i_maxDepth < N ? i_maxDepth : N,
+            i_numSkippedFrames + 1,
+            &m_truncated);
+    }
+
+    static std::size_t capacity() {
+        return N;
+    }
+
+    std::size_t size() const {
+        return m_size;
+    }
+
+    //! the stack has more frames than what was captured
+    bool_t truncated() const {
+        return m_truncated;
+    }
+
+    native_frame_ptr_t operator[](std::size_t i_index) const {
+        return m_frames[i_index];
+    }
+
+    const native_frame_ptr_t* begin() const {
+        return m_frames;
+    }
+
+    const native_frame_ptr_t* end() const {
+        return m_frames + m_size;
+    }
+
+    //! FNV-1a over the frame pointers; matches Stacktrace::hash()
+    std::size_t hash() const {
+        std::size_t h = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < m_size; ++i) {
+            h ^= reinterpret_cast<std::size_t>(m_frames[i]);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    //! Converts to a (lazily symbolized) Stacktrace; this allocates
+    Stacktrace toStacktrace() const {
+        return Stacktrace(begin(), end(), m_truncated);
+    }
+
+private:
+    native_frame_ptr_t m_frames[N];
+    std::size_t m_size;
+    bool_t m_truncated;
+};
+
+#endif // _BKTCE_RAW_STACKTRACE_H
@@ -0,0 +1,181 @@
+
+#include "stack_depot.h"
+
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+
+namespace {
+
+//! reserves zero-filled address space; the pages are only committed
+//! when they are first written
+void* reserve(std::size_t i_bytes) {
+    void* p = mmap(nullptr, i_bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+std::size_t nextPowerOf2(std::size_t i_value) {
+    std::size_t p = 1;
+    while (p < i_value) {
+        p <<= 1;
+    }
+    return p;
+}
+
+}
+
+StackDepot& StackDepot::instance() {
+    static StackDepot* s_instance = new StackDepot;
+    return *s_instance;
+}
+
+StackDepot::StackDepot(std::size_t i_maxStacks, std::size_t i_maxFrames)
+ : m_slots(nullptr),
+   m_slotMask(0),
+   m_maxStacks(i_maxStacks),
+   m_numStacks(0),
+   m_pool(nullptr),
+   m_poolWords(i_maxFrames + i_maxStacks * s_recordWords),
+   m_poolUsed(0) {
+
+    //! ids are 32-bit word offsets
+    if (m_poolWords >= 0xFFFFFFFFULL) {
+        m_poolWords = 0xFFFFFFFEULL;
+    }
+
+    //! keep the load factor under 1/2 so that probe sequences stay short
+    std::size_t numSlots = nextPowerOf2(i_maxStacks * 2);
+    m_slots = static_cast<std::atomic<stack_id_t> *>(
+        reserve(numSlots * sizeof(std::atomic<stack_id_t>)));
+    m_slotMask = numSlots - 1;
+    m_pool = static_cast<std::uint64_t *>(reserve(m_poolWords * sizeof(std::uint64_t)));
+}
+
+StackDepot::~StackDepot() {
+    munmap(m_slots, (m_slotMask + 1) * sizeof(std::atomic<stack_id_t>));
+    munmap(m_pool, m_poolWords * sizeof(std::uint64_t));
+}
+
+std::uint64_t StackDepot::hashFrames(const native_frame_ptr_t* i_begin,
+                                     std::size_t i_size) {
+    //! one multiply-xorshift round per frame (a variant of the
+    //! murmur3 finalizer); frame pointers are well spread in their
+    //! high bits and poorly in their low bits
+    std::uint64_t h = 0x9E3779B97F4A7C15ULL ^ i_size;
+    for (std::size_t i = 0; i < i_size; ++i) {
+        h ^= reinterpret_cast<std::uintptr_t>(i_begin[i]);
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+const StackDepot::Record* StackDepot::record(stack_id_t i_id) const {
+    return reinterpret_cast<const Record *>(m_pool + (i_id - 1));
+}
+
+bool_t StackDepot::equals(stack_id_t i_id,
+                          std::uint64_t i_hash,
+                          const native_frame_ptr_t* i_begin,
+                          std::size_t i_size,
+                          bool_t i_truncated) const {
+    const Record* r = record(i_id);
+    if (r->m_hash != i_hash || r->m_size != i_size || r->m_truncated != i_truncated) {
+        return false;
+    }
+    return std::memcmp(r + 1, i_begin, i_size * sizeof(native_frame_ptr_t)) == 0;
+}
+
+stack_id_t StackDepot::put(const native_frame_ptr_t* i_begin,
+                           std::size_t i_size,
+                           bool_t i_truncated) {
+    std::uint64_t h = hashFrames(i_begin, i_size);
+    stack_id_t mine = 0;
+    for (std::size_t probe = h & m_slotMask; ; probe = (probe + 1) & m_slotMask) {
+        stack_id_t id = m_slots[probe].load(std::memory_order_acquire);
+        if (id) {
+            if (equals(id, h, i_begin, i_size, i_truncated)) {
+                return id;
+            }
+            continue;
+        }
+
+        //! an empty slot: the stack is not in the table
+        if (! mine) {
+            if (m_numStacks.load(std::memory_order_relaxed) >= m_maxStacks) {
+                return 0;
+            }
+            std::size_t words = s_recordWords + i_size;
+            std::size_t offset = m_poolUsed.fetch_add(words, std::memory_order_relaxed);
+            if (offset + words > m_poolWords) {
+                return 0;
+            }
+            Record* r = reinterpret_cast<Record *>(m_pool + offset);
+            r->m_hash = h;
+            r->m_size = static_cast<std::uint32_t>(i_size);
+            r->m_truncated = i_truncated;
+            std::memcpy(r + 1, i_begin, i_size * sizeof(native_frame_ptr_t));
+            mine = static_cast<stack_id_t>(offset + 1);
+        }
+
+        //! publish the record; if another thread won the slot, it may
+        //! have stored the very same stack
+        stack_id_t expected = 0;
+        if (m_slots[probe].compare_exchange_strong(expected, mine,
+                                                   std::memory_order_release,
+                                                   std::memory_order_acquire)) {
+            m_numStacks.fetch_add(1, std::memory_order_relaxed);
+            return mine;
+        }
+        if (equals(expected, h, i_begin, i_size, i_truncated)) {
+            //! our copy is simply never referenced (append-only storage)
+            return expected;
+        }
+    }
+}
+
+const native_frame_ptr_t* StackDepot::get(stack_id_t i_id, std::size_t& o_size) const {
+    if (! i_id || i_id > m_poolUsed.load(std::memory_order_relaxed)) {
+        o_size = 0;
+        return nullptr;
+    }
+    const Record* r = record(i_id);
+    o_size = r->m_size;
+    return reinterpret_cast<const native_frame_ptr_t *>(r + 1);
+}
+
+bool_t StackDepot::truncated(stack_id_t i_id) const {
+    std::size_t size = 0;
+    if (! get(i_id, size)) {
+        return false;
+    }
+    return record(i_id)->m_truncated;
+}
+
+Stacktrace StackDepot::toStacktrace(stack_id_t i_id) const {
+    std::size_t size = 0;
+    const native_frame_ptr_t* frames = get(i_id, size);
+    if (! frames) {
+        return Stacktrace(nullptr, nullptr);
+    }
+    return Stacktrace(frames, frames + size, truncated(i_id));
+}
+
+std::size_t StackDepot::size() const {
+    return m_numStacks.load(std::memory_order_relaxed);
+}
+
+std::size_t StackDepot::bytesUsed() const {
+    std::size_t used = m_poolUsed.load(std::memory_order_relaxed);
+    if (used > m_poolWords) {
+        used = m_poolWords;
+    }
+    return used * sizeof(std::uint64_t);
+}
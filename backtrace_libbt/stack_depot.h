@@ -0,0 +1,100 @@
+#ifndef _BKTCE_STACK_DEPOT_H
+#define _BKTCE_STACK_DEPOT_H
+
+#include "bktce.h"
+#include "raw_stacktrace.h"
+
+#include <atomic>
+#include <cstdint>
+
+//! id of a unique stack in a StackDepot; 0 is never a valid id
+using stack_id_t = std::uint32_t;
+
+//! A deduplicating store of raw stack traces;
+//! Most captured traces are repeats; the depot maps a sequence of frame
+//! pointers to a stable 32-bit id, so logs, profilers and allocation
+//! trackers can record 4 bytes per event instead of the whole trace,
+//! and symbolize each unique stack once, when it is reported;
+//! The depot is append-only and lock-free: the hash table is an open
+//! addressing array of atomic ids and the traces are bump-allocated
+//! from one virtual memory region reserved (not committed) up front;
+//! put() never calls malloc and never blocks, so it is safe in signal
+//! handlers and inside allocators; construct the depot (or call
+//! instance()) before the first put() from such a context
+class StackDepot {
+public:
+    //! The process-wide depot; it is never destroyed
+    static StackDepot& instance();
+
+    //! i_maxStacks: number of unique stacks
+    //! i_maxFrames: total number of frame pointers of all unique stacks
+    explicit StackDepot(std::size_t i_maxStacks = 1 << 20,
+                        std::size_t i_maxFrames = 1 << 24);
+    ~StackDepot();
+
+    //! Returns the id of the stack [i_begin, i_begin + i_size),
+    //! storing it if it is new; returns 0 if the depot is full
+    stack_id_t put(const native_frame_ptr_t* i_begin,
+                   std::size_t i_size,
+                   bool_t i_truncated = false);
+
+    template<std::size_t N>
+    stack_id_t put(const RawStacktrace<N>& i_stack) {
+        return put(i_stack.begin(), i_stack.size(), i_stack.truncated());
+    }
+
+    //! Returns the frame pointers of a stack and sets o_size to their
+    //! number; returns nullptr (and 0) for an invalid id
+    const native_frame_ptr_t* get(stack_id_t i_id, std::size_t& o_size) const;
+
+    //! Was the stack truncated when it was captured
+    bool_t truncated(stack_id_t i_id) const;
+
+    //! Returns a (lazily symbolized) copy of a stack; this allocates
+    Stacktrace toStacktrace(stack_id_t i_id) const;
+
+    //! Number of unique stacks
+    std::size_t size() const;
+
+    //! Bytes of the trace storage in use
+    std::size_t bytesUsed() const;
+
+    //! The hash put() uses for the hash table
+    static std::uint64_t hashFrames(const native_frame_ptr_t* i_begin,
+                                    std::size_t i_size);
+
+private:
+    StackDepot(const StackDepot&) = delete;
+    StackDepot& operator=(const StackDepot&) = delete;
+
+    //! the header of each stored trace; the frame pointers follow it
+    struct Record {
+        std::uint64_t m_hash;
+        std::uint32_t m_size;
+        std::uint32_t m_truncated;
+    };
+
+    static const std::size_t s_recordWords = sizeof(Record) / sizeof(std::uint64_t);
+
+    const Record* record(stack_id_t i_id) const;
+
+    bool_t equals(stack_id_t i_id,
+                  std::uint64_t i_hash,
+                  const native_frame_ptr_t* i_begin,
+                  std::size_t i_size,
+                  bool_t i_truncated) const;
+
+    //! hash table: each slot holds 0 (empty) or a stack id
+    std::atomic<stack_id_t>* m_slots;
+    std::size_t m_slotMask;
+    std::size_t m_maxStacks;
+    std::atomic<std::size_t> m_numStacks;
+
+    //! trace storage, in 8-byte words; a stack id is the word offset of
+    //! its Record plus one
+    std::uint64_t* m_pool;
+    std::size_t m_poolWords;
+    std::atomic<std::size_t> m_poolUsed;
+};
+
+#endif // _BKTCE_STACK_DEPOT_H
@@ -0,0 +1,221 @@
+
+//! bktce_symbolize: prints the traces of a binary trace log (see
+//! trace_log.h) with function names, source files and line numbers;
+//! usage: bktce_symbolize [--root DIR] [--debug-dir DIR] LOG
+//!   --root DIR       look the modules up under DIR (a copy of the
+//!                    production machine's file system)
+//!   --debug-dir DIR  prefer DIR/.build-id/xx/yyyy.debug, the separate
+//!                    debug info of a module with build-id xxyyyy
+//! A module whose file has a different build-id than the one recorded
+//! is symbolized anyway, with a warning: the results may be wrong
+
+#include "demangle.h"
+#include "trace_log.h"
+
+#include <backtrace.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#include <elf.h>
+
+namespace {
+
+//! reads the GNU build-id note of an ELF64 file
+std::vector<std::uint8_t> readBuildId(const string_t& i_path) {
+    std::vector<std::uint8_t> buildId;
+    std::ifstream ifs(i_path, std::ios::binary);
+    Elf64_Ehdr ehdr;
+    if (! ifs.read(reinterpret_cast<char *>(&ehdr), sizeof(ehdr))
+        || std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr.e_ident[EI_CLASS] != ELFCLASS64) {
+        return buildId;
+    }
+    for (unsigned i = 0; i < ehdr.e_phnum; ++i) {
+        Elf64_Phdr phdr;
+        ifs.seekg(ehdr.e_phoff + i * ehdr.e_phentsize);
+        if (! ifs.read(reinterpret_cast<char *>(&phdr), sizeof(phdr))) {
+            break;
+        }
+        if (phdr.p_type != PT_NOTE || phdr.p_filesz > (1 << 20)) {
+            continue;
+        }
+        std::vector<char> notes(phdr.p_filesz);
+        ifs.seekg(phdr.p_offset);
+        if (! ifs.read(notes.data(), notes.size())) {
+            break;
+        }
+        std::size_t offset = 0;
+        while (offset + sizeof(Elf64_Nhdr) <= notes.size()) {
+            Elf64_Nhdr note;
+            std::memcpy(&note, notes.data() + offset, sizeof(note));
+            std::size_t name = offset + sizeof(note);
+            std::size_t desc = name + ((note.n_namesz + 3) & ~3u);
+            if (desc + note.n_descsz > notes.size()) {
+                break;
+            }
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4
+                && std::memcmp(notes.data() + name, "GNU", 4) == 0) {
+                buildId.assign(notes.data() + desc, notes.data() + desc + note.n_descsz);
+                return buildId;
+            }
+            offset = desc + ((note.n_descsz + 3) & ~3u);
+        }
+    }
+    return buildId;
+}
+
+string_t hex(const std::vector<std::uint8_t>& i_bytes) {
+    static const char s_digits[] = "0123456789abcdef";
+    string_t s;
+    for (std::uint8_t byte : i_bytes) {
+        s += s_digits[byte >> 4];
+        s += s_digits[byte & 0xf];
+    }
+    return s;
+}
+
+bool_t exists(const string_t& i_path) {
+    std::ifstream ifs(i_path);
+    return static_cast<bool_t>(ifs);
+}
+
+void errorCallback(void*, const char* i_message, int i_errnum) {
+    if (i_errnum > 0) {
+        std::fprintf(stderr, "bktce_symbolize: %s: %s\n", i_message, std::strerror(i_errnum));
+    } else if (i_errnum == 0) {
+        std::fprintf(stderr, "bktce_symbolize: %s\n", i_message);
+    }
+}
+
+struct Location {
+    string_t m_function;
+    string_t m_filename;
+    int m_lineNumber;
+};
+
+int fullCallback(void* o_locations, uintptr_t, const char* i_filename, int i_lineNumber, const char* i_function) {
+    if (i_function) {
+        char name[1024];
+        Demangler::instance().demangle(i_function, name, sizeof(name));
+        static_cast<std::vector<Location> *>(o_locations)->push_back(
+            {name, i_filename ? i_filename : "", i_lineNumber});
+    }
+    return 0;
+}
+
+void syminfoCallback(void* o_name, uintptr_t, const char* i_symbol, uintptr_t, uintptr_t) {
+    if (i_symbol) {
+        char name[1024];
+        Demangler::instance().demangle(i_symbol, name, sizeof(name));
+        *static_cast<string_t *>(o_name) = name;
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    string_t root;
+    string_t debugDir;
+    const char* logPath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            root = argv[++i];
+        } else if (std::strcmp(argv[i], "--debug-dir") == 0 && i + 1 < argc) {
+            debugDir = argv[++i];
+        } else if (! logPath) {
+            logPath = argv[i];
+        } else {
+            logPath = nullptr;
+            break;
+        }
+    }
+    if (! logPath) {
+        std::fprintf(stderr, "usage: %s [--root DIR] [--debug-dir DIR] LOG\n", argv[0]);
+        return 2;
+    }
+
+    TraceLogReader reader(logPath);
+    if (! reader.isOpen()) {
+        std::fprintf(stderr, "bktce_symbolize: %s is not a bktce trace log\n", logPath);
+        return 1;
+    }
+    //! one state per module: the log may record several modules at the
+    //! same addresses (one unloaded, the next loaded there), and a
+    //! state looks a PC up in every module it holds
+    std::map<std::uint32_t, backtrace_state*> states;
+
+    //! modules are added as their records show up, before the traces
+    //! that refer to them
+    std::size_t numAdded = 0;
+    TraceLogTrace trace;
+    while (reader.next(trace)) {
+        for (; numAdded < reader.modules().size(); ++numAdded) {
+            const TraceLogModule& module = reader.modules()[numAdded];
+            string_t path = root + module.m_path;
+            if (! debugDir.empty() && module.m_buildId.size() > 1) {
+                string_t id = hex(module.m_buildId);
+                string_t debugPath = debugDir + "/.build-id/" + id.substr(0, 2) + "/" + id.substr(2) + ".debug";
+                if (exists(debugPath)) {
+                    path = debugPath;
+                }
+            }
+            if (! exists(path)) {
+                //! e.g. linux-vdso.so.1, which has no file
+                std::fprintf(stderr, "bktce_symbolize: %s not found\n", path.c_str());
+                continue;
+            }
+            if (! module.m_buildId.empty() && readBuildId(path) != module.m_buildId) {
+                std::fprintf(stderr, "bktce_symbolize: warning: %s does not match build-id %s\n",
+                             path.c_str(), hex(module.m_buildId).c_str());
+            }
+            //! a state without modules would symbolize with this process'
+            //! own executable
+            backtrace_state* state = backtrace_create_state(nullptr, 0, &errorCallback, nullptr);
+            if (state && backtrace_add_module(state, path.c_str(), module.m_base, &errorCallback, nullptr)) {
+                states[module.m_index] = state;
+            }
+        }
+
+        std::printf("trace %llu:\n", static_cast<unsigned long long>(trace.m_tag));
+        for (std::size_t i = 0; i < trace.m_frames.size(); ++i) {
+            const TraceLogFrame& frame = trace.m_frames[i];
+            const TraceLogModule* module = reader.module(frame.m_module);
+            std::uintptr_t pc = module ? module->m_base + frame.m_offset : frame.m_offset;
+            auto it = module ? states.find(module->m_index) : states.end();
+            backtrace_state* state = it != states.end() ? it->second : nullptr;
+            std::vector<Location> locations;
+            if (state) {
+                backtrace_pcinfo(state, pc, &fullCallback, &errorCallback, &locations);
+            }
+            if (locations.empty()) {
+                string_t symbol;
+                if (state) {
+                    backtrace_syminfo(state, pc, &syminfoCallback, &errorCallback, &symbol);
+                }
+                std::printf("  %2zu# %#lx %s in %s+%#lx\n", i, static_cast<unsigned long>(pc),
+                            symbol.c_str(), module ? module->m_path.c_str() : "??",
+                            static_cast<unsigned long>(frame.m_offset));
+                continue;
+            }
+            //! libbacktrace reports the inlined calls first
+            for (std::size_t j = 0; j < locations.size(); ++j) {
+                const Location& location = locations[j];
+                std::printf("  %2zu# %#lx %s at %s:%d%s\n", i, static_cast<unsigned long>(pc),
+                            location.m_function.c_str(), location.m_filename.c_str(),
+                            location.m_lineNumber, j + 1 < locations.size() ? " (inlined)" : "");
+            }
+        }
+        if (trace.m_truncated) {
+            std::printf("  ... (truncated)\n");
+        }
+    }
+    if (reader.corrupted()) {
+        std::fprintf(stderr, "bktce_symbolize: %s is corrupted\n", logPath);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+
+#include "symbolizer.h"
+
+#include "loader.h"
+
+#include <backtrace.h>
+
+namespace {
+
+//! libbacktrace error callback used during warm-up;
+//! records whether the executable has debug info
+void warmUpErrorCallback(void* o_data, const char* /*not used*/, int i_errnum) {
+    //! errnum -1 means "no debug info", see backtrace.h
+    if (i_errnum == -1) {
+        *static_cast<bool_t *>(o_data) = false;
+    }
+}
+
+void stateErrorCallback(void* /*not used*/,
+                        const char* /*not used*/,
+                        int /*not used*/) {
+}
+
+int warmUpCallback(void* /*not used*/,
+                   uintptr_t /*not used*/,
+                   const char* /*not used*/,
+                   int /*not used*/,
+                   const char* /*not used*/) {
+    return 0;
+}
+
+}
+
+Symbolizer& Symbolizer::instance() {
+    static Symbolizer s_instance;
+    return s_instance;
+}
+
+Symbolizer::Symbolizer()
+ : m_state(backtrace_create_state(nullptr, 1, &stateErrorCallback, nullptr)),
+   m_generation(0) {
+}
+
+bool_t Symbolizer::warmUp(int i_threads) {
+    if (! m_state) {
+        return false;
+    }
+
+    //! the first lookup triggers fileline_initialize(), which reads the
+    //! executable and registers the loaded shared libraries; the address
+    //! of this function is as good as any other PC
+    bool_t hasDebugInfo = true;
+    backtrace_pcinfo(
+        m_state,
+        reinterpret_cast<uintptr_t>(&warmUpCallback),
+        &warmUpCallback,
+        &warmUpErrorCallback,
+        &hasDebugInfo
+    );
+    //! libbacktrace reads a shared library on the first lookup of one of
+    //! its PCs; read them all now
+    backtrace_load_modules_parallel(
+        m_state, i_threads, &stateErrorCallback, nullptr);
+    return hasDebugInfo;
+}
+
+backtrace_state* Symbolizer::state() const {
+    return m_state;
+}
+
+unsigned long long Symbolizer::generation() const {
+    return m_generation.load(std::memory_order_acquire);
+}
+
+bool_t Symbolizer::refreshModules() {
+    unsigned long long generation = loaderGeneration();
+    if (generation == m_generation.load(std::memory_order_acquire)) {
+        return false;
+    }
+    //! the state first: a lookup that reads the new generation must
+    //! not get the results of an unloaded library
+    if (m_state) {
+        backtrace_refresh_modules(m_state, &stateErrorCallback, nullptr);
+    }
+    m_generation.store(generation, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef _BKTCE_SYMBOLIZER_H
+#define _BKTCE_SYMBOLIZER_H
+
+#include "bktce.h"
+
+#include <atomic>
+
+struct backtrace_state;
+
+//! The process-wide owner of the libbacktrace state;
+//! libbacktrace parses the debug info of the executable and all its
+//! shared libraries when the state is first used, and it caches the
+//! DWARF tables inside the state; therefore the state must be created
+//! exactly once and shared by every Frame in the process;
+//! The state is created in threaded mode so that any number of threads
+//! can symbolize concurrently.
+//! DO NOT free/delete the state (its storage is managed by libbacktrace)
+class Symbolizer {
+public:
+    //! Returns the singleton; the state is created on the first call
+    //! (function-local static, hence thread-safe)
+    static Symbolizer& instance();
+
+    //! Forces libbacktrace to read the executable and the shared
+    //! libraries now rather than on the first captured trace;
+    //! Call this early (e.g. in main()) to take the initialization
+    //! cost out of the first trace;
+    //! With i_threads > 1 the shared libraries are read by that many
+    //! threads (see backtrace_load_modules_parallel()), which pays off
+    //! for programs that load many large libraries;
+    //! Returns false if libbacktrace can not read any debug info.
+    bool_t warmUp(int i_threads = 1);
+
+    //! Returns the shared libbacktrace state; nullptr if libbacktrace
+    //! failed to create it
+    backtrace_state* state() const;
+
+    //! The number of libraries the process had loaded and unloaded
+    //! (dlpi_adds + dlpi_subs) when the modules of the state were last
+    //! listed; an atomic load: the FrameCache entries are tagged with it
+    unsigned long long generation() const;
+
+    //! Lists the modules of the state again (backtrace_refresh_modules())
+    //! if libraries were loaded or unloaded since, then moves
+    //! generation(); one dl_iterate_phdr() step, which takes the
+    //! loader's lock: the lookups only call it on a FrameCache miss, so
+    //! call it after dlclose() before symbolizing the PCs of a library
+    //! that may have taken the addresses of the unloaded one;
+    //! Returns true if generation() moved.
+    bool_t refreshModules();
+
+private:
+    Symbolizer();
+    Symbolizer(const Symbolizer&) = delete;
+    Symbolizer& operator=(const Symbolizer&) = delete;
+
+    backtrace_state* m_state;
+    std::atomic<unsigned long long> m_generation;
+};
+
+#endif // _BKTCE_SYMBOLIZER_H
@@ -0,0 +1,113 @@
+#include <cassert>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "async_symbolizer.h"
+
+// AsyncSymbolizer must hand every trace it queued to the sink once,
+// symbolized, and in the order each producer queued them, also when
+// the queue wraps around many times
+
+void RunTinyTests();
+
+namespace {
+
+//! a tag: the producer in the high half, its count in the low half
+std::uint64_t tagOf(std::size_t i_producer, std::size_t i_count) {
+    return (static_cast<std::uint64_t>(i_producer) << 32) | i_count;
+}
+
+//! the size of the trace the tag goes with: some prefix of the stack
+std::size_t sizeOf(std::uint64_t i_tag, std::size_t i_stackSize) {
+    return 1 + (i_tag & 0xFFFFFFFF) % i_stackSize;
+}
+
+//! keeps what it receives, on the worker thread
+class RecordingSink : public TraceSink {
+public:
+    explicit RecordingSink(const RawStacktrace<16>& i_stack)
+     : m_stack(i_stack),
+       m_numMismatches(0) {
+    }
+
+    void write(std::uint64_t i_tag, const Stacktrace& i_stack) override {
+        m_tags.push_back(i_tag);
+        const std::vector<Frame>& frames = i_stack.getFrames();
+        if (frames.size() != sizeOf(i_tag, m_stack.size())) {
+            m_numMismatches += 1;
+            return;
+        }
+        for (std::size_t i = 0; i < frames.size(); ++i) {
+            if (frames[i].get() != m_stack.begin()[i] || ! frames[i].isResolved()) {
+                m_numMismatches += 1;
+                return;
+            }
+        }
+    }
+
+    const RawStacktrace<16>& m_stack;
+    std::vector<std::uint64_t> m_tags;
+    std::size_t m_numMismatches;
+};
+
+}
+
+void test_delivered_once_and_in_order() {
+    RawStacktrace<16> stack(0);
+    assert(stack.size() > 0);
+    RecordingSink sink(stack);
+    const std::size_t numTraces = 1000;
+    {
+        AsyncSymbolizer symbolizer(sink, 8, OverflowPolicy::Block);
+        for (std::size_t i = 0; i < numTraces; ++i) {
+            std::uint64_t tag = tagOf(0, i);
+            assert(symbolizer.push(stack.begin(), sizeOf(tag, stack.size()), false, tag));
+        }
+        symbolizer.flush();
+        assert(symbolizer.delivered() == numTraces);
+        assert(symbolizer.dropped() == 0);
+    }
+    assert(sink.m_tags.size() == numTraces);
+    for (std::size_t i = 0; i < numTraces; ++i) {
+        assert(sink.m_tags[i] == tagOf(0, i));
+    }
+    assert(sink.m_numMismatches == 0);
+}
+
+void test_delivered_in_order_of_each_producer() {
+    RawStacktrace<16> stack(0);
+    RecordingSink sink(stack);
+    const std::size_t numProducers = 4;
+    const std::size_t numTraces = 500;
+    {
+        AsyncSymbolizer symbolizer(sink, 8, OverflowPolicy::Block);
+        std::vector<std::thread> producers;
+        for (std::size_t p = 0; p < numProducers; ++p) {
+            producers.emplace_back([&, p]() {
+                for (std::size_t i = 0; i < numTraces; ++i) {
+                    std::uint64_t tag = tagOf(p, i);
+                    symbolizer.push(stack.begin(), sizeOf(tag, stack.size()), false, tag);
+                }
+            });
+        }
+        for (std::thread& producer : producers) {
+            producer.join();
+        }
+        //! the destructor delivers what is still queued
+    }
+    assert(sink.m_tags.size() == numProducers * numTraces);
+    std::vector<std::size_t> next(numProducers, 0);
+    for (std::uint64_t tag : sink.m_tags) {
+        std::size_t producer = static_cast<std::size_t>(tag >> 32);
+        assert(producer < numProducers);
+        assert((tag & 0xFFFFFFFF) == next[producer]);
+        next[producer] += 1;
+    }
+    assert(sink.m_numMismatches == 0);
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <cassert>
+#include <cstdint>
+
+#include "bktce.h"
+#include "cfi_unwinder.h"
+#include "raw_stacktrace.h"
+
+// CfiUnwinder against _Unwind_Backtrace, on the stacks of callee_libbt:
+// its sut() calls simple_backtrace() from the lambdas it passes to the
+// standard algorithms; this test defines simple_backtrace() (it does
+// not link bktce itself, it uses the copy in callee_libbt), and the
+// library's calls, made through the PLT, are bound to it
+
+void RunTinyTests();
+
+void sut();
+
+namespace {
+
+struct Comparison {
+    std::size_t m_numTraces = 0;
+    std::size_t m_numMismatches = 0;
+    //! the captures CfiUnwinder could not finish on its own
+    std::size_t m_numFallbacks = 0;
+};
+
+Comparison s_comparison;
+
+const std::size_t s_capacity = 128;
+
+}
+
+void simple_backtrace() {
+    native_frame_ptr_t expected[s_capacity];
+    native_frame_ptr_t actual[s_capacity];
+    std::size_t numExpected = unwindStackCfi(expected, s_capacity, 0, nullptr);
+
+    CfiUnwinder& unwinder = CfiUnwinder::instance();
+    std::uint64_t numSteps = unwinder.hits() + unwinder.misses();
+    std::size_t numActual = unwindStackCachedCfi(actual, s_capacity, 0, nullptr);
+    numSteps = unwinder.hits() + unwinder.misses() - numSteps;
+
+    //! a walk that reaches the outermost frame steps through every
+    //! recorded frame and unwindStackCachedCfi() itself
+    s_comparison.m_numTraces += 1;
+    if (numSteps <= numActual) {
+        s_comparison.m_numFallbacks += 1;
+    }
+    //! frame 0 is this function, at two different call sites
+    if (numActual != numExpected) {
+        s_comparison.m_numMismatches += 1;
+        return;
+    }
+    for (std::size_t i = 1; i < numActual; ++i) {
+        if (actual[i] != expected[i]) {
+            s_comparison.m_numMismatches += 1;
+            return;
+        }
+    }
+}
+
+void test_same_frames_as_unwind_backtrace() {
+#if defined(__x86_64__)
+    s_comparison = Comparison();
+    sut();
+    assert(s_comparison.m_numTraces > 0);
+    assert(s_comparison.m_numMismatches == 0);
+    assert(s_comparison.m_numFallbacks == 0);
+#endif
+}
+
+void test_same_frames_from_the_cache() {
+#if defined(__x86_64__)
+    CfiUnwinder& unwinder = CfiUnwinder::instance();
+    s_comparison = Comparison();
+    //! the second run only meets PCs the first one cached (sut() is
+    //! called from the same call site), the third computes their rules
+    //! again after a refresh
+    std::uint64_t numMisses[3];
+    for (int i = 0; i < 3; ++i) {
+        if (i == 2) {
+            unwinder.refresh();
+        }
+        numMisses[i] = unwinder.misses();
+        sut();
+        numMisses[i] = unwinder.misses() - numMisses[i];
+    }
+    assert(numMisses[1] == 0 && numMisses[2] > 0);
+    assert(s_comparison.m_numMismatches == 0);
+    assert(s_comparison.m_numFallbacks == 0);
+#endif
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <cassert>
+#include <cstring>
+
+#include "demangle.h"
+
+// Demangler::shortName() on the names __cxa_demangle prints
+
+void RunTinyTests();
+
+namespace {
+
+bool_t shortNameIs(const char* i_demangled, const char* i_expected) {
+    char name[256];
+    std::size_t n = Demangler::shortName(i_demangled, name, sizeof(name));
+    return n == std::strlen(i_expected) && std::strcmp(name, i_expected) == 0;
+}
+
+}
+
+void test_functions() {
+    assert(shortNameIs("main", "main"));
+    assert(shortNameIs("foo(int, char const*)", "foo"));
+    assert(shortNameIs("ns::Foo<int>::bar(std::vector<int, std::allocator<int> > const&) const",
+                       "ns::Foo::bar"));
+    assert(shortNameIs("(anonymous namespace)::helper(int)", "(anonymous namespace)::helper"));
+    assert(shortNameIs("foo(int) [clone .constprop.0]", "foo"));
+    assert(shortNameIs("vtable for ns::Foo", "ns::Foo"));
+}
+
+void test_return_types() {
+    assert(shortNameIs("void foo<int>(int)", "foo"));
+    assert(shortNameIs("std::basic_ostream<char, std::char_traits<char> >& "
+                       "std::operator<< <std::char_traits<char> >(std::basic_ostream<char, "
+                       "std::char_traits<char> >&, char const*)",
+                       "std::operator<<"));
+    assert(shortNameIs("int (*foo())(int)", "foo"));
+    assert(shortNameIs("int (*(*ns::foo(char))(int))(double)", "ns::foo"));
+    assert(shortNameIs("decltype ({parm#1}+{parm#2}) add<int, int>(int, int)", "add"));
+}
+
+void test_operators() {
+    assert(shortNameIs("operator new(unsigned long)", "operator new"));
+    assert(shortNameIs("operator delete[](void*)", "operator delete[]"));
+    assert(shortNameIs("Foo::operator bool() const", "Foo::operator bool"));
+    assert(shortNameIs("Foo::operator unsigned long() const", "Foo::operator unsigned long"));
+    assert(shortNameIs("Foo::operator()(int) const", "Foo::operator()"));
+    assert(shortNameIs("Foo::operator<(Foo const&) const", "Foo::operator<"));
+    assert(shortNameIs("bool operator< <int>(Foo<int> const&, Foo<int> const&)", "operator<"));
+    assert(shortNameIs("Foo::operator->() const", "Foo::operator->"));
+    assert(shortNameIs("operator\"\" _km(unsigned long long)", "operator\"\" _km"));
+    assert(shortNameIs("cooperator(int)", "cooperator"));
+}
+
+void test_local_entities() {
+    assert(shortNameIs("generator(int&, std::map<int, int>&)::{lambda(int&)#2}::operator()(int&) const",
+                       "generator::{lambda(int&)#2}::operator()"));
+    assert(shortNameIs("foo(int)::Local::bar()", "foo::Local::bar"));
+}
+
+void test_truncation() {
+    char name[8];
+    assert(Demangler::shortName("ns::function(int)", name, sizeof(name)) == 7);
+    assert(std::strcmp(name, "ns::fun") == 0);
+    assert(Demangler::shortName("foo()", name, 0) == 0);
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "bktce.h"
+#include "symbolizer.h"
+#include "trace_log.h"
+
+#include <backtrace.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+// a library unloaded with dlclose() and another one loaded at its
+// addresses with dlopen(): the lookups must report the new one, not
+// the debug info or the cached results of the old one
+// BKTCE_TEST_PLUGIN_A and BKTCE_TEST_PLUGIN_B are the paths of
+// test_plugin_a.cpp and test_plugin_b.cpp, BKTCE_TEST_PLUGIN_DWARF5
+// that of test_plugin_a.cpp with DWARF 5 debug info, see
+// CMakeLists.txt
+
+void RunTinyTests();
+
+namespace {
+
+using PluginFn = int (*)(int);
+
+struct Plugin {
+    explicit Plugin(const char* i_path)
+     : m_handle(dlopen(i_path, RTLD_NOW | RTLD_LOCAL)),
+       m_fn(nullptr) {
+        assert(m_handle);
+        m_fn = reinterpret_cast<PluginFn>(dlsym(m_handle, "plugin_fn"));
+        assert(m_fn);
+    }
+
+    ~Plugin() {
+        close();
+    }
+
+    void close() {
+        if (m_handle) {
+            dlclose(m_handle);
+            m_handle = nullptr;
+        }
+    }
+
+    uintptr_t pc() const {
+        return reinterpret_cast<uintptr_t>(m_fn);
+    }
+
+    void* m_handle;
+    PluginFn m_fn;
+};
+
+void errorCallback(void*, const char*, int) {
+}
+
+int fullCallback(void* o_data, uintptr_t, const char* i_filename, int, const char*) {
+    if (i_filename) {
+        *static_cast<std::string *>(o_data) = i_filename;
+    }
+    return 0;
+}
+
+std::string sourceOf(backtrace_state* i_state, uintptr_t i_pc) {
+    std::string filename;
+    backtrace_pcinfo(i_state, i_pc, &fullCallback, &errorCallback, &filename);
+    return filename;
+}
+
+void syminfoCallback(void* o_data, uintptr_t, const char* i_symbol, uintptr_t, uintptr_t) {
+    if (i_symbol) {
+        *static_cast<std::string *>(o_data) = i_symbol;
+    }
+}
+
+std::string symbolOf(backtrace_state* i_state, uintptr_t i_pc) {
+    std::string symbol;
+    backtrace_syminfo(i_state, i_pc, &syminfoCallback, &errorCallback, &symbol);
+    return symbol;
+}
+
+bool endsWith(const std::string& i_s, const char* i_suffix) {
+    std::size_t n = std::strlen(i_suffix);
+    return i_s.size() >= n && i_s.compare(i_s.size() - n, n, i_suffix) == 0;
+}
+
+}
+
+void test_pcinfo_after_reload() {
+    backtrace_state* state = backtrace_create_state(nullptr, 1, &errorCallback, nullptr);
+    assert(state);
+
+    Plugin a(BKTCE_TEST_PLUGIN_A);
+    assert(endsWith(sourceOf(state, a.pc()), "test_plugin_a.cpp"));
+    a.close();
+
+    //! a PC of b the state has never looked up, and one a looked up
+    Plugin b(BKTCE_TEST_PLUGIN_B);
+    assert(backtrace_refresh_modules(state, &errorCallback, nullptr) == 1);
+    assert(endsWith(sourceOf(state, b.pc() + 1), "test_plugin_b.cpp"));
+    assert(endsWith(sourceOf(state, b.pc()), "test_plugin_b.cpp"));
+}
+
+void test_memory_of_unloaded_library() {
+    backtrace_state* state = backtrace_create_state(nullptr, 1, &errorCallback, nullptr);
+    assert(state);
+
+    //! a and b take turns at the same addresses, so each one loaded is
+    //! read again; the first rounds map the memory of the state itself
+    auto reload = [state](int i_rounds) {
+        for (int i = 0; i < i_rounds; ++i) {
+            Plugin a(BKTCE_TEST_PLUGIN_A);
+            backtrace_refresh_modules(state, &errorCallback, nullptr);
+            assert(endsWith(sourceOf(state, a.pc()), "test_plugin_a.cpp"));
+            a.close();
+            Plugin b(BKTCE_TEST_PLUGIN_B);
+            backtrace_refresh_modules(state, &errorCallback, nullptr);
+            assert(endsWith(sourceOf(state, b.pc()), "test_plugin_b.cpp"));
+        }
+        backtrace_stats stats;
+        backtrace_get_stats(state, &stats);
+        return stats.alloc_mapped_bytes - stats.alloc_unmapped_bytes;
+    };
+    std::size_t warm = reload(4);
+    std::size_t after = reload(32);
+    //! what was read from each library went away with it: the memory
+    //! kept is less than a page per library loaded
+    assert(after < warm + 64 * 4096);
+}
+
+void test_syminfo_without_dwarf() {
+    backtrace_state* state = backtrace_create_state(nullptr, 1, &errorCallback, nullptr);
+    assert(state);
+
+    //! reading the debug info fails once the symbols are published:
+    //! the symbol names must stay readable
+    Plugin dwarf5(BKTCE_TEST_PLUGIN_DWARF5);
+    sourceOf(state, dwarf5.pc());
+    assert(symbolOf(state, dwarf5.pc()) == "plugin_fn");
+}
+
+void test_frozen_lookups() {
+    backtrace_state* state = backtrace_create_state(nullptr, 1, &errorCallback, nullptr);
+    assert(state);
+    assert(backtrace_load_modules(state, &errorCallback, nullptr));
+
+    //! a frozen thread does not look for the libraries loaded since
+    Plugin a(BKTCE_TEST_PLUGIN_A);
+    assert(backtrace_freeze_modules(1) == 0);
+    assert(sourceOf(state, a.pc()).empty());
+    assert(backtrace_freeze_modules(0) == 1);
+    assert(endsWith(sourceOf(state, a.pc()), "test_plugin_a.cpp"));
+}
+
+void test_trace_log_after_reload() {
+    char path[] = "/tmp/test_dlopen_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    {
+        TraceLogWriter writer(path);
+        assert(writer.isOpen());
+        Plugin a(BKTCE_TEST_PLUGIN_A);
+        native_frame_ptr_t frame = reinterpret_cast<native_frame_ptr_t>(a.pc());
+        assert(writer.write(&frame, 1, false, 1));
+        a.close();
+
+        //! b's PC is in the range recorded for a
+        Plugin b(BKTCE_TEST_PLUGIN_B);
+        frame = reinterpret_cast<native_frame_ptr_t>(b.pc());
+        assert(writer.write(&frame, 1, false, 2));
+    }
+
+    TraceLogReader reader(path);
+    assert(reader.isOpen());
+    TraceLogTrace trace;
+    const char* expected[] = {BKTCE_TEST_PLUGIN_A, BKTCE_TEST_PLUGIN_B};
+    for (const char* plugin : expected) {
+        assert(reader.next(trace));
+        assert(trace.m_frames.size() == 1);
+        const TraceLogModule* module = reader.module(trace.m_frames[0].m_module);
+        assert(module && module->m_path == plugin);
+    }
+    assert(! reader.next(trace) && ! reader.corrupted());
+    unlink(path);
+}
+
+void test_frame_cache_after_reload() {
+    Plugin a(BKTCE_TEST_PLUGIN_A);
+    native_frame_ptr_t pc = reinterpret_cast<native_frame_ptr_t>(a.pc());
+    assert(endsWith(string_t(Frame(pc).getSourceFilename()), "test_plugin_a.cpp"));
+    a.close();
+
+    //! the same PC, now in b; the lookups of a cached PC do not ask
+    //! the loader whether its library is still there
+    Plugin b(BKTCE_TEST_PLUGIN_B);
+    assert(Symbolizer::instance().refreshModules());
+    if (reinterpret_cast<native_frame_ptr_t>(b.pc()) != pc) {
+        //! the loader put b elsewhere: no stale entry to check
+        assert(endsWith(string_t(Frame(reinterpret_cast<native_frame_ptr_t>(b.pc())).getSourceFilename()),
+                        "test_plugin_b.cpp"));
+        return;
+    }
+    assert(endsWith(string_t(Frame(pc).getSourceFilename()), "test_plugin_b.cpp"));
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "format.h"
+
+#include <unistd.h>
+
+// writeStacktrace() must write what formatStacktrace() formats, also
+// when the trace takes more than one batch of writes
+
+void RunTinyTests();
+
+namespace {
+
+std::string formatted(const Stacktrace& i_stack, FrameFormat i_format) {
+    std::size_t length = formatStacktrace(i_stack, i_format, nullptr, 0);
+    std::string text(length + 1, '\0');
+    formatStacktrace(i_stack, i_format, &text[0], text.size());
+    text.resize(length);
+    return text;
+}
+
+std::string written(const Stacktrace& i_stack, FrameFormat i_format) {
+    std::FILE* file = std::tmpfile();
+    assert(file);
+    int fd = fileno(file);
+    assert(writeStacktrace(fd, i_stack, i_format));
+    std::string text;
+    char buffer[4096];
+    ssize_t n;
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, static_cast<std::size_t>(n));
+    }
+    std::fclose(file);
+    return text;
+}
+
+}
+
+void test_write_long_trace() {
+    //! 4 pieces and 2 numbers per frame: many batches, and the scratch
+    //! area fills up several times
+    std::vector<native_frame_ptr_t> frames;
+    for (std::size_t i = 1; i <= 500; ++i) {
+        frames.push_back(reinterpret_cast<native_frame_ptr_t>(0x400000 + i * 0x1234));
+    }
+    Stacktrace stack(frames.data(), frames.data() + frames.size(), true);
+    assert(written(stack, FrameFormat::Addresses) == formatted(stack, FrameFormat::Addresses));
+}
+
+void test_write_symbolized_trace() {
+    Stacktrace stack;
+    stack.resolve();
+    assert(written(stack, FrameFormat::Short) == formatted(stack, FrameFormat::Short));
+    assert(written(stack, FrameFormat::Full) == formatted(stack, FrameFormat::Full));
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "heap_profiler.h"
+
+// HeapProfiler's estimate of the live bytes against the bytes actually
+// allocated; the test calls the allocator hooks itself (it does not
+// link bktce_heapprof) with made-up pointers, which the profiler never
+// dereferences
+
+void RunTinyTests();
+
+namespace {
+
+const std::size_t s_samplingInterval = 64 * 1024;
+
+struct Block {
+    void* m_ptr;
+    std::size_t m_size;
+};
+
+//! i_count blocks of 64 bytes to 64 KiB, at addresses no other block
+//! of the test uses
+std::vector<Block> allocate(std::size_t i_count, std::uintptr_t i_base) {
+    HeapProfiler& profiler = HeapProfiler::instance();
+    std::vector<Block> blocks;
+    blocks.reserve(i_count);
+    for (std::size_t i = 0; i < i_count; ++i) {
+        Block block;
+        block.m_size = std::size_t(64) << (i % 11);
+        block.m_ptr = reinterpret_cast<void *>(i_base + i * 128 * 1024);
+        profiler.onAlloc(block.m_ptr, block.m_size);
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+bool_t within(double i_estimate, double i_actual, double i_tolerance) {
+    return std::abs(i_estimate - i_actual) <= i_tolerance * i_actual;
+}
+
+}
+
+void test_live_bytes_within_tolerance() {
+    HeapProfiler& profiler = HeapProfiler::instance();
+    profiler.start(s_samplingInterval);
+    std::int64_t baseline = profiler.liveBytes();
+    std::uint64_t dropped = profiler.dropped();
+
+    //! about 4000 samples: the standard deviation of the estimate is
+    //! about 1% of the bytes
+    std::vector<Block> blocks = allocate(32768, 0x100000000000ULL);
+    double allocated = 0.0;
+    for (const Block& block : blocks) {
+        allocated += static_cast<double>(block.m_size);
+    }
+    assert(within(static_cast<double>(profiler.liveBytes() - baseline), allocated, 0.15));
+
+    //! freeing every other block frees about half the bytes
+    double live = allocated;
+    for (std::size_t i = 0; i < blocks.size(); i += 2) {
+        profiler.onFree(blocks[i].m_ptr);
+        live -= static_cast<double>(blocks[i].m_size);
+    }
+    assert(within(static_cast<double>(profiler.liveBytes() - baseline), live, 0.15));
+
+    //! a free takes back exactly what the sample of its block added
+    for (std::size_t i = 1; i < blocks.size(); i += 2) {
+        profiler.onFree(blocks[i].m_ptr);
+    }
+    assert(profiler.liveBytes() == baseline);
+    assert(profiler.dropped() == dropped);
+    profiler.stop();
+}
+
+void test_frees_while_stopped_are_accounted_for() {
+    HeapProfiler& profiler = HeapProfiler::instance();
+    profiler.start(s_samplingInterval);
+    std::int64_t baseline = profiler.liveBytes();
+    std::vector<Block> blocks = allocate(8192, 0x200000000000ULL);
+    assert(profiler.liveBytes() > baseline);
+
+    profiler.stop();
+    for (const Block& block : blocks) {
+        profiler.onFree(block.m_ptr);
+    }
+    assert(profiler.liveBytes() == baseline);
+
+    //! nothing is sampled while stopped
+    blocks = allocate(8192, 0x300000000000ULL);
+    assert(profiler.liveBytes() == baseline);
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
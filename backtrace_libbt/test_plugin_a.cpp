@@ -0,0 +1,7 @@
+// a plugin test_dlopen loads, unloads, then replaces with
+// test_plugin_b.cpp; both have the same layout so that the loader
+// tends to map the second one where the first one was
+
+extern "C" int plugin_fn(int i_value) {
+    return i_value * 3 + 1;
+}
@@ -0,0 +1,5 @@
+// see test_plugin_a.cpp
+
+extern "C" int plugin_fn(int i_value) {
+    return i_value * 5 + 2;
+}
@@ -0,0 +1,126 @@
+#include <cassert>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "stack_depot.h"
+
+// StackDepot::put() must hand out one id per distinct stack and keep
+// returning it, however many stacks are stored after it
+
+void RunTinyTests();
+
+namespace {
+
+const std::size_t s_depth = 8;
+
+//! a made-up stack, distinct for every i_seed
+std::vector<native_frame_ptr_t> stackOf(std::size_t i_seed) {
+    std::vector<native_frame_ptr_t> frames(s_depth);
+    for (std::size_t i = 0; i < s_depth; ++i) {
+        frames[i] = reinterpret_cast<native_frame_ptr_t>(
+            static_cast<std::uintptr_t>(0x400000 + i_seed * 0x1000 + i * 0x10));
+    }
+    return frames;
+}
+
+bool_t storedAs(const StackDepot& i_depot, stack_id_t i_id,
+                const std::vector<native_frame_ptr_t>& i_frames) {
+    std::size_t size = 0;
+    const native_frame_ptr_t* frames = i_depot.get(i_id, size);
+    if (! frames || size != i_frames.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < size; ++i) {
+        if (frames[i] != i_frames[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+void test_ids_stay_stable_across_inserts() {
+    const std::size_t numStacks = 1000;
+    StackDepot depot(numStacks, numStacks * s_depth);
+    std::vector<stack_id_t> ids;
+    for (std::size_t i = 0; i < numStacks / 2; ++i) {
+        std::vector<native_frame_ptr_t> frames = stackOf(i);
+        ids.push_back(depot.put(frames.data(), frames.size()));
+        assert(ids.back() != 0);
+    }
+
+    //! every new stack stored after them leaves the first ids alone
+    for (std::size_t i = numStacks / 2; i < numStacks; ++i) {
+        std::vector<native_frame_ptr_t> frames = stackOf(i);
+        stack_id_t id = depot.put(frames.data(), frames.size());
+        assert(id != 0);
+        for (stack_id_t old : ids) {
+            assert(id != old);
+        }
+        std::vector<native_frame_ptr_t> first = stackOf(i - numStacks / 2);
+        assert(depot.put(first.data(), first.size()) == ids[i - numStacks / 2]);
+        ids.push_back(id);
+    }
+    assert(depot.size() == numStacks);
+
+    for (std::size_t i = 0; i < numStacks; ++i) {
+        std::vector<native_frame_ptr_t> frames = stackOf(i);
+        assert(depot.put(frames.data(), frames.size()) == ids[i]);
+        assert(storedAs(depot, ids[i], frames));
+    }
+    assert(depot.size() == numStacks);
+
+    //! a full depot turns new stacks away, not the ones it has
+    std::vector<native_frame_ptr_t> extra = stackOf(numStacks);
+    assert(depot.put(extra.data(), extra.size()) == 0);
+    std::vector<native_frame_ptr_t> first = stackOf(0);
+    assert(depot.put(first.data(), first.size()) == ids[0]);
+}
+
+void test_truncated_is_a_different_stack() {
+    StackDepot depot(16, 16 * s_depth);
+    std::vector<native_frame_ptr_t> frames = stackOf(1);
+    stack_id_t complete = depot.put(frames.data(), frames.size());
+    stack_id_t truncated = depot.put(frames.data(), frames.size(), true);
+    assert(complete != 0 && truncated != 0 && complete != truncated);
+    assert(! depot.truncated(complete));
+    assert(depot.truncated(truncated));
+    assert(depot.put(frames.data(), frames.size(), true) == truncated);
+    assert(depot.put(frames.data(), frames.size() - 1) != complete);
+}
+
+void test_same_ids_from_every_thread() {
+    const std::size_t numStacks = 256;
+    const std::size_t numThreads = 8;
+    StackDepot depot(numStacks, numStacks * s_depth);
+    std::vector<std::vector<stack_id_t>> ids(numThreads, std::vector<stack_id_t>(numStacks));
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            //! each thread goes through the stacks in its own order
+            for (std::size_t n = 0; n < numStacks; ++n) {
+                std::size_t i = (n * 37 + t * 11) % numStacks;
+                std::vector<native_frame_ptr_t> frames = stackOf(i);
+                ids[t][i] = depot.put(frames.data(), frames.size());
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    assert(depot.size() == numStacks);
+    for (std::size_t i = 0; i < numStacks; ++i) {
+        assert(ids[0][i] != 0);
+        for (std::size_t t = 1; t < numThreads; ++t) {
+            assert(ids[t][i] == ids[0][i]);
+        }
+        assert(storedAs(depot, ids[0][i], stackOf(i)));
+    }
+}
+
+int main() {
+    RunTinyTests();
+    return 0;
+}
@@ -0,0 +1,385 @@
+
+#include "trace_log.h"
+
+#include "loader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char s_magic[8] = {'B', 'K', 'T', 'C', 'E', 'L', 'O', 'G'};
+const std::uint8_t s_version = 1;
+const std::uint8_t s_moduleRecord = 'M';
+const std::uint8_t s_traceRecord = 'T';
+const std::uint8_t s_truncatedFlag = 1;
+
+std::uint8_t* putVarint(std::uint8_t* o_p, std::uint64_t i_value) {
+    while (i_value >= 0x80) {
+        *o_p++ = static_cast<std::uint8_t>(i_value | 0x80);
+        i_value >>= 7;
+    }
+    *o_p++ = static_cast<std::uint8_t>(i_value);
+    return o_p;
+}
+
+bool_t getVarint(const std::uint8_t*& io_p, const std::uint8_t* i_end, std::uint64_t& o_value) {
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; io_p < i_end && shift < 64; shift += 7) {
+        std::uint8_t byte = *io_p++;
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (! (byte & 0x80)) {
+            o_value = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::uint64_t zigzag(std::int64_t i_value) {
+    return (static_cast<std::uint64_t>(i_value) << 1) ^ static_cast<std::uint64_t>(i_value >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t i_value) {
+    return static_cast<std::int64_t>(i_value >> 1) ^ -static_cast<std::int64_t>(i_value & 1);
+}
+
+//! writes the whole buffer; O_APPEND makes each write(2) one atomic append
+bool_t writeAll(int i_fd, const std::uint8_t* i_begin, std::size_t i_size) {
+    return ::write(i_fd, i_begin, i_size) == static_cast<ssize_t>(i_size);
+}
+
+//! a module as seen by dl_iterate_phdr
+struct LoadedModule {
+    std::uintptr_t m_begin;
+    std::uintptr_t m_end;
+    std::uintptr_t m_base;
+    string_t m_path;
+    std::vector<std::uint8_t> m_buildId;
+};
+
+std::vector<std::uint8_t> buildIdOf(const dl_phdr_info* i_info) {
+    for (ElfW(Half) i = 0; i < i_info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& phdr = i_info->dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE) {
+            continue;
+        }
+        const std::uint8_t* p = reinterpret_cast<const std::uint8_t *>(i_info->dlpi_addr + phdr.p_vaddr);
+        const std::uint8_t* end = p + phdr.p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* note = reinterpret_cast<const ElfW(Nhdr) *>(p);
+            const std::uint8_t* name = p + sizeof(ElfW(Nhdr));
+            const std::uint8_t* desc = name + ((note->n_namesz + 3) & ~3u);
+            if (note->n_type == NT_GNU_BUILD_ID
+                && note->n_namesz == 4
+                && std::memcmp(name, "GNU", 4) == 0
+                && desc + note->n_descsz <= end) {
+                return std::vector<std::uint8_t>(desc, desc + note->n_descsz);
+            }
+            p = desc + ((note->n_descsz + 3) & ~3u);
+        }
+    }
+    return std::vector<std::uint8_t>();
+}
+
+int collectModule(dl_phdr_info* i_info, size_t, void* o_modules) {
+    LoadedModule module;
+    module.m_begin = ~static_cast<std::uintptr_t>(0);
+    module.m_end = 0;
+    module.m_base = i_info->dlpi_addr;
+    for (ElfW(Half) i = 0; i < i_info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& phdr = i_info->dlpi_phdr[i];
+        if (phdr.p_type == PT_LOAD) {
+            std::uintptr_t begin = i_info->dlpi_addr + phdr.p_vaddr;
+            module.m_begin = std::min(module.m_begin, begin);
+            module.m_end = std::max(module.m_end, begin + phdr.p_memsz);
+        }
+    }
+    if (module.m_begin >= module.m_end) {
+        return 0;
+    }
+    if (i_info->dlpi_name && i_info->dlpi_name[0]) {
+        module.m_path = i_info->dlpi_name;
+    } else {
+        //! the main executable
+        char path[4096];
+        ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (size > 0) {
+            module.m_path.assign(path, size);
+        }
+    }
+    module.m_buildId = buildIdOf(i_info);
+    static_cast<std::vector<LoadedModule> *>(o_modules)->push_back(module);
+    return 0;
+}
+
+}
+
+TraceLogWriter::TraceLogWriter(const char* i_path)
+ : m_fd(open(i_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)),
+   m_modules(new ModuleTable),
+   m_loadGeneration(0) {
+    if (m_fd < 0) {
+        return;
+    }
+    std::uint8_t header[sizeof(s_magic) + 1];
+    std::memcpy(header, s_magic, sizeof(s_magic));
+    header[sizeof(s_magic)] = s_version;
+    if (! writeAll(m_fd, header, sizeof(header))) {
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    refreshModules();
+}
+
+TraceLogWriter::~TraceLogWriter() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    delete m_modules.load();
+    for (const ModuleTable* table : m_retired) {
+        delete table;
+    }
+}
+
+bool_t TraceLogWriter::isOpen() const {
+    return m_fd >= 0;
+}
+
+void TraceLogWriter::refreshModules() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd < 0) {
+        return;
+    }
+    m_loadGeneration.store(loaderGeneration());
+    std::vector<LoadedModule> loaded;
+    dl_iterate_phdr(&collectModule, &loaded);
+
+    ModuleTable* table = new ModuleTable;
+    std::vector<std::uint8_t> record;
+    for (const LoadedModule& module : loaded) {
+        auto key = std::make_pair(module.m_base, module.m_path);
+        auto it = m_recorded.find(key);
+        if (it == m_recorded.end()) {
+            std::uint32_t index = static_cast<std::uint32_t>(m_recorded.size() + 1);
+            it = m_recorded.emplace(key, index).first;
+
+            record.resize(1 + 5 * 10 + module.m_buildId.size() + module.m_path.size());
+            std::uint8_t* p = record.data();
+            *p++ = s_moduleRecord;
+            p = putVarint(p, index);
+            p = putVarint(p, module.m_base);
+            p = putVarint(p, module.m_end - module.m_begin);
+            p = putVarint(p, module.m_buildId.size());
+            std::memcpy(p, module.m_buildId.data(), module.m_buildId.size());
+            p += module.m_buildId.size();
+            p = putVarint(p, module.m_path.size());
+            std::memcpy(p, module.m_path.data(), module.m_path.size());
+            p += module.m_path.size();
+            writeAll(m_fd, record.data(), p - record.data());
+        }
+        table->m_modules.push_back({module.m_begin, module.m_end, module.m_base, it->second});
+    }
+    std::sort(table->m_modules.begin(), table->m_modules.end(),
+              [](const Module& lhs, const Module& rhs) {
+                  return lhs.m_begin < rhs.m_begin;
+              });
+    m_retired.push_back(m_modules.exchange(table, std::memory_order_acq_rel));
+}
+
+const TraceLogWriter::Module* TraceLogWriter::findModule(std::uintptr_t i_pc) const {
+    const std::vector<Module>& modules = m_modules.load(std::memory_order_acquire)->m_modules;
+    auto it = std::upper_bound(modules.begin(), modules.end(), i_pc,
+                               [](std::uintptr_t i_value, const Module& i_module) {
+                                   return i_value < i_module.m_begin;
+                               });
+    if (it == modules.begin()) {
+        return nullptr;
+    }
+    --it;
+    return i_pc < it->m_end ? &*it : nullptr;
+}
+
+bool_t TraceLogWriter::write(const native_frame_ptr_t* i_begin,
+                             std::size_t i_size,
+                             bool_t i_truncated,
+                             std::uint64_t i_tag) {
+    if (m_fd < 0) {
+        return false;
+    }
+    if (i_size > s_maxFrames) {
+        i_size = s_maxFrames;
+        i_truncated = true;
+    }
+
+    //! tag, flags, count and two varints per frame
+    std::uint8_t buffer[1 + 10 + 1 + 10 + s_maxFrames * (5 + 10)];
+    std::uint8_t* p = buffer;
+    *p++ = s_traceRecord;
+    p = putVarint(p, i_tag);
+    *p++ = i_truncated ? s_truncatedFlag : 0;
+    p = putVarint(p, i_size);
+
+    //! a library unloaded since the last scan may have left its
+    //! addresses to another one: a PC found in the table is not enough
+    if (loaderGeneration() != m_loadGeneration.load()) {
+        refreshModules();
+    }
+
+    std::uint32_t previousModule = 0;
+    std::uintptr_t previousOffset = 0;
+    for (std::size_t i = 0; i < i_size; ++i) {
+        std::uintptr_t pc = reinterpret_cast<std::uintptr_t>(i_begin[i]);
+        const Module* module = findModule(pc);
+        std::uint32_t index = module ? module->m_index : 0;
+        std::uintptr_t offset = module ? pc - module->m_base : pc;
+        std::int64_t delta = static_cast<std::int64_t>(offset);
+        if (index && index == previousModule) {
+            delta = static_cast<std::int64_t>(offset - previousOffset);
+        }
+        p = putVarint(p, index);
+        p = putVarint(p, zigzag(delta));
+        previousModule = index;
+        previousOffset = offset;
+    }
+    return writeAll(m_fd, buffer, p - buffer);
+}
+
+TraceLogReader::TraceLogReader(const char* i_path)
+ : m_begin(nullptr),
+   m_end(nullptr),
+   m_current(nullptr),
+   m_mappedSize(0),
+   m_corrupted(false) {
+    int fd = open(i_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > static_cast<off_t>(sizeof(s_magic))) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            m_begin = static_cast<const std::uint8_t *>(p);
+            m_mappedSize = st.st_size;
+            m_end = m_begin + m_mappedSize;
+        }
+    }
+    close(fd);
+    if (m_begin
+        && (std::memcmp(m_begin, s_magic, sizeof(s_magic)) != 0
+            || m_begin[sizeof(s_magic)] != s_version)) {
+        munmap(const_cast<std::uint8_t *>(m_begin), m_mappedSize);
+        m_begin = m_end = nullptr;
+    }
+    m_current = m_begin ? m_begin + sizeof(s_magic) + 1 : nullptr;
+}
+
+TraceLogReader::~TraceLogReader() {
+    if (m_begin) {
+        munmap(const_cast<std::uint8_t *>(m_begin), m_mappedSize);
+    }
+}
+
+bool_t TraceLogReader::isOpen() const {
+    return m_begin != nullptr;
+}
+
+bool_t TraceLogReader::readModule() {
+    TraceLogModule module;
+    std::uint64_t index = 0;
+    std::uint64_t base = 0;
+    std::uint64_t size = 0;
+    std::uint64_t length = 0;
+    if (! getVarint(m_current, m_end, index)
+        || ! getVarint(m_current, m_end, base)
+        || ! getVarint(m_current, m_end, size)
+        || ! getVarint(m_current, m_end, length)
+        || length > static_cast<std::uint64_t>(m_end - m_current)) {
+        return false;
+    }
+    module.m_index = static_cast<std::uint32_t>(index);
+    module.m_base = base;
+    module.m_size = size;
+    module.m_buildId.assign(m_current, m_current + length);
+    m_current += length;
+    if (! getVarint(m_current, m_end, length)
+        || length > static_cast<std::uint64_t>(m_end - m_current)) {
+        return false;
+    }
+    module.m_path.assign(reinterpret_cast<const char *>(m_current), length);
+    m_current += length;
+    m_modules.push_back(std::move(module));
+    return true;
+}
+
+bool_t TraceLogReader::next(TraceLogTrace& o_trace) {
+    while (m_current && m_current < m_end) {
+        std::uint8_t type = *m_current++;
+        if (type == s_moduleRecord) {
+            if (! readModule()) {
+                m_corrupted = true;
+                return false;
+            }
+            continue;
+        }
+        std::uint64_t tag = 0;
+        std::uint64_t size = 0;
+        if (type != s_traceRecord
+            || ! getVarint(m_current, m_end, tag)
+            || m_current == m_end) {
+            m_corrupted = true;
+            return false;
+        }
+        std::uint8_t flags = *m_current++;
+        if (! getVarint(m_current, m_end, size)) {
+            m_corrupted = true;
+            return false;
+        }
+        o_trace.m_tag = tag;
+        o_trace.m_truncated = flags & s_truncatedFlag;
+        o_trace.m_frames.clear();
+        std::uint32_t previousModule = 0;
+        std::uintptr_t previousOffset = 0;
+        for (std::uint64_t i = 0; i < size; ++i) {
+            std::uint64_t index = 0;
+            std::uint64_t delta = 0;
+            if (! getVarint(m_current, m_end, index) || ! getVarint(m_current, m_end, delta)) {
+                m_corrupted = true;
+                return false;
+            }
+            std::uintptr_t offset = static_cast<std::uintptr_t>(unzigzag(delta));
+            if (index && index == previousModule) {
+                offset += previousOffset;
+            }
+            o_trace.m_frames.push_back({static_cast<std::uint32_t>(index), offset});
+            previousModule = static_cast<std::uint32_t>(index);
+            previousOffset = offset;
+        }
+        return true;
+    }
+    return false;
+}
+
+const std::vector<TraceLogModule>& TraceLogReader::modules() const {
+    return m_modules;
+}
+
+const TraceLogModule* TraceLogReader::module(std::uint32_t i_index) const {
+    for (const TraceLogModule& module : m_modules) {
+        if (module.m_index == i_index) {
+            return &module;
+        }
+    }
+    return nullptr;
+}
+
+bool_t TraceLogReader::corrupted() const {
+    return m_corrupted;
+}
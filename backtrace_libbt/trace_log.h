@@ -0,0 +1,151 @@
+#ifndef _BKTCE_TRACE_LOG_H
+#define _BKTCE_TRACE_LOG_H
+
+#include "bktce.h"
+#include "raw_stacktrace.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//! A compact binary log of raw stack traces, symbolized offline by the
+//! bktce_symbolize tool;
+//! The process only pays for capturing: a trace is encoded as
+//! (module, offset) pairs and appended with a single write(2); the
+//! names, files and lines are looked up later, possibly on another
+//! machine, from the modules' files (or their separate debug info,
+//! found through the build-ids recorded in the log);
+//! Format (all integers are LEB128 varints unless noted):
+//!   file   := "BKTCELOG" u8:version record*
+//!   record := 'M' index base size buildIdLength buildId pathLength path
+//!           | 'T' tag u8:flags numFrames frame*
+//!   frame  := module delta
+//! A module record describes a loaded module: its 1-based index, its
+//! load bias (dlpi_addr), the size of its address range, its GNU
+//! build-id and its path; modules are recorded when the log is opened
+//! and when a trace refers to a module loaded since;
+//! In a trace record, bit 0 of flags is the truncated flag; module is
+//! the index of the frame's module, or 0 for a PC outside of every
+//! module; the frame's offset is PC - base (the PC itself if module is
+//! 0); delta is the zigzag-encoded difference between the offset and
+//! the previous frame's offset if both frames are in the same module,
+//! else the zigzag-encoded offset;
+//! The file can be mmap()-ed and decoded in place (TraceLogReader)
+class TraceLogWriter {
+public:
+    static const std::size_t s_maxFrames = 256;
+
+    //! Creates (truncates) the log file and records the loaded modules
+    explicit TraceLogWriter(const char* i_path);
+    ~TraceLogWriter();
+
+    bool_t isOpen() const;
+
+    //! Appends one trace; first looks at the loader's counters (one
+    //! dl_iterate_phdr() step) and records the modules loaded or
+    //! unloaded since the last scan; never allocates unless they moved;
+    //! returns false on I/O error
+    bool_t write(const native_frame_ptr_t* i_begin,
+                 std::size_t i_size,
+                 bool_t i_truncated,
+                 std::uint64_t i_tag = 0);
+
+    template<std::size_t N>
+    bool_t write(const RawStacktrace<N>& i_stack, std::uint64_t i_tag = 0) {
+        return write(i_stack.begin(), i_stack.size(), i_stack.truncated(), i_tag);
+    }
+
+    //! Records the modules loaded since the last scan
+    void refreshModules();
+
+private:
+    struct Module {
+        std::uintptr_t m_begin;
+        std::uintptr_t m_end;
+        std::uintptr_t m_base;
+        std::uint32_t m_index;
+    };
+
+    //! immutable once published; replaced tables are kept until the
+    //! writer is destroyed since a concurrent write() may be using them
+    struct ModuleTable {
+        std::vector<Module> m_modules;
+    };
+
+    TraceLogWriter(const TraceLogWriter&) = delete;
+    TraceLogWriter& operator=(const TraceLogWriter&) = delete;
+
+    const Module* findModule(std::uintptr_t i_pc) const;
+
+    int m_fd;
+    std::mutex m_mutex;
+    std::atomic<const ModuleTable*> m_modules;
+    std::vector<const ModuleTable*> m_retired;
+    //! the index of every module recorded, by (base, path)
+    std::map<std::pair<std::uintptr_t, string_t>, std::uint32_t> m_recorded;
+    std::atomic<unsigned long long> m_loadGeneration;
+};
+
+//! A module record of a trace log
+struct TraceLogModule {
+    std::uint32_t m_index;
+    std::uintptr_t m_base;
+    std::uintptr_t m_size;
+    std::vector<std::uint8_t> m_buildId;
+    string_t m_path;
+};
+
+//! A frame of a trace record
+struct TraceLogFrame {
+    //! 0 if the PC is outside of every module
+    std::uint32_t m_module;
+    //! PC - base of the module (the PC if m_module is 0)
+    std::uintptr_t m_offset;
+};
+
+//! A trace record of a trace log
+struct TraceLogTrace {
+    std::uint64_t m_tag;
+    bool_t m_truncated;
+    std::vector<TraceLogFrame> m_frames;
+};
+
+//! Decodes a trace log mapped into memory
+class TraceLogReader {
+public:
+    explicit TraceLogReader(const char* i_path);
+    ~TraceLogReader();
+
+    //! The file is mapped and has a valid header
+    bool_t isOpen() const;
+
+    //! Decodes the next trace; the module records found on the way are
+    //! added to modules(); returns false at the end of the log (or at
+    //! a corrupted record, see corrupted())
+    bool_t next(TraceLogTrace& o_trace);
+
+    //! The module records read so far
+    const std::vector<TraceLogModule>& modules() const;
+
+    //! The module with index i_index, nullptr if not read (yet)
+    const TraceLogModule* module(std::uint32_t i_index) const;
+
+    bool_t corrupted() const;
+
+private:
+    TraceLogReader(const TraceLogReader&) = delete;
+    TraceLogReader& operator=(const TraceLogReader&) = delete;
+
+    bool_t readModule();
+
+    const std::uint8_t* m_begin;
+    const std::uint8_t* m_end;
+    const std::uint8_t* m_current;
+    std::size_t m_mappedSize;
+    bool_t m_corrupted;
+    std::vector<TraceLogModule> m_modules;
+};
+
+#endif // _BKTCE_TRACE_LOG_H
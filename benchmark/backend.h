@@ -0,0 +1,40 @@
+#ifndef _BKTCE_BENCH_BACKEND_H
+#define _BKTCE_BENCH_BACKEND_H
+
+#include <cstddef>
+
+//! One way of capturing a stack trace
+struct Capture {
+    //! the name in the results table
+    const char* m_name;
+
+    //! writes at most i_capacity return addresses of the calling stack
+    //! to o_frames, innermost first; returns the number written
+    std::size_t (*m_capture)(void** o_frames, std::size_t i_capacity);
+};
+
+//! A stack trace library under test; every benchmark executable is
+//! linked with exactly one backend (the boost backends can not share a
+//! process: they are the same header-only code configured differently)
+struct Backend {
+    const char* m_name;
+
+    //! the capture methods, terminated by {nullptr, nullptr}
+    const Capture* m_captures;
+
+    //! symbolizes the frames the way a program printing a trace would
+    //! (function, source file and line where the backend provides them);
+    //! returns the number of characters produced, so that the work can
+    //! not be optimized away
+    std::size_t (*m_symbolize)(void* const* i_frames, std::size_t i_size);
+
+    //! empties the backend's own caches of symbolized frames so that the
+    //! underlying debug info lookup can be measured; nullptr if there
+    //! are none
+    void (*m_dropCaches)();
+};
+
+//! defined by backend_<name>.cpp
+const Backend& benchBackend();
+
+#endif // _BKTCE_BENCH_BACKEND_H
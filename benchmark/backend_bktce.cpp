@@ -0,0 +1,58 @@
+
+#include "backend.h"
+
+#include "bktce.h"
+#include "frame_cache.h"
+#include "raw_stacktrace.h"
+
+//! bktce: the three unwinders, symbolized through Stacktrace (batched
+//! libbacktrace lookups, demangling, FrameCache)
+
+namespace {
+
+template<UnwindBackend B>
+std::size_t capture(void** o_frames, std::size_t i_capacity) {
+    bool_t truncated = false;
+    std::size_t size = 0;
+    switch (B) {
+    case UnwindBackend::Cfi:
+        size = unwindStackCfi(const_cast<native_frame_ptr_t *>(o_frames), i_capacity, 0, &truncated);
+        break;
+    case UnwindBackend::FramePointer:
+        size = unwindStackFramePointer(const_cast<native_frame_ptr_t *>(o_frames), i_capacity, 0, &truncated);
+        break;
+    case UnwindBackend::CachedCfi:
+        size = unwindStackCachedCfi(const_cast<native_frame_ptr_t *>(o_frames), i_capacity, 0, &truncated);
+        break;
+    }
+    return size;
+}
+
+std::size_t symbolize(void* const* i_frames, std::size_t i_size) {
+    const native_frame_ptr_t* frames = const_cast<const native_frame_ptr_t *>(i_frames);
+    Stacktrace st(frames, frames + i_size);
+    st.resolve();
+    std::size_t length = 0;
+    for (const Frame& frame : st.getFrames()) {
+        length += frame.getFunction().size() + frame.getSourceFilename().size() + 8;
+    }
+    return length;
+}
+
+void dropCaches() {
+    FrameCache::instance().clear();
+}
+
+const Capture s_captures[] = {
+    {"bktce-cfi", &capture<UnwindBackend::Cfi>},
+    {"bktce-fp", &capture<UnwindBackend::FramePointer>},
+    {"bktce-cached-cfi", &capture<UnwindBackend::CachedCfi>},
+    {nullptr, nullptr}
+};
+
+}
+
+const Backend& benchBackend() {
+    static const Backend backend = {"bktce", s_captures, &symbolize, &dropCaches};
+    return backend;
+}
@@ -0,0 +1,48 @@
+
+#include "backend.h"
+
+//! boost.stacktrace in header-only mode; the build compiles this file
+//! twice, with BOOST_STACKTRACE_USE_BACKTRACE (libbacktrace, provided
+//! by bktce's copy) or with BOOST_STACKTRACE_USE_ADDR2LINE (runs the
+//! addr2line program for every frame)
+#include <boost/stacktrace.hpp>
+
+namespace {
+
+#if defined(BOOST_STACKTRACE_USE_BACKTRACE)
+const char* const s_name = "boost-backtrace";
+#elif defined(BOOST_STACKTRACE_USE_ADDR2LINE)
+const char* const s_name = "boost-addr2line";
+#else
+const char* const s_name = "boost";
+#endif
+
+std::size_t capture(void** o_frames, std::size_t i_capacity) {
+    boost::stacktrace::stacktrace st(0, i_capacity);
+    std::size_t size = st.size();
+    for (std::size_t i = 0; i < size; ++i) {
+        o_frames[i] = const_cast<void *>(st[i].address());
+    }
+    return size;
+}
+
+std::size_t symbolize(void* const* i_frames, std::size_t i_size) {
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < i_size; ++i) {
+        boost::stacktrace::frame frame(i_frames[i]);
+        length += boost::stacktrace::to_string(frame).size();
+    }
+    return length;
+}
+
+const Capture s_captures[] = {
+    {s_name, &capture},
+    {nullptr, nullptr}
+};
+
+}
+
+const Backend& benchBackend() {
+    static const Backend backend = {s_name, s_captures, &symbolize, nullptr};
+    return backend;
+}
@@ -0,0 +1,42 @@
+
+#include "backend.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <execinfo.h>
+
+//! glibc's backtrace() and backtrace_symbols(): binary file, symbol
+//! (exported functions only) and offset; no source information
+
+namespace {
+
+std::size_t capture(void** o_frames, std::size_t i_capacity) {
+    int size = backtrace(o_frames, static_cast<int>(i_capacity));
+    return size > 0 ? size : 0;
+}
+
+std::size_t symbolize(void* const* i_frames, std::size_t i_size) {
+    char** symbols = backtrace_symbols(i_frames, static_cast<int>(i_size));
+    if (! symbols) {
+        return 0;
+    }
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < i_size; ++i) {
+        length += std::strlen(symbols[i]);
+    }
+    free(symbols);
+    return length;
+}
+
+const Capture s_captures[] = {
+    {"gnu", &capture},
+    {nullptr, nullptr}
+};
+
+}
+
+const Backend& benchBackend() {
+    static const Backend backend = {"gnu", s_captures, &symbolize, nullptr};
+    return backend;
+}
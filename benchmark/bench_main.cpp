@@ -0,0 +1,195 @@
+
+//! Measures one stack trace backend (see backend.h) and appends the
+//! results to a table; run every bktce_bench_* executable (or the
+//! run_benchmarks target) to compare them
+//!
+//! usage: bktce_bench_<backend> [--depths 4,16,64,256]
+//!                              [--symbolize-depth 16]
+//!                              [--iterations 1000] [--budget-ms 1000]
+//!                              [--output results.csv [--append]]
+//!
+//! the table is CSV: backend,metric,depth,frames,value,unit
+//! - capture, capture_p99: the latency of capturing a trace at "depth"
+//!   levels of recursion in the workload ("frames" is what the backend
+//!   returned); one row per capture method; capture is the median of
+//!   the averages of batches of 16 captures, capture_p99 the 99th
+//!   percentile of captures timed one by one, less the cost of
+//!   reading the clock
+//! - cold_symbolize: the first symbolization of a trace in the process,
+//!   which includes reading the debug info
+//! - cold_rss: the resident memory the first symbolization added
+//! - warm_symbolize: per frame, symbolizing the same trace again
+//! - warm_symbolize_uncached: the same, with the backend's own caches
+//!   of symbolized frames dropped before each round
+//! - peak_rss: the peak resident memory of the process at the end
+
+#include "backend.h"
+#include "bench_util.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+const std::size_t s_maxFrames = 1024;
+const std::size_t s_batchSize = 16;
+
+const char* const s_usage = "[--depths 4,16,64,256] [--symbolize-depth N]"
+                            " [--iterations N] [--budget-ms N]";
+
+struct Options : OutputOptions {
+    std::vector<std::size_t> m_depths = {4, 16, 64, 256};
+    std::size_t m_symbolizeDepth = 16;
+    std::size_t m_iterations = 1000;
+    std::size_t m_budgetMs = 1000;
+};
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    parseCommandLine(argc, argv, s_usage, options, [&](const std::string& i_name, const char* i_value) {
+        if (i_name == "--depths") {
+            return parseList(i_value, options.m_depths);
+        } else if (i_name == "--symbolize-depth") {
+            options.m_symbolizeDepth = std::strtoul(i_value, nullptr, 10);
+        } else if (i_name == "--iterations") {
+            options.m_iterations = std::max<std::size_t>(1, std::strtoul(i_value, nullptr, 10));
+        } else if (i_name == "--budget-ms") {
+            options.m_budgetMs = std::strtoul(i_value, nullptr, 10);
+        } else {
+            return false;
+        }
+        return true;
+    });
+    return options;
+}
+
+std::size_t residentKb() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0;
+    std::size_t resident = 0;
+    statm >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+std::size_t peakResidentKb() {
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+//! what the probe does at the bottom of the workload
+struct CaptureRun {
+    const Capture* m_capture;
+    const Options* m_options;
+    void** m_frames;
+    std::size_t m_size;
+    //! the average capture of each batch
+    std::vector<double> m_batchSamples;
+    //! every capture of the timed ones
+    std::vector<double> m_samples;
+};
+
+//! what reading the clock around an interval adds to it
+double clockOverheadNs() {
+    std::vector<double> samples;
+    for (std::size_t i = 0; i < 1000; ++i) {
+        clock_type::time_point begin = clock_type::now();
+        samples.push_back(elapsedNs(begin, clock_type::now()));
+    }
+    return percentile(samples, 0.5);
+}
+
+void captureOnce(void* io_data) {
+    CaptureRun* run = static_cast<CaptureRun *>(io_data);
+    run->m_size = run->m_capture->m_capture(run->m_frames, s_maxFrames);
+}
+
+void captureRepeatedly(void* io_data) {
+    CaptureRun* run = static_cast<CaptureRun *>(io_data);
+    std::size_t numBatches = (run->m_options->m_iterations + s_batchSize - 1) / s_batchSize;
+    double overhead = clockOverheadNs();
+    clock_type::time_point deadline = clock_type::now() + std::chrono::milliseconds(run->m_options->m_budgetMs);
+    run->m_batchSamples.reserve(numBatches);
+    run->m_samples.reserve(numBatches * s_batchSize);
+    for (std::size_t i = 0; i < numBatches; ++i) {
+        clock_type::time_point begin = clock_type::now();
+        for (std::size_t j = 0; j < s_batchSize; ++j) {
+            run->m_size = run->m_capture->m_capture(run->m_frames, s_maxFrames);
+        }
+        clock_type::time_point end = clock_type::now();
+        run->m_batchSamples.push_back(elapsedNs(begin, end) / s_batchSize);
+
+        //! a batch average hides the slow captures: time them one by one
+        for (std::size_t j = 0; j < s_batchSize; ++j) {
+            begin = clock_type::now();
+            run->m_size = run->m_capture->m_capture(run->m_frames, s_maxFrames);
+            end = clock_type::now();
+            run->m_samples.push_back(std::max(0.0, elapsedNs(begin, end) - overhead));
+        }
+        if (end > deadline) {
+            break;
+        }
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    const Backend& backend = benchBackend();
+    ResultTable table(options, "backend,metric,depth,frames,value,unit");
+    std::vector<void *> frames(s_maxFrames, nullptr);
+    volatile std::size_t sink = 0;
+
+    //! the trace that gets symbolized; capturing it first also takes
+    //! the unwinder's own initialization out of the cold measurement
+    CaptureRun run = {backend.m_captures, &options, frames.data(), 0, {}, {}};
+    runAtDepth(options.m_symbolizeDepth, &captureOnce, &run);
+    std::size_t size = run.m_size;
+
+    std::size_t rssBefore = residentKb();
+    clock_type::time_point begin = clock_type::now();
+    sink = sink + backend.m_symbolize(frames.data(), size);
+    clock_type::time_point end = clock_type::now();
+    std::size_t rssAfter = residentKb();
+    table.add(backend.m_name, "cold_symbolize", options.m_symbolizeDepth, size, elapsedNs(begin, end) / 1000.0, "us");
+    table.add(backend.m_name, "cold_rss", options.m_symbolizeDepth, size, rssAfter > rssBefore ? rssAfter - rssBefore : 0, "KiB");
+
+    auto measureWarm = [&](const char* i_metric, void (*i_prepare)()) {
+        std::vector<double> samples;
+        clock_type::time_point deadline = clock_type::now() + std::chrono::milliseconds(options.m_budgetMs);
+        for (std::size_t i = 0; i < options.m_iterations && clock_type::now() < deadline; ++i) {
+            if (i_prepare) {
+                i_prepare();
+            }
+            clock_type::time_point b = clock_type::now();
+            sink = sink + backend.m_symbolize(frames.data(), size);
+            samples.push_back(elapsedNs(b, clock_type::now()) / std::max<std::size_t>(1, size));
+        }
+        table.add(backend.m_name, i_metric, options.m_symbolizeDepth, size, percentile(samples, 0.5), "ns/frame");
+    };
+    measureWarm("warm_symbolize", nullptr);
+    if (backend.m_dropCaches) {
+        measureWarm("warm_symbolize_uncached", backend.m_dropCaches);
+    }
+
+    for (const Capture* capture = backend.m_captures; capture->m_name; ++capture) {
+        for (std::size_t depth : options.m_depths) {
+            CaptureRun depthRun = {capture, &options, frames.data(), 0, {}, {}};
+            runAtDepth(depth, &captureRepeatedly, &depthRun);
+            table.add(capture->m_name, "capture", depth, depthRun.m_size, percentile(depthRun.m_batchSamples, 0.5), "ns");
+            table.add(capture->m_name, "capture_p99", depth, depthRun.m_size, percentile(depthRun.m_samples, 0.99), "ns");
+        }
+    }
+
+    table.add(backend.m_name, "peak_rss", 0, 0, peakResidentKb(), "KiB");
+    return 0;
+}
@@ -0,0 +1,205 @@
+
+//! Measures how one libbacktrace state in threaded mode scales when
+//! many threads capture and symbolize at the same time (the state that
+//! Symbolizer shares across the process)
+//!
+//! usage: bktce_bench_threads [--threads 1,2,4,8] [--duration-ms 1000]
+//!                            [--depth 16] [--output FILE [--append]]
+//!
+//! For every thread count a fresh state is created and the threads are
+//! released on it together, as in a service that starts symbolizing
+//! from all its workers at once; every thread then loops, capturing a
+//! trace (alternately the path shared by all threads and a path of its
+//! own, see numWorkloadVariants()) and symbolizing each of its frames
+//! with backtrace_pcinfo();
+//! the table is CSV: threads,metric,value,unit
+//! - throughput: traces captured and symbolized per second, all threads
+//! - latency_p50, latency_p99, latency_p999: of one trace, excluding
+//!   the first trace of each thread
+//! - first_trace_max: the slowest first trace, which waits for (or
+//!   duplicates) the reading of the debug info
+//! - initializations, units_read, units_reread, symbol_only,
+//!   alloc_lock_misses, alloc_mapped: the state's counters (see
+//!   backtrace_get_stats()); initializations above 1 and units_reread
+//!   are the parse work the threads duplicated, symbol_only the lookups
+//!   that gave up waiting for another thread's parse
+//! The states are never freed (libbacktrace can not free them), so the
+//! memory use grows with every round
+
+#include "bench_util.h"
+#include "raw_stacktrace.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <backtrace.h>
+
+namespace {
+
+const std::size_t s_maxFrames = 256;
+
+const char* const s_usage = "[--threads 1,2,4,8] [--duration-ms N] [--depth N]";
+
+struct Options : OutputOptions {
+    std::vector<std::size_t> m_threads;
+    std::size_t m_durationMs = 1000;
+    std::size_t m_depth = 16;
+};
+
+//! 1, 2, 4, ... up to the number of cores, and the number of cores
+std::vector<std::size_t> defaultThreadCounts() {
+    std::size_t numCores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::size_t> counts;
+    for (std::size_t n = 1; n < numCores; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(numCores);
+    return counts;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    parseCommandLine(argc, argv, s_usage, options, [&](const std::string& i_name, const char* i_value) {
+        if (i_name == "--threads") {
+            return parseList(i_value, options.m_threads)
+                && std::find(options.m_threads.begin(), options.m_threads.end(), 0) == options.m_threads.end();
+        } else if (i_name == "--duration-ms") {
+            options.m_durationMs = std::strtoul(i_value, nullptr, 10);
+        } else if (i_name == "--depth") {
+            options.m_depth = std::strtoul(i_value, nullptr, 10);
+        } else {
+            return false;
+        }
+        return true;
+    });
+    if (options.m_threads.empty()) {
+        options.m_threads = defaultThreadCounts();
+    }
+    return options;
+}
+
+void errorCallback(void*, const char*, int) {
+}
+
+int countCallback(void* io_data, uintptr_t, const char*, int, const char* i_function) {
+    if (i_function) {
+        ++*static_cast<std::size_t *>(io_data);
+    }
+    return 0;
+}
+
+//! one thread of a round
+struct Worker {
+    backtrace_state* m_state = nullptr;
+    std::size_t m_index = 0;
+    std::vector<double> m_latencies;
+    double m_firstLatency = 0.0;
+    std::size_t m_numResolved = 0;
+};
+
+//! the probe: captures the trace then symbolizes every frame
+void captureAndSymbolize(void* io_data) {
+    Worker* worker = static_cast<Worker *>(io_data);
+    native_frame_ptr_t frames[s_maxFrames];
+    bool_t truncated = false;
+    std::size_t size = unwindStack(frames, s_maxFrames, 0, &truncated);
+    for (std::size_t i = 0; i < size; ++i) {
+        //! look a return address up at the call instruction
+        uintptr_t pc = reinterpret_cast<uintptr_t>(frames[i]) - (i ? 1 : 0);
+        backtrace_pcinfo(worker->m_state, pc, &countCallback, &errorCallback, &worker->m_numResolved);
+    }
+}
+
+void runRound(const Options& i_options, std::size_t i_numThreads, ResultTable& io_table) {
+    backtrace_state* state = backtrace_create_state(nullptr, 1, &errorCallback, nullptr);
+    if (! state) {
+        std::cerr << "can not create the libbacktrace state" << std::endl;
+        std::exit(1);
+    }
+
+    std::vector<Worker> workers(i_numThreads);
+    std::atomic<bool> go(false);
+    std::atomic<std::size_t> numReady(0);
+    clock_type::time_point deadline;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < i_numThreads; ++i) {
+        workers[i].m_state = state;
+        workers[i].m_index = i;
+        threads.emplace_back([&, i]() {
+            Worker& worker = workers[i];
+            worker.m_latencies.reserve(1 << 16);
+            numReady.fetch_add(1);
+            while (! go.load(std::memory_order_acquire)) {
+            }
+            for (std::size_t n = 0; ; ++n) {
+                //! every other trace goes through this thread's own path
+                std::size_t variant = n % 2 ? 1 + worker.m_index % (numWorkloadVariants() - 1) : 0;
+                clock_type::time_point begin = clock_type::now();
+                runAtDepth(i_options.m_depth, &captureAndSymbolize, &worker, variant);
+                clock_type::time_point end = clock_type::now();
+                if (n) {
+                    worker.m_latencies.push_back(elapsedNs(begin, end));
+                } else {
+                    worker.m_firstLatency = elapsedNs(begin, end);
+                }
+                if (end > deadline) {
+                    break;
+                }
+            }
+        });
+    }
+    while (numReady.load() != i_numThreads) {
+        std::this_thread::yield();
+    }
+    clock_type::time_point begin = clock_type::now();
+    deadline = begin + std::chrono::milliseconds(i_options.m_durationMs);
+    go.store(true, std::memory_order_release);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double seconds = elapsedNs(begin, clock_type::now()) / 1e9;
+
+    std::vector<double> latencies;
+    double firstLatency = 0.0;
+    for (const Worker& worker : workers) {
+        latencies.insert(latencies.end(), worker.m_latencies.begin(), worker.m_latencies.end());
+        firstLatency = std::max(firstLatency, worker.m_firstLatency);
+    }
+    backtrace_stats stats;
+    backtrace_get_stats(state, &stats);
+
+    io_table.add(i_numThreads, "throughput", (latencies.size() + i_numThreads) / seconds, "traces/s");
+    io_table.add(i_numThreads, "latency_p50", percentile(latencies, 0.5) / 1000.0, "us");
+    io_table.add(i_numThreads, "latency_p99", percentile(latencies, 0.99) / 1000.0, "us");
+    io_table.add(i_numThreads, "latency_p999", percentile(latencies, 0.999) / 1000.0, "us");
+    io_table.add(i_numThreads, "first_trace_max", firstLatency / 1000.0, "us");
+    io_table.add(i_numThreads, "initializations", stats.initializations, "count");
+    io_table.add(i_numThreads, "units_read", stats.units_read, "count");
+    io_table.add(i_numThreads, "units_reread", stats.units_reread, "count");
+    io_table.add(i_numThreads, "symbol_only", stats.symbol_only, "count");
+    io_table.add(i_numThreads, "alloc_lock_misses", stats.alloc_lock_misses, "count");
+    io_table.add(i_numThreads, "alloc_mapped", stats.alloc_mapped_bytes / 1024, "KiB");
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    ResultTable table(options, "threads,metric,value,unit");
+
+    //! initializes libgcc's unwinder, which is not what is measured
+    RawStacktrace<4> warmUp;
+    (void)warmUp;
+
+    for (std::size_t numThreads : options.m_threads) {
+        runRound(options, numThreads, table);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef _BKTCE_BENCH_UTIL_H
+#define _BKTCE_BENCH_UTIL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//! What the benchmark executables share: timing, the results table and
+//! the parsing of their command lines
+
+using clock_type = std::chrono::steady_clock;
+
+inline double elapsedNs(clock_type::time_point i_begin, clock_type::time_point i_end) {
+    return std::chrono::duration<double, std::nano>(i_end - i_begin).count();
+}
+
+inline double percentile(std::vector<double> io_samples, double i_fraction) {
+    if (io_samples.empty()) {
+        return 0.0;
+    }
+    std::size_t index = static_cast<std::size_t>(i_fraction * (io_samples.size() - 1));
+    std::nth_element(io_samples.begin(), io_samples.begin() + index, io_samples.end());
+    return io_samples[index];
+}
+
+//! the options of every benchmark: where the table goes
+struct OutputOptions {
+    std::string m_output;
+    bool m_append = false;
+};
+
+//! i_options: the options of the benchmark, before the output ones
+[[noreturn]] inline void usage(const char* i_program, const char* i_options) {
+    std::cerr << "usage: " << i_program << ' ' << i_options
+              << " [--output FILE [--append]]" << std::endl;
+    std::exit(2);
+}
+
+//! Reads "--output FILE" and "--append" into o_options and hands every
+//! other "--name value" pair to i_parse(name, value), which returns
+//! false if it does not know the name; exits through usage() on an
+//! unknown option
+template <typename Parse>
+void parseCommandLine(int argc, char** argv, const char* i_usage,
+                      OutputOptions& o_options, Parse i_parse) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--append") {
+            o_options.m_append = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0], i_usage);
+        }
+        const char* value = argv[++i];
+        if (arg == "--output") {
+            o_options.m_output = value;
+        } else if (! i_parse(arg, value)) {
+            usage(argv[0], i_usage);
+        }
+    }
+}
+
+//! Parses a comma-separated list of numbers ("4,16,64") into o_values;
+//! returns false if an item is not a number
+inline bool parseList(const char* i_value, std::vector<std::size_t>& o_values) {
+    o_values.clear();
+    for (const char* p = i_value; *p; ) {
+        char* end = nullptr;
+        std::size_t value = std::strtoul(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+        o_values.push_back(value);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+//! A CSV table written to the --output file, or to the standard output;
+//! the header line is only written to an empty file, so that several
+//! runs can --append to the same table
+class ResultTable {
+public:
+    ResultTable(const OutputOptions& i_options, const char* i_columns) {
+        if (! i_options.m_output.empty()) {
+            m_file.open(i_options.m_output, i_options.m_append ? std::ios::app : std::ios::trunc);
+            if (! m_file) {
+                std::cerr << "can not open " << i_options.m_output << std::endl;
+                std::exit(1);
+            }
+            m_file.seekp(0, std::ios::end);
+        }
+        if (! m_file.is_open() || m_file.tellp() == 0) {
+            stream() << i_columns << '\n';
+        }
+    }
+
+    //! writes one row, a value per column
+    template <typename First, typename... Rest>
+    void add(const First& i_first, const Rest&... i_rest) {
+        std::ostream& out = stream();
+        out << i_first;
+        ((out << ',' << i_rest), ...);
+        out << '\n';
+        out.flush();
+    }
+
+private:
+    std::ostream& stream() {
+        return m_file.is_open() ? static_cast<std::ostream&>(m_file) : std::cout;
+    }
+
+    std::ofstream m_file;
+};
+
+#endif // _BKTCE_BENCH_UTIL_H
@@ -0,0 +1,64 @@
+
+#include "workload.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using GroupType = vector<pair<string, string>>;
+using DictType = map<int, GroupType>;
+
+template<typename T>
+struct Status {
+    T m_flag = 0;
+    explicit Status(const T& i_value) : m_flag(i_value) {}
+};
+
+template<std::size_t N>
+__attribute__((noinline))
+void branch(probe_t i_probe, void* io_data) {
+    volatile std::size_t salt = N;
+    (void)salt;
+    i_probe(io_data);
+    __asm__ __volatile__("" ::: "memory");
+}
+
+using branch_t = void (*)(probe_t, void*);
+
+template<std::size_t... Ns>
+constexpr std::array<branch_t, sizeof...(Ns)> makeBranches(std::index_sequence<Ns...>) {
+    return {{&branch<Ns>...}};
+}
+
+const auto s_branches = makeBranches(std::make_index_sequence<16>());
+
+Status<int> generator(DictType& o_dict, probe_t i_probe, void* io_data, std::size_t i_variant) {
+    std::vector<int> elements(1, 0);
+    for_each(
+        elements.begin(),
+        elements.end(),
+        [&](int& elem) {
+            GroupType& group = o_dict[elem];
+            group.emplace_back(pair<string, string>{"phrase", "x12"});
+            s_branches[i_variant % s_branches.size()](i_probe, io_data);
+            group.emplace_back(pair<string, string>{"code", "dsm"});
+        });
+    return Status<int>(1);
+}
+
+std::size_t numWorkloadVariants() {
+    return s_branches.size();
+}
+
+void sut(probe_t i_probe, void* io_data, std::size_t i_variant) {
+    DictType dict;
+    Status<int> status = generator(dict, i_probe, io_data, i_variant);
+    if (! status.m_flag) {
+        exit(1);
+    }
+}
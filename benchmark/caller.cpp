@@ -0,0 +1,32 @@
+
+#include "workload.h"
+
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Target {
+    probe_t m_probe;
+    void* m_data;
+    std::size_t m_variant;
+};
+
+__attribute__((noinline))
+void searchAndCall(const vector<int>& elems, std::size_t index, const Target& target) {
+    if (! index) {
+        sut(target.m_probe, target.m_data, target.m_variant);
+        return;
+    }
+    searchAndCall(elems, index - 1, target);
+    //! not a tail call: keeps one frame per level
+    __asm__ __volatile__("" ::: "memory");
+}
+
+}
+
+void runAtDepth(std::size_t i_depth, probe_t i_probe, void* io_data, std::size_t i_variant) {
+    Target target = {i_probe, io_data, i_variant};
+    searchAndCall({0xDE, 0xAD, 0xBE, 0, 0xEF}, i_depth, target);
+}
@@ -0,0 +1,26 @@
+#ifndef _BKTCE_BENCH_WORKLOAD_H
+#define _BKTCE_BENCH_WORKLOAD_H
+
+#include <cstddef>
+
+//! The code the benchmarks capture from; it has the shape of the
+//! caller/callee examples: a recursion in the executable (caller.cpp)
+//! that calls into a shared library (callee.cpp), which reaches the
+//! probe through a couple of templates and a lambda; the traces
+//! therefore cross a module boundary and contain inlined frames
+using probe_t = void (*)(void* io_data);
+
+//! the number of different paths sut() can take to the probe; each one
+//! goes through functions of its own, so that the traces of two
+//! variants share the outer frames but not the inner ones
+std::size_t numWorkloadVariants();
+
+//! calls i_probe below i_depth frames of recursion (plus the frames of
+//! sut() and of the caller), through the path i_variant
+void runAtDepth(std::size_t i_depth, probe_t i_probe, void* io_data,
+                std::size_t i_variant = 0);
+
+//! the entry point of the shared library
+void sut(probe_t i_probe, void* io_data, std::size_t i_variant);
+
+#endif // _BKTCE_BENCH_WORKLOAD_H